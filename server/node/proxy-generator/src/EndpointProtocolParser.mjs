@@ -30,6 +30,18 @@ import xml2js from "xml2js";
 import camelCase from "camelcase";
 import ProtocolArguments from "./EndpointProtocolArguments.mjs";
 
+// Requests that westfield-proxy looks at itself, by interface and request name. The generated glue hands them to the
+// named westfield-proxy function, which returns where the request should go.
+const proxyRequestInterceptions = {
+  wl_pointer: {
+    set_cursor: "interceptSetCursor",
+  },
+  wl_surface: {
+    attach: "interceptSurfaceAttach",
+    commit: "interceptSurfaceCommit",
+  },
+};
+
 export default class EndpointProtocolParser {
   static _parseMessageInterfaces(itfMessage, itfName) {
     let argInterfaces = "[";
@@ -88,7 +100,16 @@ export default class EndpointProtocolParser {
       evSig = EndpointProtocolParser._parseMessageSignature(itfRequest);
     }
     const evName = camelCase(itfRequest.$.name);
-    if (evSig.includes("n")) {
+    const proxyInterception =
+      proxyRequestInterceptions[protocolItf.$.name]?.[itfRequest.$.name];
+    if (proxyInterception) {
+      out.write(`\tR${opcode} (message) {\n`);
+      out.write(`\t\tconst args = unmarshallArgs(message,'${evSig}')\n`);
+      out.write(
+        `\t\treturn require('westfield-proxy').${proxyInterception}(this, ...args)\n`
+      );
+      out.write("\t}\n");
+    } else if (evSig.includes("n")) {
       out.write(`\tR${opcode} (message) {\n`);
       out.write(`\t\tconst args = unmarshallArgs(message,'${evSig}')\n`);
       out.write(`\t\treturn this.requestHandlers.${evName}(...args)\n`);
@@ -208,6 +229,7 @@ export default class EndpointProtocolParser {
       "\tconstructor (wlClient, interceptors, version, wlResource, userData, creationArgs, id) {\n"
     );
     interceptorOut.write("\t\tthis.wlClient = wlClient\n");
+    interceptorOut.write("\t\tthis.interceptors = interceptors\n");
     interceptorOut.write("\t\tthis.wlResource = wlResource\n");
     interceptorOut.write("\t\tthis.userData = userData\n");
     interceptorOut.write("\t\tthis.creationArgs = creationArgs\n");
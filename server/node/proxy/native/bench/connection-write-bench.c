@@ -0,0 +1,195 @@
+/*
+ * Compares the two ways wl_resource_post_event serializes an event that only carries fixed size arguments: straight
+ * into the out buffer with wl_connection_write_fixed, or through a closure with wl_closure_marshal, wl_closure_send and
+ * wl_closure_destroy as before, and as still done when the protocol is logged.
+ *
+ * The events are written to a wl_connection on a socketpair in batches that fit in its out buffer. Only the writes are
+ * timed, the flush and the read on the other end of the socketpair are not, so the numbers show the cost of
+ * serializing an event, not of the socket. Each number is the best of a few runs:
+ *
+ *   connection-write-bench [events per run]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wayland-private.h"
+#include "wayland-server-protocol.h"
+
+#define RUNS 5
+#define OUT_BUFFER_SIZE 4096
+
+struct event {
+    const char *name;
+    const struct wl_interface *interface;
+    uint32_t opcode;
+};
+
+static const struct event events[] = {
+        { "wl_callback.done", &wl_callback_interface, WL_CALLBACK_DONE },
+        { "wl_surface.enter", &wl_surface_interface, WL_SURFACE_ENTER },
+        { "wl_pointer.motion", &wl_pointer_interface, WL_POINTER_MOTION },
+        { "wl_pointer.button", &wl_pointer_interface, WL_POINTER_BUTTON },
+        { "wl_keyboard.modifiers", &wl_keyboard_interface, WL_KEYBOARD_MODIFIERS },
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int
+write_fixed(struct wl_connection *connection, struct wl_object *sender, uint32_t opcode, union wl_argument *args)
+{
+    return wl_connection_write_fixed(connection, sender->id, opcode, &sender->interface->events[opcode], args, false);
+}
+
+static int
+write_closure(struct wl_connection *connection, struct wl_object *sender, uint32_t opcode, union wl_argument *args)
+{
+    struct wl_closure *closure;
+    int result;
+
+    closure = wl_closure_marshal(sender, opcode, args, &sender->interface->events[opcode]);
+    if (closure == NULL)
+        return -1;
+
+    result = wl_closure_send(closure, connection);
+    wl_closure_destroy(closure);
+
+    return result;
+}
+
+/* Reads everything that was flushed, so the next batch never finds the socket full */
+static int
+drain(struct wl_connection *connection, int peer, size_t size)
+{
+    char buffer[OUT_BUFFER_SIZE];
+    ssize_t len;
+
+    if (wl_connection_flush(connection) < 0)
+        return -1;
+
+    while (size > 0) {
+        len = read(peer, buffer, sizeof buffer);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return -1;
+        size -= (size_t) len;
+    }
+
+    return 0;
+}
+
+/* Returns the events written per second, or a negative number on failure */
+static double
+run(const struct event *event, int (*write_event)(struct wl_connection *, struct wl_object *, uint32_t,
+                                                  union wl_argument *),
+    uint32_t count)
+{
+    const struct wl_message *message = &event->interface->events[event->opcode];
+    struct wl_object sender = { event->interface, NULL, 3 };
+    struct wl_object output = { &wl_output_interface, NULL, 4 };
+    union wl_argument args[WL_CLOSURE_MAX_ARGS];
+    struct argument_details arg;
+    const char *signature = message->signature;
+    struct wl_connection *connection;
+    uint32_t written = 0, batch, size, i;
+    uint64_t elapsed = 0, start;
+    int fds[2], arg_count, a;
+
+    arg_count = arg_count_for_signature(message->signature);
+    for (a = 0; a < arg_count; a++) {
+        signature = get_next_argument(signature, &arg);
+        if (arg.type == 'o')
+            args[a].o = &output;
+        else
+            args[a].u = 0x100 + a;
+    }
+
+    size = 8 + 4 * arg_count;
+    batch = OUT_BUFFER_SIZE / size;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+        return -1;
+    connection = wl_connection_create(fds[0]);
+    if (connection == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    while (written < count) {
+        start = now_ns();
+        for (i = 0; i < batch; i++) {
+            if (write_event(connection, &sender, event->opcode, args) != 0)
+                goto fail;
+        }
+        elapsed += now_ns() - start;
+
+        if (drain(connection, fds[1], batch * size) < 0)
+            goto fail;
+        written += batch;
+    }
+
+    wl_connection_destroy(connection);
+    close(fds[1]);
+    return written / (elapsed / 1e9);
+
+fail:
+    wl_connection_destroy(connection);
+    close(fds[1]);
+    return -1;
+}
+
+static double
+best_of_runs(const struct event *event, int (*write_event)(struct wl_connection *, struct wl_object *, uint32_t,
+                                                           union wl_argument *),
+             uint32_t count)
+{
+    double best = 0, rate;
+    int r;
+
+    for (r = 0; r < RUNS; r++) {
+        rate = run(event, write_event, count);
+        if (rate < 0)
+            return rate;
+        if (rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t count = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : 10000000;
+    double fixed, closure;
+    size_t i;
+
+    printf("%-22s %-6s %14s %14s\n", "event", "args", "closure", "write_fixed");
+
+    for (i = 0; i < sizeof events / sizeof events[0]; i++) {
+        closure = best_of_runs(&events[i], write_closure, count);
+        fixed = best_of_runs(&events[i], write_fixed, count);
+        if (closure < 0 || fixed < 0) {
+            fprintf(stderr, "writing %s failed\n", events[i].name);
+            return EXIT_FAILURE;
+        }
+
+        printf("%-22s %-6s %8.1f M ev/s %8.1f M ev/s\n",
+               events[i].name, events[i].interface->events[events[i].opcode].signature,
+               closure / 1e6, fixed / 1e6);
+    }
+
+    return EXIT_SUCCESS;
+}
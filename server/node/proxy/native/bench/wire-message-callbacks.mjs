@@ -0,0 +1,102 @@
+// Measures what passing client requests to JS costs per request: the wire message callback of every request and the
+// wire message end callback of every batch, as run by dispatchRequests.
+//
+// Build the addon first (yarn build:native), then run
+//
+//   node native/bench/wire-message-callbacks.mjs [requests per batch] [batches] [runs]
+//
+// from the proxy package. Run it on two revisions to compare a change to the callback path. WESTFIELD_ADDON overrides
+// the path of the addon.
+import { createRequire } from 'module'
+import net from 'net'
+import os from 'os'
+import path from 'path'
+import { fileURLToPath } from 'url'
+
+const require = createRequire(import.meta.url)
+const addonPath =
+  process.env.WESTFIELD_ADDON ??
+  path.join(path.dirname(fileURLToPath(import.meta.url)), '..', '..', 'dist', 'westfield-addon.node')
+const addon = require(addonPath)
+
+const requestsPerBatch = Number(process.argv[2] ?? 100)
+const batches = Number(process.argv[3] ?? 10000)
+const runs = Number(process.argv[4] ?? 5)
+// the whole batch has to fit in the in buffer of the connection to be read in one go
+const requestSize = 12
+if (requestsPerBatch * requestSize > 4096) {
+  throw new Error('A batch must not be larger than 4096 bytes.')
+}
+
+process.env.XDG_RUNTIME_DIR ??= os.tmpdir()
+
+let requestsSeen = 0
+let batchesSeen = 0
+let client
+
+const display = addon.createDisplay(
+  (wlClient) => {
+    client = wlClient
+    addon.setWireMessageCallback(wlClient, () => {
+      requestsSeen++
+      // handled, not dispatched natively
+      return 0
+    })
+    addon.setWireMessageEndCallback(wlClient, () => {
+      batchesSeen++
+    })
+  },
+  () => {},
+  () => {},
+)
+const socketName = addon.addSocketAuto(display)
+const socket = net.connect(path.join(process.env.XDG_RUNTIME_DIR, socketName))
+await new Promise((resolve) => socket.once('connect', resolve))
+while (client === undefined) {
+  addon.dispatchRequests(display)
+}
+
+// wl_display.sync requests, never answered as JS takes them all
+const batch = Buffer.alloc(requestsPerBatch * requestSize)
+for (let i = 0; i < requestsPerBatch; i++) {
+  batch.writeUInt32LE(1, i * requestSize)
+  batch.writeUInt32LE(requestSize << 16, i * requestSize + 4)
+  batch.writeUInt32LE(0xff000000 + i, i * requestSize + 8)
+}
+
+function writeBatch() {
+  return new Promise((resolve) => socket.write(batch, resolve))
+}
+
+// nanoseconds spent in dispatchRequests for the given number of batches
+async function run(batchCount) {
+  let elapsed = 0n
+  for (let n = 0; n < batchCount; n++) {
+    const expected = batchesSeen + 1
+    await writeBatch()
+    while (batchesSeen < expected) {
+      const start = process.hrtime.bigint()
+      addon.dispatchRequests(display)
+      elapsed += process.hrtime.bigint() - start
+    }
+  }
+  return elapsed
+}
+
+await run(Math.min(batches, 1000))
+
+const results = []
+for (let i = 0; i < runs; i++) {
+  const requestsBefore = requestsSeen
+  const elapsed = await run(batches)
+  results.push(Number(elapsed) / (requestsSeen - requestsBefore))
+}
+results.sort((a, b) => a - b)
+
+console.log(
+  `${requestsPerBatch} requests per batch, ${batches} batches: ` +
+    `best ${results[0].toFixed(1)} ns, median ${results[runs >> 1].toFixed(1)} ns per request`,
+)
+
+socket.destroy()
+addon.destroyDisplay(display)
@@ -0,0 +1,178 @@
+/*
+ * Compares the flat and the paged (WL_MAP_PAGED) layout of wl_map, the object map of a client. For every map size it
+ * fills a server side map the way a client does: client ids appended with wl_map_insert_at and server ids created with
+ * wl_map_insert_new. It then reports
+ *
+ *  - ns per insert of each kind,
+ *  - the allocated size of the map, from wl_map_get_allocated_size,
+ *  - ns per wl_map_lookup of random live ids,
+ *  - ns per wl_map_remove and wl_map_insert_new of a random server id, the id recycling of a busy client.
+ *
+ * Each number is the best of a few runs. wl-map-bench is built with the flat layout, wl-map-bench-paged with the paged
+ * one:
+ *
+ *   wl-map-bench [objects...]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wayland-private.h"
+
+#define RUNS 5
+#define LOOKUPS 10000000u
+#define CHURN 1000000u
+#define RANDOM_IDS (1u << 20)
+
+struct result {
+    double client_insert_ns;
+    double server_insert_ns;
+    double lookup_ns;
+    double churn_ns;
+    size_t allocated;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t
+xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double
+min_double(double a, double b)
+{
+    return a < b ? a : b;
+}
+
+/* Half of the objects get client ids, the other half server ids */
+static int
+run(uint32_t objects, uint32_t *ids, struct result *result)
+{
+    struct wl_map map;
+    uint32_t client_objects = objects / 2;
+    uint32_t server_objects = objects - client_objects;
+    uint32_t random_state = 0x9e3779b9u;
+    uintptr_t sink = 0;
+    uint64_t start;
+    uint32_t i, id;
+
+    wl_map_init(&map, WL_MAP_SERVER_SIDE);
+
+    start = now_ns();
+    /* id 0 is never used, as in wl_client_create */
+    for (i = 0; i <= client_objects; i++) {
+        if (wl_map_insert_at(&map, 0, i, i ? &map : NULL) < 0)
+            goto fail;
+    }
+    result->client_insert_ns = (double) (now_ns() - start) / client_objects;
+
+    start = now_ns();
+    for (i = 0; i < server_objects; i++) {
+        if (wl_map_insert_new(&map, 0, &map) == 0)
+            goto fail;
+    }
+    result->server_insert_ns = (double) (now_ns() - start) / server_objects;
+
+    result->allocated = wl_map_get_allocated_size(&map);
+
+    for (i = 0; i < RANDOM_IDS; i++) {
+        id = xorshift32(&random_state) % objects;
+        ids[i] = id < client_objects ? id + 1 : WL_SERVER_ID_START + id - client_objects;
+    }
+
+    start = now_ns();
+    for (i = 0; i < LOOKUPS; i++)
+        sink += (uintptr_t) wl_map_lookup(&map, ids[i & (RANDOM_IDS - 1)]);
+    result->lookup_ns = (double) (now_ns() - start) / LOOKUPS;
+    if (sink == 0)
+        goto fail;
+
+    start = now_ns();
+    for (i = 0; i < CHURN; i++) {
+        id = WL_SERVER_ID_START + xorshift32(&random_state) % server_objects;
+        wl_map_remove(&map, id);
+        if (wl_map_insert_new(&map, 0, &map) != id)
+            goto fail;
+    }
+    result->churn_ns = (double) (now_ns() - start) / CHURN;
+
+    wl_map_release(&map);
+    return 0;
+
+fail:
+    wl_map_release(&map);
+    return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const uint32_t default_objects[] = { 10000, 100000, 1000000 };
+    struct result best, result;
+    uint32_t *ids, objects;
+    int count, i, r;
+
+    ids = malloc(RANDOM_IDS * sizeof *ids);
+    if (ids == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    count = argc > 1 ? argc - 1 : (int) (sizeof default_objects / sizeof default_objects[0]);
+
+#ifdef WL_MAP_PAGED
+    printf("paged wl_map\n");
+#else
+    printf("flat wl_map\n");
+#endif
+    printf("%10s %12s %12s %12s %12s %12s\n",
+           "objects", "client ins", "server ins", "lookup", "remove+ins", "allocated");
+
+    for (i = 0; i < count; i++) {
+        objects = argc > 1 ? (uint32_t) strtoul(argv[i + 1], NULL, 10) : default_objects[i];
+        if (objects < 2) {
+            fprintf(stderr, "at least 2 objects are needed\n");
+            free(ids);
+            return EXIT_FAILURE;
+        }
+
+        for (r = 0; r < RUNS; r++) {
+            if (run(objects, ids, &result) < 0) {
+                fprintf(stderr, "wl_map failed with %u objects\n", objects);
+                free(ids);
+                return EXIT_FAILURE;
+            }
+            if (r == 0) {
+                best = result;
+                continue;
+            }
+            best.client_insert_ns = min_double(best.client_insert_ns, result.client_insert_ns);
+            best.server_insert_ns = min_double(best.server_insert_ns, result.server_insert_ns);
+            best.lookup_ns = min_double(best.lookup_ns, result.lookup_ns);
+            best.churn_ns = min_double(best.churn_ns, result.churn_ns);
+        }
+
+        printf("%10u %9.2f ns %9.2f ns %9.2f ns %9.2f ns %8zu KiB\n",
+               objects, best.client_insert_ns, best.server_insert_ns, best.lookup_ns, best.churn_ns,
+               best.allocated / 1024);
+    }
+
+    free(ids);
+    return EXIT_SUCCESS;
+}
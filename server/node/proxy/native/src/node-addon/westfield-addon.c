@@ -1,8 +1,12 @@
+#define _GNU_SOURCE
+
 #include "include/node_api.h"
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include "westfield-wayland-server-extra.h"
 #include "westfield.h"
 #include "wlr_drm.h"
@@ -34,16 +38,77 @@ if((the_call) != napi_ok) { \
 the_call;
 #endif
 
+// wl_display requests that are answered natively for clients that are not materialized yet
+#define DISPLAY_OBJECT_ID 1
+#define DISPLAY_SYNC_OPCODE 0
+#define DISPLAY_GET_REGISTRY_OPCODE 1
+
+// Addon state of a single napi_env. Every worker thread that loads the addon gets its own, and only ever touches the
+// displays it created itself.
+struct westfield_addon {
+    // struct display_destruction_listener::link, displays created by this env that are not destroyed yet
+    struct wl_list displays;
+};
+
+// The messages read from a client in one go are passed to JS under a single handle scope, which also holds the handles
+// they all need. The batch ends in on_wire_message_end, or once the dispatch returns if the client went away first.
+struct message_batch {
+    napi_handle_scope scope;
+    // NULL once the handles below must no longer be used, the scope may still be open
+    struct client_destruction_listener *client_listener;
+    napi_value global;
+    napi_value client_value;
+    napi_value wire_message_cb;
+};
+
 struct display_destruction_listener {
     struct wl_listener listener;
+    // the env that created the display, the display must only be used from its thread
     napi_env env;
+    struct wl_display *display;
+    // link in westfield_addon::displays
+    struct wl_list link;
+    // the env is being torn down, JS can no longer be called
+    bool env_gone;
     napi_ref client_creation_cb_ref;
     napi_ref global_created_cb_ref;
     napi_ref global_destroyed_cb_ref;
+    // only announce clients to JS once they send a message that needs JS
+    bool lazy_clients;
+    // struct lazy_global::link, globals implemented in JS, advertised natively to unmaterialized clients
+    struct wl_list lazy_globals;
+    // struct client_destruction_listener::link
+    struct wl_list unmaterialized_clients;
+    struct message_batch batch;
+};
+
+struct lazy_global {
+    struct wl_list link;
+    uint32_t name;
+    char *interface_name;
+    uint32_t version;
 };
 
 struct client_destruction_listener {
     struct wl_listener listener;
+    struct wl_listener resource_created_listener;
+    struct wl_client *client;
+    struct display_destruction_listener *display_listener;
+    // false until the client is announced to JS
+    bool materialized;
+    // link in display_destruction_listener::unmaterialized_clients while not materialized
+    struct wl_list link;
+    // struct wl_resource *, registries created before the client was materialized
+    struct wl_array registries;
+    // uint32_t, ids of wl_display.sync callbacks answered natively, see on_sync_done
+    struct wl_array native_syncs;
+    // set while the client leaves this display for another shard
+    bool migrating;
+    // server object ids reserved ahead for JS, see createServerObjectIdPool. Points into the ArrayBuffer of id_pool_ref.
+    uint32_t *id_pool;
+    uint32_t id_pool_capacity;
+    uint32_t id_pool_low_water;
+    napi_ref id_pool_ref;
     napi_ref js_object;
     napi_ref destroy_cb_ref;
     napi_ref wire_message_cb_ref;
@@ -59,43 +124,232 @@ struct weston_xwayland_callbacks {
     napi_ref xwayland_starting_cb_ref;
 };
 
+struct westfield_encoder_callbacks {
+    napi_env env;
+    napi_ref frame_done_cb_ref;
+    struct westfield_encoder *encoder;
+};
+
+struct memory_mapped_file_work {
+    napi_async_work work;
+    napi_deferred deferred;
+    // keeps contents alive while the work runs
+    napi_ref buffer_ref;
+    void *contents;
+    size_t size;
+    int fd;
+};
+
+struct drm_init_work {
+    napi_async_work work;
+    napi_deferred deferred;
+    // NULL once the display is destroyed
+    struct wl_display *display;
+    struct wl_listener display_destroy_listener;
+    char device_path[128];
+    struct westfield_egl *westfield_egl;
+};
+
+struct xwayland_setup_work {
+    napi_async_work work;
+    napi_deferred deferred;
+    // NULL once the display is destroyed
+    struct wl_display *display;
+    struct wl_listener display_destroy_listener;
+    struct weston_xwayland_callbacks *callbacks;
+    struct westfield_xwayland *westfield_xwayland;
+};
+
+struct westfield_transfer_callbacks {
+    napi_env env;
+    // the display whose event loop runs the transfer
+    struct display_destruction_listener *display_listener;
+    napi_ref progress_cb_ref;
+    napi_ref done_cb_ref;
+    // NULL once the transfer is done or cancelled
+    struct westfield_transfer *transfer;
+    // the JS handle was garbage collected, free once the transfer is over
+    bool finalized;
+};
+
+static void
+reject_deferred(napi_env env, napi_deferred deferred, const char *message) {
+    napi_value message_value, error_value;
+
+    NAPI_CALL(env, napi_create_string_utf8(env, message, NAPI_AUTO_LENGTH, &message_value))
+    NAPI_CALL(env, napi_create_error(env, NULL, message_value, &error_value))
+    NAPI_CALL(env, napi_reject_deferred(env, deferred, error_value))
+}
+
+// queue work on the libuv thread pool and return the promise it settles
+static napi_value
+queue_async_work(napi_env env, const char *name, napi_async_execute_callback execute,
+                 napi_async_complete_callback complete, void *data, napi_async_work *work,
+                 napi_deferred *deferred) {
+    napi_value resource_name, promise;
+
+    NAPI_CALL(env, napi_create_promise(env, deferred, &promise))
+    NAPI_CALL(env, napi_create_string_utf8(env, name, NAPI_AUTO_LENGTH, &resource_name))
+    NAPI_CALL(env, napi_create_async_work(env, NULL, resource_name, execute, complete, data, work))
+    NAPI_CALL(env, napi_queue_async_work(env, *work))
+
+    return promise;
+}
+
 static void
 finalize_cb(napi_env env, void *finalize_data, void *finalize_hint) {
     free(finalize_data);
 }
 
+// NULL once the display is being destroyed
+static inline struct display_destruction_listener *
+get_display_listener(struct wl_display *display) {
+    return wl_display_get_user_data(display);
+}
+
+static inline struct client_destruction_listener *
+get_client_listener(struct wl_client *client) {
+    return wl_client_get_user_data(client);
+}
+
+// The batch of the client if it is the one that is open. Callbacks that can also fire outside of a dispatch, or from
+// within a JS callback of another client's batch, must not open or close a batch, but can reuse the handles of the
+// open one.
+static inline struct message_batch *
+get_open_message_batch(struct client_destruction_listener *destruction_listener) {
+    struct message_batch *batch = &destruction_listener->display_listener->batch;
+
+    return batch->client_listener == destruction_listener ? batch : NULL;
+}
+
 static void
 on_display_destroyed(struct wl_listener *listener, void *data) {
     struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) listener;
     napi_env env = display_destruction_listener->env;
 
-    NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->client_creation_cb_ref))
-    NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->global_created_cb_ref))
-    NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->global_destroyed_cb_ref))
+    wl_display_set_user_data(data, NULL);
+    wl_list_remove(&display_destruction_listener->link);
+    if (!display_destruction_listener->env_gone) {
+        NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->client_creation_cb_ref))
+        NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->global_created_cb_ref))
+        NAPI_CALL(env, napi_delete_reference(env, display_destruction_listener->global_destroyed_cb_ref))
+    }
+
+    struct lazy_global *lazy_global, *next;
+    wl_list_for_each_safe(lazy_global, next, &display_destruction_listener->lazy_globals, link) {
+        wl_list_remove(&lazy_global->link);
+        free(lazy_global->interface_name);
+        free(lazy_global);
+    }
+}
+
+static enum wl_iterator_result
+collect_resource_id(struct wl_resource *resource, void *data) {
+    struct wl_array *ids = data;
+    uint32_t *id;
+
+    id = wl_array_add(ids, sizeof(*id));
+    if (id == NULL) {
+        return WL_ITERATOR_STOP;
+    }
+    *id = wl_resource_get_id(resource);
+    return WL_ITERATOR_CONTINUE;
+}
+
+// The ids of all objects the client still has natively, which are destroyed together with it, so JS can drop them in
+// one go. The ids are collected in a single pass and handed to JS without copying them.
+static napi_value
+create_destroyed_ids(napi_env env, struct wl_client *client) {
+    napi_value ids_buffer, ids_value;
+    struct wl_array ids;
+    size_t count;
+
+    wl_array_init(&ids);
+    wl_client_for_each_resource(client, collect_resource_id, &ids);
+    count = ids.size / sizeof(uint32_t);
+
+    if (count) {
+        NAPI_CALL(env, napi_create_external_arraybuffer(env, ids.data, ids.size, finalize_cb, NULL, &ids_buffer))
+    } else {
+        wl_array_release(&ids);
+        NAPI_CALL(env, napi_create_arraybuffer(env, 0, NULL, &ids_buffer))
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint32_array, count, ids_buffer, 0, &ids_value))
+    return ids_value;
+}
+
+// Layout of the id pool shared with JS, as uint32 indices. Both counters only ever grow, the id of count n lives at
+// ID_POOL_IDS + n % capacity.
+#define ID_POOL_TAKEN 0
+#define ID_POOL_FILLED 1
+#define ID_POOL_IDS 2
+
+// Give back the ids that were reserved for the id pool but not taken by JS, they would stay reserved otherwise.
+static void
+release_id_pool(struct wl_client *client, struct client_destruction_listener *destruction_listener) {
+    uint32_t *pool = destruction_listener->id_pool;
+
+    if (pool[ID_POOL_FILLED] - pool[ID_POOL_TAKEN] <= destruction_listener->id_pool_capacity) {
+        for (uint32_t n = pool[ID_POOL_TAKEN]; n != pool[ID_POOL_FILLED]; n++) {
+            wl_client_release_server_object_ids(client, &pool[ID_POOL_IDS + n % destruction_listener->id_pool_capacity],
+                                                1);
+        }
+    }
 }
 
 static void
 on_client_destroyed(struct wl_listener *listener, void *data) {
     struct client_destruction_listener *destruction_listener = (struct client_destruction_listener *) listener;
-    if (destruction_listener->destroy_cb_ref) {
-        struct wl_client *client = data;
-        struct display_destruction_listener *display_destruction_listener;
-        napi_value global, client_value, cb_result, cb;
-        napi_env env;
-
-
-        display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-                wl_client_get_display(client), on_display_destroyed);
-        env = display_destruction_listener->env;
+    struct message_batch *batch = get_open_message_batch(destruction_listener);
 
-        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->js_object, &client_value))
-        napi_value argv[1] = {client_value};
+    // this can run from within a JS callback of the batch, its scope is closed once the dispatch gets back to it
+    if (batch) {
+        batch->client_listener = NULL;
+    }
+    wl_list_remove(&destruction_listener->link);
+    wl_list_init(&destruction_listener->link);
+    wl_array_release(&destruction_listener->registries);
+    wl_array_init(&destruction_listener->registries);
+    wl_array_release(&destruction_listener->native_syncs);
+    wl_array_init(&destruction_listener->native_syncs);
+
+    if (destruction_listener->destroy_cb_ref && !destruction_listener->display_listener->env_gone) {
+        napi_value global, client_value, migrated_value, destroyed_ids_value, cb_result, cb;
+        napi_handle_scope scope = NULL;
+        napi_env env = destruction_listener->display_listener->env;
+
+        if (batch) {
+            global = batch->global;
+            client_value = batch->client_value;
+        } else {
+            NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+            NAPI_CALL(env, napi_get_global(env, &global))
+            NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->js_object, &client_value))
+        }
+        NAPI_CALL(env, napi_get_boolean(env, destruction_listener->migrating, &migrated_value))
+        // a migrating client takes its objects along
+        if (destruction_listener->migrating) {
+            NAPI_CALL(env, napi_get_null(env, &destroyed_ids_value))
+        } else {
+            destroyed_ids_value = create_destroyed_ids(env, destruction_listener->client);
+        }
+        napi_value argv[3] = {client_value, migrated_value, destroyed_ids_value};
 
         NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->destroy_cb_ref, &cb))
-        NAPI_CALL(env, napi_get_global(env, &global))
-        NAPI_CALL(env, napi_call_function(env, global, cb, 1, argv, &cb_result))
+        NAPI_CALL(env, napi_call_function(env, global, cb, 3, argv, &cb_result))
+        if (scope) {
+            NAPI_CALL(env, napi_close_handle_scope(env, scope))
+        }
 
         napi_delete_reference(env, destruction_listener->js_object);
+        if (destruction_listener->id_pool_ref) {
+            // a migrating client keeps its object map, JS on the other shard makes a pool of its own
+            if (destruction_listener->migrating) {
+                release_id_pool(destruction_listener->client, destruction_listener);
+            }
+            destruction_listener->id_pool = NULL;
+            NAPI_CALL(env, napi_delete_reference(env, destruction_listener->id_pool_ref))
+        }
         if (destruction_listener->destroy_cb_ref) {
             NAPI_CALL(env, napi_delete_reference(env, destruction_listener->destroy_cb_ref))
         }
@@ -117,31 +371,137 @@ on_client_destroyed(struct wl_listener *listener, void *data) {
     }
 }
 
+static void
+notify_registry_created(napi_env env, struct client_destruction_listener *destruction_listener,
+                        struct wl_resource *registry, uint32_t registry_id, bool already_advertised) {
+    napi_value cb, registry_value, registry_id_value, already_advertised_value, global, cb_result;
+    napi_handle_scope scope = NULL;
+    struct message_batch *batch = get_open_message_batch(destruction_listener);
+
+    if (batch) {
+        global = batch->global;
+    } else {
+        NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+        NAPI_CALL(env, napi_get_global(env, &global))
+    }
+    NAPI_CALL(env, napi_create_external(env, registry, NULL, NULL, &registry_value))
+    NAPI_CALL(env, napi_create_uint32(env, registry_id, &registry_id_value))
+    NAPI_CALL(env, napi_get_boolean(env, already_advertised, &already_advertised_value))
+    napi_value argv[3] = {registry_value, registry_id_value, already_advertised_value};
+
+    NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->registry_created_cb_ref, &cb))
+    NAPI_CALL(env, napi_call_function(env, global, cb, 3, argv, &cb_result))
+    if (scope) {
+        NAPI_CALL(env, napi_close_handle_scope(env, scope))
+    }
+}
+
+// Announce the client to JS. JS is expected to install its client callbacks from within onClientCreated.
+static void
+materialize_client(struct display_destruction_listener *display_destruction_listener,
+                   struct client_destruction_listener *destruction_listener) {
+    napi_env env = display_destruction_listener->env;
+    napi_value client_value, migrated_value, global, cb_result, cb;
+    napi_handle_scope scope;
+    struct wl_resource **registry;
+
+    wl_list_remove(&destruction_listener->link);
+    wl_list_init(&destruction_listener->link);
+    destruction_listener->materialized = true;
+
+    NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+    NAPI_CALL(env, napi_create_external(env, destruction_listener->client, NULL, NULL, &client_value))
+    NAPI_CALL(env, napi_create_reference(env, client_value, 1, &destruction_listener->js_object))
+
+    NAPI_CALL(env, napi_get_boolean(env, wl_client_is_migrated(destruction_listener->client), &migrated_value))
+
+    NAPI_CALL(env, napi_get_global(env, &global))
+    napi_value argv[2] = {client_value, migrated_value};
+    NAPI_CALL(env, napi_get_reference_value(env, display_destruction_listener->client_creation_cb_ref, &cb))
+    NAPI_CALL(env, napi_call_function(env, global, cb, 2, argv, &cb_result))
+    NAPI_CALL(env, napi_close_handle_scope(env, scope))
+
+    // registries created in the meantime already received all globals, JS only has to start tracking them
+    if (destruction_listener->registry_created_cb_ref) {
+        wl_array_for_each(registry, &destruction_listener->registries) {
+            notify_registry_created(env, destruction_listener, *registry, wl_resource_get_id(*registry), true);
+        }
+    }
+    wl_array_release(&destruction_listener->registries);
+    wl_array_init(&destruction_listener->registries);
+}
+
+// Must only be called where the batch was opened, directly from the dispatch and not from within a JS callback.
+static void
+close_message_batch(struct display_destruction_listener *display_destruction_listener) {
+    napi_env env = display_destruction_listener->env;
+
+    if (display_destruction_listener->batch.scope) {
+        NAPI_CALL(env, napi_close_handle_scope(env, display_destruction_listener->batch.scope))
+    }
+    display_destruction_listener->batch = (struct message_batch) {0};
+}
+
+static struct message_batch *
+get_message_batch(struct client_destruction_listener *destruction_listener) {
+    struct display_destruction_listener *display_destruction_listener = destruction_listener->display_listener;
+    struct message_batch *batch = &display_destruction_listener->batch;
+    napi_env env = display_destruction_listener->env;
+
+    if (batch->client_listener == destruction_listener) {
+        return batch;
+    }
+
+    close_message_batch(display_destruction_listener);
+    NAPI_CALL(env, napi_open_handle_scope(env, &batch->scope))
+    NAPI_CALL(env, napi_get_global(env, &batch->global))
+    NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->js_object, &batch->client_value))
+    if (destruction_listener->wire_message_cb_ref) {
+        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->wire_message_cb_ref,
+                                                &batch->wire_message_cb))
+    }
+    batch->client_listener = destruction_listener;
+    return batch;
+}
+
 static int
 on_wire_message(struct wl_client *client, int32_t *wire_message,
                 size_t wire_message_size, int object_id, int opcode) {
-    struct client_destruction_listener *destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(
-            client, on_client_destroyed);
+    struct client_destruction_listener *destruction_listener = get_client_listener(client);
+    if (!destruction_listener->materialized) {
+        if (object_id == DISPLAY_OBJECT_ID && opcode == DISPLAY_SYNC_OPCODE) {
+            // the client may be materialized before the callback fires, remember who has to answer it
+            uint32_t *callback_id = wl_array_add(&destruction_listener->native_syncs, sizeof(*callback_id));
+            if (callback_id == NULL) {
+                free(wire_message);
+                wl_client_post_no_memory(client);
+                return 0;
+            }
+            *callback_id = (uint32_t) wire_message[2];
+        }
+        if (object_id == DISPLAY_OBJECT_ID &&
+            (opcode == DISPLAY_SYNC_OPCODE || opcode == DISPLAY_GET_REGISTRY_OPCODE)) {
+            // handled natively, see on_registry_created and on_sync_done
+            free(wire_message);
+            return 1;
+        }
+        materialize_client(destruction_listener->display_listener, destruction_listener);
+    }
+
     if (destruction_listener->wire_message_cb_ref) {
-        struct display_destruction_listener *display_destruction_listener;
         uint32_t cb_result_consumed;
-        napi_value wire_message_value, client_value, object_id_value, opcode_value, global, cb_result, cb;
-        napi_env env;
-
-        display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-                wl_client_get_display(client), on_display_destroyed);
-        env = display_destruction_listener->env;
+        napi_value wire_message_value, object_id_value, opcode_value, cb_result;
+        napi_env env = destruction_listener->display_listener->env;
+        // a batch is bounded by the size of the connection's in buffer, so its handles can't pile up
+        struct message_batch *batch = get_message_batch(destruction_listener);
 
         NAPI_CALL(env, napi_create_external_arraybuffer(env, wire_message, wire_message_size, finalize_cb, NULL,
                                                         &wire_message_value))
         NAPI_CALL(env, napi_create_uint32(env, (uint32_t) object_id, &object_id_value))
         NAPI_CALL(env, napi_create_uint32(env, (uint32_t) opcode, &opcode_value))
-        NAPI_CALL(env, napi_get_global(env, &global))
-        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->js_object, &client_value))
-        napi_value argv[4] = {client_value, wire_message_value, object_id_value, opcode_value};
+        napi_value argv[4] = {batch->client_value, wire_message_value, object_id_value, opcode_value};
 
-        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->wire_message_cb_ref, &cb))
-        NAPI_CALL(env, napi_call_function(env, global, cb, 4, argv, &cb_result))
+        NAPI_CALL(env, napi_call_function(env, batch->global, batch->wire_message_cb, 4, argv, &cb_result))
         NAPI_CALL(env, napi_get_value_uint32(env, cb_result, &cb_result_consumed))
         return cb_result_consumed;
     } else {
@@ -149,14 +509,43 @@ on_wire_message(struct wl_client *client, int32_t *wire_message,
     }
 }
 
+static void
+fill_id_pool(struct wl_client *client, struct client_destruction_listener *destruction_listener) {
+    uint32_t *pool = destruction_listener->id_pool;
+    uint32_t available, missing, start, head;
+
+    available = pool[ID_POOL_FILLED] - pool[ID_POOL_TAKEN];
+    if (available > destruction_listener->id_pool_capacity) {
+        // JS took more than there was, the counters can't be trusted anymore
+        return;
+    }
+
+    // fill up to the end of the ring first, then from its start
+    missing = destruction_listener->id_pool_capacity - available;
+    start = pool[ID_POOL_FILLED] % destruction_listener->id_pool_capacity;
+    head = destruction_listener->id_pool_capacity - start < missing ?
+           destruction_listener->id_pool_capacity - start : missing;
+    wl_get_server_object_ids_batch(client, &pool[ID_POOL_IDS + start], head);
+    wl_get_server_object_ids_batch(client, &pool[ID_POOL_IDS], missing - head);
+    pool[ID_POOL_FILLED] += missing;
+}
+
+static void
+refill_id_pool(struct wl_client *client, struct client_destruction_listener *destruction_listener) {
+    uint32_t *pool = destruction_listener->id_pool;
+
+    if (pool && pool[ID_POOL_FILLED] - pool[ID_POOL_TAKEN] < destruction_listener->id_pool_low_water) {
+        fill_id_pool(client, destruction_listener);
+    }
+}
+
 static void
 on_wire_message_end(struct wl_client *client) {
     int *fds_in;
     size_t fds_in_size;
     struct wl_connection *connection;
-    struct client_destruction_listener *destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(
-            client, on_client_destroyed);
-    if (destruction_listener->wire_message_end_cb_ref) {
+    struct client_destruction_listener *destruction_listener = get_client_listener(client);
+    if (destruction_listener->materialized && destruction_listener->wire_message_end_cb_ref) {
         connection = wl_client_get_connection(client);
         fds_in_size = wl_connection_fds_in_size(connection);
         fds_in = malloc(fds_in_size);
@@ -164,13 +553,9 @@ on_wire_message_end(struct wl_client *client) {
             wl_connection_copy_fds_in(connection, fds_in, fds_in_size);
         }
 
-        struct display_destruction_listener *display_destruction_listener;
-        napi_value client_value, fds_value = NULL, global, cb_result, cb;
-        napi_env env;
-
-        display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-                wl_client_get_display(client), on_display_destroyed);
-        env = display_destruction_listener->env;
+        napi_value fds_value = NULL, cb_result, cb;
+        napi_env env = destruction_listener->display_listener->env;
+        struct message_batch *batch = get_message_batch(destruction_listener);
 
         if (fds_in_size) {
             NAPI_CALL(env,
@@ -181,55 +566,96 @@ on_wire_message_end(struct wl_client *client) {
             NAPI_CALL(env, napi_get_null(env, &fds_value))
         }
 
-        NAPI_CALL(env, napi_get_global(env, &global))
-        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->js_object, &client_value))
-        napi_value argv[2] = {client_value, fds_value};
+        napi_value argv[2] = {batch->client_value, fds_value};
 
         NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->wire_message_end_cb_ref, &cb))
-        NAPI_CALL(env, napi_call_function(env, global, cb, 2, argv, &cb_result))
+        NAPI_CALL(env, napi_call_function(env, batch->global, cb, 2, argv, &cb_result))
     }
+    close_message_batch(destruction_listener->display_listener);
+
+    // JS handled the whole batch, top up what it took
+    refill_id_pool(client, destruction_listener);
 }
 
 static void
 on_registry_created(struct wl_client *client, struct wl_resource *registry, uint32_t registry_id) {
-    struct client_destruction_listener *destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(
-            client,
-            on_client_destroyed);
+    struct client_destruction_listener *destruction_listener = get_client_listener(client);
+    struct display_destruction_listener *display_destruction_listener = destruction_listener->display_listener;
 
-    if (destruction_listener->registry_created_cb_ref) {
-        struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-                wl_client_get_display(client), on_display_destroyed);
-        napi_env env = display_destruction_listener->env;
-        napi_value cb, registry_value, registry_id_value, global, cb_result;
+    if (!destruction_listener->materialized) {
+        struct wl_resource **registry_entry;
+        struct lazy_global *lazy_global;
 
-        NAPI_CALL(env, napi_create_external(env, registry, NULL, NULL, &registry_value))
-        NAPI_CALL(env, napi_create_uint32(env, registry_id, &registry_id_value))
-        napi_value argv[2] = {registry_value, registry_id_value};
+        registry_entry = wl_array_add(&destruction_listener->registries, sizeof(*registry_entry));
+        if (registry_entry == NULL) {
+            wl_client_post_no_memory(client);
+            return;
+        }
+        *registry_entry = registry;
 
-        NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->registry_created_cb_ref, &cb))
-        NAPI_CALL(env, napi_get_global(env, &global))
-        NAPI_CALL(env, napi_call_function(env, global, cb, 2, argv, &cb_result))
+        wl_registry_emit_globals(registry);
+        wl_list_for_each(lazy_global, &display_destruction_listener->lazy_globals, link) {
+            wl_registry_send_global(registry, lazy_global->name, lazy_global->interface_name, lazy_global->version);
+        }
+        return;
+    }
+
+    if (destruction_listener->registry_created_cb_ref) {
+        notify_registry_created(display_destruction_listener->env, destruction_listener, registry, registry_id, false);
+    }
+}
+
+static bool
+take_native_sync(struct client_destruction_listener *destruction_listener, uint32_t callback_id) {
+    uint32_t *native_sync, *last;
+
+    wl_array_for_each(native_sync, &destruction_listener->native_syncs) {
+        if (*native_sync == callback_id) {
+            // swap in the last entry, order doesn't matter
+            last = (uint32_t *) ((char *) destruction_listener->native_syncs.data +
+                                 destruction_listener->native_syncs.size) - 1;
+            *native_sync = *last;
+            destruction_listener->native_syncs.size -= sizeof(*last);
+            return true;
+        }
     }
+    return false;
 }
 
 static void
 on_sync_done(struct wl_client *client, uint32_t callback_id) {
-    struct client_destruction_listener *destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(
-            client,
-            on_client_destroyed);
+    struct client_destruction_listener *destruction_listener = get_client_listener(client);
+
+    // JS never saw this sync if it arrived before the client was materialized, even if it is materialized by now
+    if (take_native_sync(destruction_listener, callback_id)) {
+        struct wl_resource *callback = wl_client_get_object(client, callback_id);
+        if (callback) {
+            wl_callback_send_done(callback, wl_display_get_serial(wl_client_get_display(client)));
+            wl_resource_destroy(callback);
+        }
+        return;
+    }
 
     if (destruction_listener->sync_done_cb_ref) {
-        struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-                wl_client_get_display(client), on_display_destroyed);
-        napi_env env = display_destruction_listener->env;
+        napi_env env = destruction_listener->display_listener->env;
         napi_value cb, callback_id_value, global, cb_result;
+        napi_handle_scope scope = NULL;
+        struct message_batch *batch = get_open_message_batch(destruction_listener);
 
+        if (batch) {
+            global = batch->global;
+        } else {
+            NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+            NAPI_CALL(env, napi_get_global(env, &global))
+        }
         NAPI_CALL(env, napi_create_uint32(env, callback_id, &callback_id_value))
         napi_value argv[1] = {callback_id_value};
 
         NAPI_CALL(env, napi_get_reference_value(env, destruction_listener->sync_done_cb_ref, &cb))
-        NAPI_CALL(env, napi_get_global(env, &global))
         NAPI_CALL(env, napi_call_function(env, global, cb, 1, argv, &cb_result))
+        if (scope) {
+            NAPI_CALL(env, napi_close_handle_scope(env, scope))
+        }
     }
 }
 
@@ -237,69 +663,87 @@ static void
 on_resource_created(struct wl_listener *listener, void *data) {
     struct wl_resource *resource = data;
     struct wl_client *client = wl_resource_get_client(resource);
-    struct client_destruction_listener *client_destruction_listener
-            = (struct client_destruction_listener *) wl_client_get_destroy_listener(client, on_client_destroyed);
-    struct display_destruction_listener *display_destruction_listener
-            = (struct display_destruction_listener *) wl_display_get_destroy_listener(wl_client_get_display(client),
-                                                                                      on_display_destroyed);
-
-    const char *itf_name = wl_resource_get_class(resource);
-    if (strcmp(itf_name, "wl_buffer") == 0 && client_destruction_listener->buffer_created_cb_ref) {
-        napi_env env = display_destruction_listener->env;
+    struct client_destruction_listener *client_destruction_listener = get_client_listener(client);
+
+    if (client_destruction_listener->buffer_created_cb_ref &&
+        strcmp(wl_resource_get_class(resource), "wl_buffer") == 0) {
+        napi_env env = client_destruction_listener->display_listener->env;
         napi_value cb, global, cb_result, resource_id_value;
+        napi_handle_scope scope = NULL;
+        // a buffer is mostly created by a request of the client, from within its batch
+        struct message_batch *batch = get_open_message_batch(client_destruction_listener);
 
+        if (batch) {
+            global = batch->global;
+        } else {
+            NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+            NAPI_CALL(env, napi_get_global(env, &global))
+        }
         NAPI_CALL(env, napi_get_reference_value(env, client_destruction_listener->buffer_created_cb_ref, &cb))
-        NAPI_CALL(env, napi_get_global(env, &global))
         NAPI_CALL(env, napi_create_uint32(env, wl_resource_get_id(resource), &resource_id_value))
 
         napi_value argv[] = {resource_id_value};
         NAPI_CALL(env, napi_call_function(env, global, cb, 1, argv, &cb_result))
+        if (scope) {
+            NAPI_CALL(env, napi_close_handle_scope(env, scope))
+        }
+    }
+}
+
+static enum wl_iterator_result
+collect_registry(struct wl_resource *resource, void *data) {
+    struct wl_array *registries = data;
+    struct wl_resource **registry;
+
+    if (strcmp(wl_resource_get_class(resource), "wl_registry") == 0) {
+        registry = wl_array_add(registries, sizeof(*registry));
+        if (registry) {
+            *registry = resource;
+        }
     }
+    return WL_ITERATOR_CONTINUE;
 }
 
 static void
 on_client_created(struct wl_listener *listener, void *data) {
     struct wl_client *client = data;
     struct display_destruction_listener *display_destruction_listener;
-    napi_value client_value, global, cb_result, cb;
-    napi_ref client_ref;
-    napi_env env;
 
-    display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            wl_client_get_display(client), on_display_destroyed);
-    env = display_destruction_listener->env;
+    display_destruction_listener = get_display_listener(wl_client_get_display(client));
 
-    struct client_destruction_listener *destruction_listener = malloc(sizeof(struct client_destruction_listener));
+    struct client_destruction_listener *destruction_listener = calloc(1, sizeof(struct client_destruction_listener));
     destruction_listener->listener.notify = on_client_destroyed;
-    destruction_listener->wire_message_cb_ref = NULL;
-    destruction_listener->wire_message_end_cb_ref = NULL;
-    destruction_listener->registry_created_cb_ref = NULL;
-    destruction_listener->destroy_cb_ref = NULL;
-    destruction_listener->buffer_created_cb_ref = NULL;
+    destruction_listener->client = client;
+    destruction_listener->display_listener = display_destruction_listener;
+    wl_list_init(&destruction_listener->link);
+    wl_array_init(&destruction_listener->registries);
+    wl_array_init(&destruction_listener->native_syncs);
 
+    wl_client_set_user_data(client, destruction_listener);
     wl_client_add_destroy_listener(client, &destruction_listener->listener);
     wl_client_set_wire_message_cb(client, on_wire_message);
     wl_client_set_wire_message_end_cb(client, on_wire_message_end);
     wl_client_set_registry_created_cb(client, on_registry_created);
     wl_client_set_sync_done_cb(client, on_sync_done);
 
-    struct wl_listener *resource_listener = malloc(sizeof(struct wl_listener));
-    resource_listener->notify = on_resource_created;
-    wl_client_add_resource_created_listener(client, resource_listener);
+    destruction_listener->resource_created_listener.notify = on_resource_created;
+    wl_client_add_resource_created_listener(client, &destruction_listener->resource_created_listener);
 
-    NAPI_CALL(env, napi_create_external(env, client, NULL, NULL, &client_value))
-    NAPI_CALL(env, napi_create_reference(env, client_value, 1, &client_ref))
-    destruction_listener->js_object = client_ref;
+    if (wl_client_is_migrated(client)) {
+        // moved here from another shard, JS has to pick up its objects right away
+        wl_client_for_each_resource(client, collect_registry, &destruction_listener->registries);
+    } else if (display_destruction_listener->lazy_clients) {
+        // clients that only round trip the registry never reach JS
+        wl_list_insert(&display_destruction_listener->unmaterialized_clients, &destruction_listener->link);
+        return;
+    }
 
-    NAPI_CALL(env, napi_get_global(env, &global))
-    napi_value argv[1] = {client_value};
-    NAPI_CALL(env, napi_get_reference_value(env, display_destruction_listener->client_creation_cb_ref, &cb))
-    NAPI_CALL(env, napi_call_function(env, global, cb, 1, argv, &cb_result))
+    materialize_client(display_destruction_listener, destruction_listener);
 }
 
 // expected arguments in order:
 // - Object client
-// - onWireMessage(Object client, ArrayBuffer wireMessage, ArrayBuffer fdsIn):void
+// - onClientDestroyed(Object client, boolean migrated, Uint32Array destroyedIds | null):void
 // return:
 // - void
 napi_value
@@ -318,8 +762,7 @@ setClientDestroyedCallback(napi_env env, napi_callback_info info) {
     js_cb = argv[1];
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->destroy_cb_ref = js_cb_ref;
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -348,9 +791,12 @@ setWireMessageCallback(napi_env env, napi_callback_info info) {
     js_cb = argv[1];
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->wire_message_cb_ref = js_cb_ref;
+    // an open batch still holds the previous callback
+    if (destruction_listener->display_listener->batch.client_listener == destruction_listener) {
+        destruction_listener->display_listener->batch.client_listener = NULL;
+    }
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
     return return_value;
@@ -377,8 +823,7 @@ setWireMessageEndCallback(napi_env env, napi_callback_info info) {
     js_cb = argv[1];
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->wire_message_end_cb_ref = js_cb_ref;
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -388,8 +833,7 @@ setWireMessageEndCallback(napi_env env, napi_callback_info info) {
 
 static void
 on_global_created(struct wl_display *display, uint32_t global_name) {
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
+    struct display_destruction_listener *display_destruction_listener = get_display_listener(display);
     napi_value cb, global, global_name_value, cb_result;
     napi_env env = display_destruction_listener->env;
 
@@ -402,9 +846,8 @@ on_global_created(struct wl_display *display, uint32_t global_name) {
 
 static void
 on_global_destroyed(struct wl_display *display, uint32_t global_name) {
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    if (display_destruction_listener == NULL) {
+    struct display_destruction_listener *display_destruction_listener = get_display_listener(display);
+    if (display_destruction_listener == NULL || display_destruction_listener->env_gone) {
         // If the destruction listener is NULL then the whole display is being destroyed. Not much we can do here.
         return;
     }
@@ -431,21 +874,28 @@ createDisplay(napi_env env, napi_callback_info info) {
     napi_value argv[argc], display_value;
     struct wl_listener *client_creation_listener;
     struct display_destruction_listener *display_destruction_listener;
+    struct westfield_addon *addon;
 
     NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_instance_data(env, (void **) &addon))
 
     client_creation_listener = malloc(sizeof(struct wl_listener));
     client_creation_listener->notify = on_client_created;
 
-    display_destruction_listener = malloc(sizeof(struct display_destruction_listener));
+    display_destruction_listener = calloc(1, sizeof(struct display_destruction_listener));
     display_destruction_listener->listener.notify = on_display_destroyed;
     display_destruction_listener->env = env;
+    wl_list_init(&display_destruction_listener->lazy_globals);
+    wl_list_init(&display_destruction_listener->unmaterialized_clients);
 
     NAPI_CALL(env, napi_create_reference(env, argv[0], 1, &display_destruction_listener->client_creation_cb_ref))
     NAPI_CALL(env, napi_create_reference(env, argv[1], 1, &display_destruction_listener->global_created_cb_ref))
     NAPI_CALL(env, napi_create_reference(env, argv[2], 1, &display_destruction_listener->global_destroyed_cb_ref))
 
     struct wl_display *display = wl_display_create();
+    display_destruction_listener->display = display;
+    wl_list_insert(&addon->displays, &display_destruction_listener->link);
+    wl_display_set_user_data(display, display_destruction_listener);
     wl_display_add_destroy_listener(display, &display_destruction_listener->listener);
     wl_display_add_client_created_listener(display, client_creation_listener);
     wl_display_set_global_created_cb(display, on_global_created);
@@ -455,6 +905,124 @@ createDisplay(napi_env env, napi_callback_info info) {
     return display_value;
 }
 
+// When enabled, newly connected clients are only announced to JS (onClientCreated) once they send a message other than
+// wl_display.sync or wl_display.get_registry. Until then both are answered natively, with the native globals and the
+// globals added with addLazyGlobal. Registries created in the meantime are passed to onRegistryCreated with
+// alreadyAdvertised set once the client is materialized.
+// expected arguments in order:
+// - Object display
+// - boolean enabled
+// return:
+// - void
+napi_value
+setLazyClients(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    struct display_destruction_listener *display_destruction_listener;
+    struct client_destruction_listener *destruction_listener, *next;
+    bool enabled;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_bool(env, argv[1], &enabled))
+
+    display_destruction_listener = get_display_listener(display);
+    display_destruction_listener->lazy_clients = enabled;
+    if (!enabled) {
+        wl_list_for_each_safe(destruction_listener, next, &display_destruction_listener->unmaterialized_clients, link) {
+            materialize_client(display_destruction_listener, destruction_listener);
+        }
+    }
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// Advertise a global implemented in JS to clients that are not materialized yet.
+// expected arguments in order:
+// - Object display
+// - number name
+// - string interfaceName
+// - number version
+// return:
+// - void
+napi_value
+addLazyGlobal(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    struct display_destruction_listener *display_destruction_listener;
+    struct client_destruction_listener *destruction_listener;
+    struct lazy_global *lazy_global;
+    struct wl_resource **registry;
+    size_t interface_name_length;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+
+    display_destruction_listener = get_display_listener(display);
+
+    lazy_global = calloc(1, sizeof(*lazy_global));
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &lazy_global->name))
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[2], NULL, 0, &interface_name_length))
+    lazy_global->interface_name = malloc(interface_name_length + 1);
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[2], lazy_global->interface_name, interface_name_length + 1,
+                                              &interface_name_length))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[3], &lazy_global->version))
+    wl_list_insert(display_destruction_listener->lazy_globals.prev, &lazy_global->link);
+
+    wl_list_for_each(destruction_listener, &display_destruction_listener->unmaterialized_clients, link) {
+        wl_array_for_each(registry, &destruction_listener->registries) {
+            wl_registry_send_global(*registry, lazy_global->name, lazy_global->interface_name, lazy_global->version);
+        }
+    }
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object display
+// - number name
+// return:
+// - void
+napi_value
+removeLazyGlobal(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    struct display_destruction_listener *display_destruction_listener;
+    struct client_destruction_listener *destruction_listener;
+    struct lazy_global *lazy_global, *next;
+    struct wl_resource **registry;
+    uint32_t name;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &name))
+
+    display_destruction_listener = get_display_listener(display);
+
+    wl_list_for_each_safe(lazy_global, next, &display_destruction_listener->lazy_globals, link) {
+        if (lazy_global->name != name) {
+            continue;
+        }
+
+        wl_list_for_each(destruction_listener, &display_destruction_listener->unmaterialized_clients, link) {
+            wl_array_for_each(registry, &destruction_listener->registries) {
+                wl_registry_send_global_remove(*registry, name);
+            }
+        }
+        wl_list_remove(&lazy_global->link);
+        free(lazy_global->interface_name);
+        free(lazy_global);
+    }
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
 // expected arguments in order:
 // - Object display
 // return:
@@ -469,9 +1037,6 @@ addSocketAuto(napi_env env, napi_callback_info info) {
 
     display_value = argv[0];
     napi_get_value_external(env, display_value, (void **) &display);
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
 
     const char *display_name = wl_display_add_socket_auto(display);
     NAPI_CALL(env, napi_create_string_latin1(env, display_name, NAPI_AUTO_LENGTH, &display_name_value))
@@ -494,9 +1059,6 @@ destroyDisplay(napi_env env, napi_callback_info info) {
     display_value = argv[0];
     NAPI_CALL(env, napi_get_value_external(env, display_value, (void **) &display))
 
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
     wl_display_terminate(display);
     wl_display_destroy_clients(display);
     wl_display_destroy(display);
@@ -514,17 +1076,12 @@ destroyClient(napi_env env, napi_callback_info info) {
     size_t argc = 1;
     napi_value argv[argc], client_value, return_value;
     struct wl_client *client;
-    struct wl_display *display;
 
     NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
 
     client_value = argv[0];
     napi_get_value_external(env, client_value, (void **) &client);
 
-    display = wl_client_get_display(client);
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
     wl_client_destroy(client);
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -561,6 +1118,8 @@ sendEvents(napi_env env, napi_callback_info info) {
         wl_connection_put_fd(connection, fds[i]);
     }
     wl_connection_write(connection, messages, messages_length * 4);
+    // events are where JS announces the server objects it created
+    refill_id_pool(client, get_client_listener(client));
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
     return return_value;
@@ -575,19 +1134,27 @@ dispatchRequests(napi_env env, napi_callback_info info) {
     size_t argc = 1;
     napi_value argv[argc], display_value, return_value;
     struct wl_display *display;
+    struct display_destruction_listener *display_destruction_listener;
+    struct message_batch outer_batch;
 
     NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
 
     display_value = argv[0];
     napi_get_value_external(env, display_value, (void **) &display);
+    display_destruction_listener = get_display_listener(display);
+
+    // a JS callback can dispatch again, the batch of the outer dispatch is closed by the outer dispatch
+    outer_batch = display_destruction_listener->batch;
+    display_destruction_listener->batch = (struct message_batch) {0};
 
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
     wl_display_flush_clients(display);
     wl_event_loop_dispatch(wl_display_get_event_loop(display), 0);
+    // a batch whose client was destroyed or migrated never saw its end
+    close_message_batch(display_destruction_listener);
     wl_display_flush_clients(display);
 
+    display_destruction_listener->batch = outer_batch;
+
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
     return return_value;
 }
@@ -633,40 +1200,77 @@ getFd(napi_env env, napi_callback_info info) {
 }
 
 // expected arguments in order:
-// - number size
+// - Buffer contents
 // return:
-// - number
+// - number fd owned by the caller, or -1 on failure
 napi_value
 createMemoryMappedFile(napi_env env, napi_callback_info info) {
     void *contents;
     size_t argc = 1, size;
     napi_value argv[argc], buffer_value, fd_value;
     int fd;
-    ssize_t written;
 
     NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
     buffer_value = argv[0];
     NAPI_CALL(env, napi_get_buffer_info(env, buffer_value, &contents, &size))
 
-    fd = westfield_os_create_anonymous_file(size);
-    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // identical contents (eg the keymap sent to every client) share a single sealed file
+    fd = westfield_memfd_cache_get(contents, size);
 
-    while (size > 0) {
-        // FIXME error handling
-        written = write(fd, contents, size);
-        if (written <= 0)
-            break;
+    NAPI_CALL(env, napi_create_int32(env, fd, &fd_value))
+    return fd_value;
+}
+
+static void
+execute_memory_mapped_file_work(napi_env env, void *data) {
+    struct memory_mapped_file_work *work = data;
 
-        contents += written;
-        size -= written;
+    work->fd = westfield_memfd_cache_get(work->contents, work->size);
+}
+
+static void
+complete_memory_mapped_file_work(napi_env env, napi_status status, void *data) {
+    struct memory_mapped_file_work *work = data;
+    napi_value fd_value;
+
+    if (status == napi_ok && work->fd >= 0) {
+        NAPI_CALL(env, napi_create_int32(env, work->fd, &fd_value))
+        NAPI_CALL(env, napi_resolve_deferred(env, work->deferred, fd_value))
+    } else {
+        reject_deferred(env, work->deferred, "Can't create memory mapped file.");
     }
 
-    NAPI_CALL(env, napi_create_int32(env, fd, &fd_value))
-    return fd_value;
+    NAPI_CALL(env, napi_delete_reference(env, work->buffer_ref))
+    NAPI_CALL(env, napi_delete_async_work(env, work->work))
+    free(work);
 }
 
+// Like createMemoryMappedFile, but creates and writes the file on the thread pool. contents must not be modified until
+// the promise settles.
 // expected arguments in order:
-// - Object display
+// - Buffer contents
+// return:
+// - Promise<number> resolving to an fd owned by the caller
+napi_value
+createMemoryMappedFileAsync(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], promise;
+    struct memory_mapped_file_work *work;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+
+    work = calloc(1, sizeof(*work));
+    work->fd = -1;
+    NAPI_CALL(env, napi_get_buffer_info(env, argv[0], &work->contents, &work->size))
+    NAPI_CALL(env, napi_create_reference(env, argv[0], 1, &work->buffer_ref))
+
+    promise = queue_async_work(env, "westfield:createMemoryMappedFile", execute_memory_mapped_file_work,
+                               complete_memory_mapped_file_work, work, &work->work, &work->deferred);
+    return promise;
+}
+
+// expected arguments in order:
+// - Object display
 // return:
 // - void
 napi_value
@@ -679,9 +1283,6 @@ initShm(napi_env env, napi_callback_info info) {
     display_value = argv[0];
     NAPI_CALL(env, napi_get_value_external(env, display_value, (void **) &display))
 
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
     wl_display_init_shm(display);
 
     // FIXME don't hardcode shm formats here
@@ -701,6 +1302,19 @@ finalize_westfield_drm(napi_env env,
     westfield_egl_finalize(finalize_data);
 }
 
+// announce the egl backed buffer protocols, must run on the main thread
+static void
+create_drm_globals(struct wl_display *display, struct westfield_egl *westfield_egl) {
+    // init wayland egl related buffer protocols
+    if (westfield_egl) {
+        // TODO do something with the global objects?
+        wlr_linux_dmabuf_v1_create_with_renderer(display, 4, westfield_egl);
+        wlr_drm_create(display, westfield_egl);
+    } else {
+        fprintf(stderr, "Can't initialize EGL, wl_dmabuf and wl_drm disabled.");
+    }
+}
+
 // expected arguments in order:
 // - Object display
 // - string device_path
@@ -722,26 +1336,83 @@ initDrm(napi_env env, napi_callback_info info) {
     NAPI_CALL(env,
               napi_get_value_string_utf8(env, device_path_value, device_path, sizeof(device_path), &device_path_length))
 
-    struct display_destruction_listener *display_destruction_listener = (struct display_destruction_listener *) wl_display_get_destroy_listener(
-            display, on_display_destroyed);
-    display_destruction_listener->env = env;
-
     // init egl backend
     westfield_egl = westfield_egl_new(device_path);
-    // init wayland egl related buffer protocols
-    if (westfield_egl) {
-        // TODO do something with the global objects?
-        wlr_linux_dmabuf_v1_create_with_renderer(display, 4, westfield_egl);
-        wlr_drm_create(display, westfield_egl);
-    } else {
-        fprintf(stderr, "Can't initialize EGL, wl_dmabuf and wl_drm disabled.");
-    }
+    create_drm_globals(display, westfield_egl);
 
     NAPI_CALL(env, napi_create_external(env, westfield_egl, finalize_westfield_drm, NULL, &return_value))
 
     return return_value;
 }
 
+static void
+execute_drm_init_work(napi_env env, void *data) {
+    struct drm_init_work *work = data;
+
+    // the egl context is no longer current once this returns, so it can be created on any thread
+    work->westfield_egl = westfield_egl_new(work->device_path);
+}
+
+static void
+drm_init_work_display_destroyed(struct wl_listener *listener, void *data) {
+    struct drm_init_work *work = wl_container_of(listener, work, display_destroy_listener);
+
+    wl_list_remove(&work->display_destroy_listener.link);
+    work->display = NULL;
+}
+
+static void
+complete_drm_init_work(napi_env env, napi_status status, void *data) {
+    struct drm_init_work *work = data;
+    napi_value return_value;
+
+    if (work->display) {
+        wl_list_remove(&work->display_destroy_listener.link);
+    }
+
+    if (status != napi_ok || work->westfield_egl == NULL) {
+        reject_deferred(env, work->deferred, "Can't initialize EGL.");
+    } else if (work->display == NULL) {
+        westfield_egl_finalize(work->westfield_egl);
+        reject_deferred(env, work->deferred, "Display destroyed before EGL was initialized.");
+    } else {
+        create_drm_globals(work->display, work->westfield_egl);
+        NAPI_CALL(env, napi_create_external(env, work->westfield_egl, finalize_westfield_drm, NULL, &return_value))
+        NAPI_CALL(env, napi_resolve_deferred(env, work->deferred, return_value))
+    }
+
+    NAPI_CALL(env, napi_delete_async_work(env, work->work))
+    free(work);
+}
+
+// Like initDrm, but opens the device and initializes EGL on the thread pool.
+// expected arguments in order:
+// - Object display
+// - string device_path
+// return:
+// - Promise<unknown> resolving to a westfield_drm object, rejected if EGL can't be initialized or the display is
+//   destroyed first
+napi_value
+initDrmAsync(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], promise;
+    struct drm_init_work *work;
+    size_t device_path_length;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+
+    work = calloc(1, sizeof(*work));
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &work->display))
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[1], work->device_path, sizeof(work->device_path),
+                                              &device_path_length))
+    work->display_destroy_listener.notify = drm_init_work_display_destroyed;
+    wl_display_add_destroy_listener(work->display, &work->display_destroy_listener);
+
+    promise = queue_async_work(env, "westfield:initDrm", execute_drm_init_work, complete_drm_init_work, work,
+                               &work->work, &work->deferred);
+    return promise;
+}
+
 // expected arguments in order:
 // - Object client
 // - onSyncDone(Object client, number callbackId):void
@@ -763,8 +1434,7 @@ setSyncDoneCallback(napi_env env, napi_callback_info info) {
     NAPI_CALL(env, napi_get_value_external(env, client_value, (void **) &client))
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->sync_done_cb_ref = js_cb_ref;
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -792,8 +1462,7 @@ setRegistryCreatedCallback(napi_env env, napi_callback_info info) {
     NAPI_CALL(env, napi_get_value_external(env, client_value, (void **) &client))
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->registry_created_cb_ref = js_cb_ref;
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -821,8 +1490,7 @@ setBufferCreatedCallback(napi_env env, napi_callback_info info) {
     NAPI_CALL(env, napi_get_value_external(env, client_value, (void **) &client))
     NAPI_CALL(env, napi_create_reference(env, js_cb, 1, &js_cb_ref))
 
-    destruction_listener = (struct client_destruction_listener *) wl_client_get_destroy_listener(client,
-                                                                                                 on_client_destroyed);
+    destruction_listener = get_client_listener(client);
     destruction_listener->buffer_created_cb_ref = js_cb_ref;
 
     NAPI_CALL(env, napi_get_undefined(env, &return_value))
@@ -1019,6 +1687,80 @@ getServerObjectIdsBatch(napi_env env, napi_callback_info info) {
     return return_value;
 }
 
+// Hand server object ids back for reuse, once the objects are gone and the browser compositor confirmed it recycled
+// their ids. Keeps the object map of long running clients proportional to their live objects.
+// expected arguments in order:
+// - Object client
+// - Uint32Array ids
+// return:
+// - number of ids released
+napi_value
+releaseServerObjectIds(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_client *client;
+    uint32_t *ids;
+    size_t amount;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_typedarray_info(env, argv[1], NULL, &amount, (void **) &ids, NULL, NULL))
+
+    NAPI_CALL(env, napi_create_uint32(env, wl_client_release_server_object_ids(client, ids, amount), &return_value))
+    return return_value;
+}
+
+// Reserve server object ids ahead, so JS can take them without calling into the addon. The returned array starts with the
+// number of ids JS has taken and the number of ids native has filled in, both only ever growing, followed by a ring of
+// capacity ids. JS takes the id at 2 + taken % capacity as long as taken != filled, and increments taken. The pool is
+// topped up after each batch of wire messages and each sendEvents, when fewer than lowWater ids are left.
+// getServerObjectIdsBatch remains available for when it runs dry.
+// expected arguments in order:
+// - Object client
+// - number capacity, rounded up to a power of 2
+// - number lowWater
+// return:
+// - Uint32Array
+napi_value
+createServerObjectIdPool(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], pool_buffer, return_value;
+    struct wl_client *client;
+    struct client_destruction_listener *destruction_listener;
+    uint32_t capacity = 1, requested_capacity, low_water;
+    void *pool;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &requested_capacity))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &low_water))
+
+    // the counters wrap around at 2^32, which only keeps the ring intact for a power of 2 capacity
+    while (capacity < requested_capacity && capacity < (1u << 16)) {
+        capacity <<= 1;
+    }
+
+    destruction_listener = get_client_listener(client);
+    if (destruction_listener->id_pool_ref) {
+        release_id_pool(client, destruction_listener);
+        destruction_listener->id_pool = NULL;
+        NAPI_CALL(env, napi_delete_reference(env, destruction_listener->id_pool_ref))
+    }
+
+    NAPI_CALL(env, napi_create_arraybuffer(env, (ID_POOL_IDS + capacity) * sizeof(uint32_t), &pool, &pool_buffer))
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint32_array, ID_POOL_IDS + capacity, pool_buffer, 0,
+                                          &return_value))
+    NAPI_CALL(env, napi_create_reference(env, pool_buffer, 1, &destruction_listener->id_pool_ref))
+
+    destruction_listener->id_pool = pool;
+    destruction_listener->id_pool_capacity = capacity;
+    destruction_listener->id_pool_low_water = low_water < capacity ? low_water : capacity;
+    memset(pool, 0, ID_POOL_IDS * sizeof(uint32_t));
+    fill_id_pool(client, destruction_listener);
+
+    return return_value;
+}
+
 napi_value
 makePipe(napi_env env, napi_callback_info info) {
     size_t argc = 1;
@@ -1109,6 +1851,81 @@ setupXWayland(napi_env env, napi_callback_info info) {
     return return_value;
 }
 
+static void
+execute_xwayland_setup_work(napi_env env, void *data) {
+    struct xwayland_setup_work *work = data;
+
+    work->westfield_xwayland = westfield_xwayland_prepare();
+}
+
+static void
+xwayland_setup_work_display_destroyed(struct wl_listener *listener, void *data) {
+    struct xwayland_setup_work *work = wl_container_of(listener, work, display_destroy_listener);
+
+    wl_list_remove(&work->display_destroy_listener.link);
+    work->display = NULL;
+}
+
+static void
+complete_xwayland_setup_work(napi_env env, napi_status status, void *data) {
+    struct xwayland_setup_work *work = data;
+    struct weston_xwayland_callbacks *callbacks = work->callbacks;
+    napi_value return_value;
+
+    if (work->display) {
+        wl_list_remove(&work->display_destroy_listener.link);
+    }
+
+    if (status == napi_ok && work->westfield_xwayland && work->display) {
+        westfield_xwayland_start(work->westfield_xwayland, work->display, callbacks, westfield_xserver_starting,
+                                 westfield_xserver_destroyed);
+        NAPI_CALL(env, napi_create_external(env, work->westfield_xwayland, NULL, NULL, &return_value))
+        NAPI_CALL(env, napi_resolve_deferred(env, work->deferred, return_value))
+    } else {
+        if (work->westfield_xwayland) {
+            // releases the lock file and socket of the prepared display
+            westfield_xwayland_teardown(work->westfield_xwayland);
+        }
+        NAPI_CALL(env, napi_delete_reference(env, callbacks->xwayland_starting_cb_ref))
+        NAPI_CALL(env, napi_delete_reference(env, callbacks->xwwayland_destroyed_cb_ref))
+        free(callbacks);
+        reject_deferred(env, work->deferred, work->display ? "Can't set up XWayland." :
+                                             "Display destroyed before XWayland was set up.");
+    }
+
+    NAPI_CALL(env, napi_delete_async_work(env, work->work))
+    free(work);
+}
+
+// Like setupXWayland, but takes the X display lock file and binds its socket on the thread pool.
+// expected arguments in order:
+// - Object display
+// - onXWaylandStarting(number wmFd, Object client, number displayFd):void
+// - onXWaylandDestroyed():void
+// return:
+// - Promise resolving to an XWayland handle, rejected if XWayland can't be set up or the display is destroyed first
+napi_value
+setupXWaylandAsync(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], promise;
+    struct xwayland_setup_work *work;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+
+    work = calloc(1, sizeof(*work));
+    work->callbacks = calloc(1, sizeof(struct weston_xwayland_callbacks));
+    work->callbacks->env = env;
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &work->display))
+    NAPI_CALL(env, napi_create_reference(env, argv[1], 1, &work->callbacks->xwayland_starting_cb_ref))
+    NAPI_CALL(env, napi_create_reference(env, argv[2], 1, &work->callbacks->xwwayland_destroyed_cb_ref))
+    work->display_destroy_listener.notify = xwayland_setup_work_display_destroyed;
+    wl_display_add_destroy_listener(work->display, &work->display_destroy_listener);
+
+    promise = queue_async_work(env, "westfield:setupXWayland", execute_xwayland_setup_work,
+                               complete_xwayland_setup_work, work, &work->work, &work->deferred);
+    return promise;
+}
+
 napi_value
 teardownXWayland(napi_env env, napi_callback_info info) {
     size_t argc = 1;
@@ -1182,47 +1999,1749 @@ getCredentials(napi_env env, napi_callback_info info) {
     return return_value;
 }
 
+static struct wl_shm_buffer *
+get_shm_buffer(struct wl_client *client, uint32_t buffer_id) {
+    return wl_shm_buffer_get(wl_client_get_object(client, buffer_id));
+}
+
+static void
+on_encoded_frame(void *user_data, struct westfield_encoded_frame *frame) {
+    struct westfield_encoder_callbacks *encoder_callbacks = user_data;
+    napi_env env = encoder_callbacks->env;
+    napi_value cb, global, cb_result, serial_value, frame_value, keyframe_value, width_value, height_value;
+    napi_handle_scope scope;
+
+    NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+    if (frame->data) {
+        NAPI_CALL(env, napi_create_external_arraybuffer(env, frame->data, frame->size, finalize_cb, NULL, &frame_value))
+    } else {
+        NAPI_CALL(env, napi_get_null(env, &frame_value))
+    }
+    NAPI_CALL(env, napi_create_uint32(env, frame->serial, &serial_value))
+    NAPI_CALL(env, napi_get_boolean(env, frame->keyframe, &keyframe_value))
+    NAPI_CALL(env, napi_create_int32(env, frame->width, &width_value))
+    NAPI_CALL(env, napi_create_int32(env, frame->height, &height_value))
+    napi_value argv[5] = {serial_value, frame_value, keyframe_value, width_value, height_value};
+
+    NAPI_CALL(env, napi_get_reference_value(env, encoder_callbacks->frame_done_cb_ref, &cb))
+    NAPI_CALL(env, napi_get_global(env, &global))
+    NAPI_CALL(env, napi_call_function(env, global, cb, 5, argv, &cb_result))
+    NAPI_CALL(env, napi_close_handle_scope(env, scope))
+}
+
+// expected arguments in order:
+// - Object display
+// - number bitrateKbps
+// - number keyframeInterval
+// - number maxFramesInFlight
+// - onEncodedFrame(number serial, ArrayBuffer|null bitstream, boolean keyframe, number width, number height):void
+// return:
+// - Object encoder or undefined if no encoder is available
+napi_value
+createEncoder(napi_env env, napi_callback_info info) {
+    size_t argc = 5;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    struct westfield_encoder_config config;
+    struct westfield_encoder_callbacks *encoder_callbacks;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &config.bitrate_kbps))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &config.keyframe_interval))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[3], &config.max_frames_in_flight))
+
+    encoder_callbacks = calloc(1, sizeof(struct westfield_encoder_callbacks));
+    encoder_callbacks->env = env;
+    encoder_callbacks->encoder = westfield_encoder_create(wl_display_get_event_loop(display), &config,
+                                                          encoder_callbacks, on_encoded_frame);
+    if (encoder_callbacks->encoder == NULL) {
+        free(encoder_callbacks);
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_reference(env, argv[4], 1, &encoder_callbacks->frame_done_cb_ref))
+    NAPI_CALL(env, napi_create_external(env, encoder_callbacks, NULL, NULL, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object encoder
+// - Object client
+// - number bufferId
+// - number serial
+// return:
+// - boolean true if the frame was queued for encoding
 napi_value
-init(napi_env env, napi_value exports) {
-    napi_property_descriptor desc[] = {
-            // core
-            DECLARE_NAPI_METHOD("createDisplay", createDisplay),
-            DECLARE_NAPI_METHOD("destroyDisplay", destroyDisplay),
-            DECLARE_NAPI_METHOD("addSocketAuto", addSocketAuto),
-            DECLARE_NAPI_METHOD("getFd", getFd),
-            DECLARE_NAPI_METHOD("destroyClient", destroyClient),
-            DECLARE_NAPI_METHOD("sendEvents", sendEvents),
-            DECLARE_NAPI_METHOD("dispatchRequests", dispatchRequests),
-            DECLARE_NAPI_METHOD("flush", flush),
-            DECLARE_NAPI_METHOD("createMemoryMappedFile", createMemoryMappedFile),
-            DECLARE_NAPI_METHOD("initShm", initShm),
-            DECLARE_NAPI_METHOD("initDrm", initDrm),
-            DECLARE_NAPI_METHOD("setWireMessageCallback", setWireMessageCallback),
-            DECLARE_NAPI_METHOD("setWireMessageEndCallback", setWireMessageEndCallback),
-            DECLARE_NAPI_METHOD("setClientDestroyedCallback", setClientDestroyedCallback),
-            DECLARE_NAPI_METHOD("setRegistryCreatedCallback", setRegistryCreatedCallback),
-            DECLARE_NAPI_METHOD("setSyncDoneCallback", setSyncDoneCallback),
-            DECLARE_NAPI_METHOD("emitGlobals", emitGlobals),
-            DECLARE_NAPI_METHOD("createWlMessage", createWlMessage),
-            DECLARE_NAPI_METHOD("initWlInterface", initWlInterface),
-            DECLARE_NAPI_METHOD("createWlInterface", createWlInterface),
-            DECLARE_NAPI_METHOD("createWlResource", createWlResource),
-            DECLARE_NAPI_METHOD("destroyWlResourceSilently", destroyWlResourceSilently),
-            DECLARE_NAPI_METHOD("setBufferCreatedCallback", setBufferCreatedCallback),
-            DECLARE_NAPI_METHOD("getServerObjectIdsBatch", getServerObjectIdsBatch),
-            DECLARE_NAPI_METHOD("makePipe", makePipe),
-            DECLARE_NAPI_METHOD("equalValueExternal", equalValueExternal),
-            DECLARE_NAPI_METHOD("getCredentials", getCredentials),
+encodeShmBuffer(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value;
+    struct westfield_encoder_callbacks *encoder_callbacks;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    uint32_t buffer_id, serial;
+    bool queued = false;
 
-            // xwayland
-            DECLARE_NAPI_METHOD("setupXWayland", setupXWayland),
-            DECLARE_NAPI_METHOD("teardownXWayland", teardownXWayland),
-            DECLARE_NAPI_METHOD("getXWaylandDisplay", getXWaylandDisplay),
-    };
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &encoder_callbacks))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[3], &serial))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer) {
+        queued = westfield_encoder_encode_shm_buffer(encoder_callbacks->encoder, shm_buffer, serial);
+    }
 
-    NAPI_CALL(env, napi_define_properties(env, exports, sizeof(desc) / sizeof(napi_property_descriptor), desc))
+    NAPI_CALL(env, napi_get_boolean(env, queued, &return_value))
+    return return_value;
+}
+
+napi_value
+requestEncoderKeyframe(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_encoder_callbacks *encoder_callbacks;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &encoder_callbacks))
+
+    westfield_encoder_request_keyframe(encoder_callbacks->encoder);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+napi_value
+setEncoderBitrate(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct westfield_encoder_callbacks *encoder_callbacks;
+    uint32_t bitrate_kbps;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &encoder_callbacks))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &bitrate_kbps))
+
+    westfield_encoder_set_bitrate(encoder_callbacks->encoder, bitrate_kbps);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+napi_value
+destroyEncoder(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_encoder_callbacks *encoder_callbacks;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &encoder_callbacks))
+
+    westfield_encoder_destroy(encoder_callbacks->encoder);
+    NAPI_CALL(env, napi_delete_reference(env, encoder_callbacks->frame_done_cb_ref))
+    free(encoder_callbacks);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+static napi_value
+create_int32_array(napi_env env, const int32_t *values, size_t length) {
+    napi_value array_buffer, int32_array;
+    void *data;
+
+    NAPI_CALL(env, napi_create_arraybuffer(env, length * sizeof(int32_t), &data, &array_buffer))
+    if (length) {
+        memcpy(data, values, length * sizeof(int32_t));
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_int32_array, length, array_buffer, 0, &int32_array))
+
+    return int32_array;
+}
+
+napi_value
+createScrollDetector(napi_env env, napi_callback_info info) {
+    napi_value return_value;
+    struct westfield_scroll_detector *detector;
+
+    detector = westfield_scroll_detector_create();
+    NAPI_CALL(env, napi_create_external(env, detector, NULL, NULL, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object detector
+// - Object client
+// - number bufferId
+// return:
+// - { copyRects: Int32Array, damageRects: Int32Array } or undefined if the buffer is not a supported shm buffer.
+//   copyRects holds [srcX, srcY, dstX, dstY, width, height] tuples to apply on the previous frame, followed by
+//   damageRects holding [x, y, width, height] tuples to repaint from the buffer.
+napi_value
+detectScroll(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value, copy_rects_value, damage_rects_value;
+    struct westfield_scroll_detector *detector;
+    struct westfield_scroll_result result;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    uint32_t buffer_id;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &detector))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL || !westfield_scroll_detector_process_shm_buffer(detector, shm_buffer, &result)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    copy_rects_value = create_int32_array(env, (const int32_t *) result.copy_rects, result.copy_rect_count * 6);
+    damage_rects_value = create_int32_array(env, (const int32_t *) result.damage_rects, result.damage_rect_count * 4);
+    westfield_scroll_result_release(&result);
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "copyRects", copy_rects_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "damageRects", damage_rects_value))
+    return return_value;
+}
 
-    westfield_xwayland_init();
+napi_value
+destroyScrollDetector(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_scroll_detector *detector;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &detector))
+
+    westfield_scroll_detector_destroy(detector);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+napi_value
+createTileClassifier(napi_env env, napi_callback_info info) {
+    napi_value return_value;
+    struct westfield_tile_classifier *classifier;
+
+    classifier = westfield_tile_classifier_create();
+    NAPI_CALL(env, napi_create_external(env, classifier, NULL, NULL, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object classifier
+// - Object client
+// - number bufferId
+// - Int32Array damage as [x, y, width, height] tuples
+// return:
+// - Int32Array of [x, y, width, height, tileClass] tuples for each damaged tile, or undefined if the buffer is not a
+//   supported shm buffer.
+napi_value
+classifyTiles(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value;
+    struct westfield_tile_classifier *classifier;
+    struct westfield_tile_tag *tag;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    struct wl_array tags, tuples;
+    struct westfield_rect *damage;
+    size_t damage_length;
+    uint32_t buffer_id;
+    int32_t *tuple;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &classifier))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+    NAPI_CALL(env, napi_get_typedarray_info(env, argv[3], NULL, &damage_length, (void **) &damage, NULL, NULL))
+
+    wl_array_init(&tags);
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL ||
+        !westfield_tile_classifier_classify_shm_buffer(classifier, shm_buffer, damage, damage_length / 4, &tags)) {
+        wl_array_release(&tags);
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    wl_array_init(&tuples);
+    wl_array_for_each(tag, &tags) {
+        tuple = wl_array_add(&tuples, sizeof(int32_t) * 5);
+        if (tuple == NULL) {
+            break;
+        }
+        tuple[0] = tag->rect.x;
+        tuple[1] = tag->rect.y;
+        tuple[2] = tag->rect.width;
+        tuple[3] = tag->rect.height;
+        tuple[4] = tag->tile_class;
+    }
+    return_value = create_int32_array(env, tuples.data, tuples.size / sizeof(int32_t));
+    wl_array_release(&tuples);
+    wl_array_release(&tags);
+
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object classifier
+// - number tileClass
+// - number rawBytes
+// - number encodedBytes
+napi_value
+reportEncodedTile(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value;
+    struct westfield_tile_classifier *classifier;
+    uint32_t tile_class;
+    int64_t raw_bytes, encoded_bytes;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &classifier))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &tile_class))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[2], &raw_bytes))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[3], &encoded_bytes))
+
+    westfield_tile_classifier_report_encoded(classifier, tile_class, raw_bytes, encoded_bytes);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+static void
+set_named_double(napi_env env, napi_value object, const char *name, double value) {
+    napi_value number_value;
+
+    NAPI_CALL(env, napi_create_double(env, value, &number_value))
+    NAPI_CALL(env, napi_set_named_property(env, object, name, number_value))
+}
+
+napi_value
+getTileClassifierStats(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_tile_classifier *classifier;
+    struct westfield_tile_classifier_stats stats;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &classifier))
+
+    westfield_tile_classifier_get_stats(classifier, &stats);
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "losslessTiles", (double) stats.tiles[WESTFIELD_TILE_LOSSLESS]);
+    set_named_double(env, return_value, "lossyTiles", (double) stats.tiles[WESTFIELD_TILE_LOSSY]);
+    set_named_double(env, return_value, "classFlips", (double) stats.class_flips);
+    set_named_double(env, return_value, "losslessRawBytes", (double) stats.raw_bytes[WESTFIELD_TILE_LOSSLESS]);
+    set_named_double(env, return_value, "losslessEncodedBytes", (double) stats.encoded_bytes[WESTFIELD_TILE_LOSSLESS]);
+    set_named_double(env, return_value, "lossyRawBytes", (double) stats.raw_bytes[WESTFIELD_TILE_LOSSY]);
+    set_named_double(env, return_value, "lossyEncodedBytes", (double) stats.encoded_bytes[WESTFIELD_TILE_LOSSY]);
+    set_named_double(env, return_value, "bytesSaved", (double) stats.bytes_saved);
+    return return_value;
+}
+
+napi_value
+destroyTileClassifier(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_tile_classifier *classifier;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &classifier))
+
+    westfield_tile_classifier_destroy(classifier);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - number maxBytes
+// return:
+// - Object pixel cache
+napi_value
+createPixelCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_pixel_cache *cache;
+    int64_t max_bytes;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &max_bytes))
+
+    cache = westfield_pixel_cache_create(max_bytes < 0 ? 0 : max_bytes);
+    NAPI_CALL(env, napi_create_external(env, cache, NULL, NULL, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object pixel cache
+// - Object client
+// - number bufferId
+// return:
+// - { hash: bigint, hit: boolean } or undefined if the buffer is not a supported shm buffer. If hit is false, the hash
+//   was added to the cache and the pixels should be sent along with it.
+napi_value
+pixelCacheLookupBuffer(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value, hash_value, hit_value;
+    struct westfield_pixel_cache *cache;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    uint32_t buffer_id;
+    uint64_t hash, size;
+    bool hit;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL || !westfield_pixel_cache_hash_shm_buffer(shm_buffer, NULL, &hash, &size)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+    hit = westfield_pixel_cache_lookup_or_insert(cache, hash, size);
+
+    NAPI_CALL(env, napi_create_bigint_uint64(env, hash, &hash_value))
+    NAPI_CALL(env, napi_get_boolean(env, hit, &hit_value))
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hash", hash_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hit", hit_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object pixel cache
+// - Object client
+// - number bufferId
+// - Int32Array tiles as [x, y, width, height] tuples
+// return:
+// - { hashes: BigUint64Array, hits: Uint8Array } with an entry per tile, or undefined if the buffer is not a supported
+//   shm buffer. Tiles that don't lie within the buffer get a 0 hash and are never a hit.
+napi_value
+pixelCacheLookupTiles(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value, hashes_buffer, hashes_value, hits_buffer, hits_value;
+    struct westfield_pixel_cache *cache;
+    struct westfield_rect *tiles;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    size_t tiles_length, tile_count;
+    uint32_t buffer_id;
+    uint64_t *hashes, size;
+    uint8_t *hits;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+    NAPI_CALL(env, napi_get_typedarray_info(env, argv[3], NULL, &tiles_length, (void **) &tiles, NULL, NULL))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL || (wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_ARGB8888 &&
+                               wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_XRGB8888)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    tile_count = tiles_length / 4;
+    NAPI_CALL(env, napi_create_arraybuffer(env, tile_count * sizeof(uint64_t), (void **) &hashes, &hashes_buffer))
+    NAPI_CALL(env, napi_create_arraybuffer(env, tile_count, (void **) &hits, &hits_buffer))
+
+    for (size_t i = 0; i < tile_count; i++) {
+        if (westfield_pixel_cache_hash_shm_buffer(shm_buffer, &tiles[i], &hashes[i], &size)) {
+            hits[i] = westfield_pixel_cache_lookup_or_insert(cache, hashes[i], size);
+        } else {
+            hashes[i] = 0;
+            hits[i] = 0;
+        }
+    }
+
+    NAPI_CALL(env, napi_create_typedarray(env, napi_biguint64_array, tile_count, hashes_buffer, 0, &hashes_value))
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint8_array, tile_count, hits_buffer, 0, &hits_value))
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hashes", hashes_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hits", hits_value))
+    return return_value;
+}
+
+napi_value
+pixelCacheRemove(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct westfield_pixel_cache *cache;
+    uint64_t hash;
+    bool lossless;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_bigint_uint64(env, argv[1], &hash, &lossless))
+
+    westfield_pixel_cache_remove(cache, hash);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object pixel cache
+// return:
+// - BigUint64Array of the hashes evicted since the last call, which the browser can drop
+napi_value
+pixelCacheTakeEvicted(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value, evicted_buffer;
+    struct westfield_pixel_cache *cache;
+    struct wl_array evicted;
+    void *evicted_data;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_pixel_cache_take_evicted(cache, &evicted);
+    NAPI_CALL(env, napi_create_arraybuffer(env, evicted.size, &evicted_data, &evicted_buffer))
+    if (evicted.size) {
+        memcpy(evicted_data, evicted.data, evicted.size);
+    }
+    wl_array_release(&evicted);
+
+    NAPI_CALL(env, napi_create_typedarray(env, napi_biguint64_array, evicted.size / sizeof(uint64_t),
+                                          evicted_buffer, 0, &return_value))
+    return return_value;
+}
+
+napi_value
+setPixelCacheMaxBytes(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct westfield_pixel_cache *cache;
+    int64_t max_bytes;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &max_bytes))
+
+    westfield_pixel_cache_set_max_bytes(cache, max_bytes < 0 ? 0 : max_bytes);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+napi_value
+getPixelCacheStats(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_pixel_cache *cache;
+    struct westfield_pixel_cache_stats stats;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "lookups", (double) stats.lookups);
+    set_named_double(env, return_value, "hits", (double) stats.hits);
+    set_named_double(env, return_value, "hitRate", stats.lookups ? (double) stats.hits / (double) stats.lookups : 0);
+    set_named_double(env, return_value, "evictions", (double) stats.evictions);
+    set_named_double(env, return_value, "entries", (double) stats.entries);
+    set_named_double(env, return_value, "bytes", (double) stats.bytes);
+    set_named_double(env, return_value, "maxBytes", (double) stats.max_bytes);
+    return return_value;
+}
+
+napi_value
+destroyPixelCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_pixel_cache *cache;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_pixel_cache_destroy(cache);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - number maxCursors
+// return:
+// - Object cursor cache
+napi_value
+createCursorCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_cursor_cache *cache;
+    uint32_t max_cursors;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &max_cursors))
+
+    cache = westfield_cursor_cache_create(max_cursors);
+    NAPI_CALL(env, napi_create_external(env, cache, NULL, NULL, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object cursor cache
+// - Object client
+// - number bufferId of the buffer attached to the cursor-role surface
+// - number hotspotX
+// - number hotspotY
+// return:
+// - { cursorId, isNew, width, height, hotspotX, hotspotY, pixels: ArrayBuffer|null, evictedCursorIds: Uint32Array }
+//   or undefined if the buffer is not a supported shm buffer. pixels is only set if isNew is true.
+napi_value
+updateCursorImage(napi_env env, napi_callback_info info) {
+    size_t argc = 5;
+    napi_value argv[argc], return_value, value;
+    struct westfield_cursor_cache *cache;
+    struct westfield_cursor cursor;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    struct wl_array evicted_ids;
+    uint32_t buffer_id;
+    int32_t hotspot_x, hotspot_y;
+    void *evicted_data;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &buffer_id))
+    NAPI_CALL(env, napi_get_value_int32(env, argv[3], &hotspot_x))
+    NAPI_CALL(env, napi_get_value_int32(env, argv[4], &hotspot_y))
+
+    wl_array_init(&evicted_ids);
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL ||
+        !westfield_cursor_cache_update(cache, shm_buffer, hotspot_x, hotspot_y, &cursor, &evicted_ids)) {
+        wl_array_release(&evicted_ids);
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_create_uint32(env, cursor.id, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "cursorId", value))
+    NAPI_CALL(env, napi_get_boolean(env, cursor.is_new, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "isNew", value))
+    NAPI_CALL(env, napi_create_int32(env, cursor.width, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "width", value))
+    NAPI_CALL(env, napi_create_int32(env, cursor.height, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "height", value))
+    NAPI_CALL(env, napi_create_int32(env, cursor.hotspot_x, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hotspotX", value))
+    NAPI_CALL(env, napi_create_int32(env, cursor.hotspot_y, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "hotspotY", value))
+
+    if (cursor.pixels) {
+        NAPI_CALL(env, napi_create_external_arraybuffer(env, cursor.pixels, (size_t) cursor.width * cursor.height * 4,
+                                                        finalize_cb, NULL, &value))
+    } else {
+        NAPI_CALL(env, napi_get_null(env, &value))
+    }
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "pixels", value))
+
+    NAPI_CALL(env, napi_create_arraybuffer(env, evicted_ids.size, &evicted_data, &value))
+    if (evicted_ids.size) {
+        memcpy(evicted_data, evicted_ids.data, evicted_ids.size);
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint32_array, evicted_ids.size / sizeof(uint32_t), value, 0,
+                                          &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "evictedCursorIds", value))
+    wl_array_release(&evicted_ids);
+
+    return return_value;
+}
+
+napi_value
+destroyCursorCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_cursor_cache *cache;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_cursor_cache_destroy(cache);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object client
+// - number bufferId
+// - number filter, 0 for box or 1 for bilinear
+// - number scale, the factor by which to shrink the buffer
+// - Int32Array damage as [x, y, width, height] tuples in buffer coordinates
+// return:
+// - { width, height, rects: Int32Array, pixels: ArrayBuffer } or undefined if the buffer is not a supported shm buffer.
+//   rects holds the damage as [x, y, width, height] tuples in downscaled coordinates, pixels the tightly packed pixels
+//   of each rect, one rect after the other.
+napi_value
+downscaleShmBuffer(napi_env env, napi_callback_info info) {
+    size_t argc = 5;
+    napi_value argv[argc], return_value, value;
+    struct westfield_downscaled downscaled;
+    struct westfield_rect *damage;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    size_t damage_length;
+    uint32_t buffer_id, filter;
+    double scale;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &buffer_id))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &filter))
+    NAPI_CALL(env, napi_get_value_double(env, argv[3], &scale))
+    NAPI_CALL(env, napi_get_typedarray_info(env, argv[4], NULL, &damage_length, (void **) &damage, NULL, NULL))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL ||
+        !westfield_downscale_shm_buffer(shm_buffer, filter, (float) scale, damage, damage_length / 4, &downscaled)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_create_int32(env, downscaled.width, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "width", value))
+    NAPI_CALL(env, napi_create_int32(env, downscaled.height, &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "height", value))
+    value = create_int32_array(env, (const int32_t *) downscaled.rects, downscaled.rect_count * 4);
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "rects", value))
+    NAPI_CALL(env, napi_create_external_arraybuffer(env, downscaled.pixels, downscaled.pixels_size, finalize_cb, NULL,
+                                                    &value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "pixels", value))
+
+    // pixels are now owned by the array buffer
+    downscaled.pixels = NULL;
+    westfield_downscaled_release(&downscaled);
+
+    return return_value;
+}
+
+// expected arguments in order:
+// - number minBitrateKbps
+// - number maxBitrateKbps
+// - number maxFps
+// return:
+// - Object quality controller or undefined if it could not be allocated
+napi_value
+createQualityController(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value;
+    struct westfield_quality_controller *controller;
+    struct westfield_quality_config config;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &config.min_bitrate_kbps))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &config.max_bitrate_kbps))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &config.max_fps))
+
+    controller = westfield_quality_controller_create(&config);
+    if (controller) {
+        NAPI_CALL(env, napi_create_external(env, controller, NULL, NULL, &return_value))
+    } else {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    }
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object quality controller
+// - number bytes
+// - number nowMs
+napi_value
+qualityReportSent(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value;
+    struct westfield_quality_controller *controller;
+    int64_t bytes;
+    double now_ms;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &controller))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &bytes))
+    NAPI_CALL(env, napi_get_value_double(env, argv[2], &now_ms))
+
+    westfield_quality_controller_report_sent(controller, bytes < 0 ? 0 : bytes, now_ms);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object quality controller
+// - number bytes
+// - number latencyMs, time between sending the frame and the browser acknowledging it
+// - number nowMs
+napi_value
+qualityReportAcked(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[argc], return_value;
+    struct westfield_quality_controller *controller;
+    int64_t bytes;
+    double latency_ms, now_ms;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &controller))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &bytes))
+    NAPI_CALL(env, napi_get_value_double(env, argv[2], &latency_ms))
+    NAPI_CALL(env, napi_get_value_double(env, argv[3], &now_ms))
+
+    westfield_quality_controller_report_acked(controller, bytes < 0 ? 0 : bytes, latency_ms, now_ms);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object quality controller
+// - number nowMs
+// return:
+// - { bitrateKbps, compressionLevel, maxFps, bandwidthKbps, latencyMs, bytesInFlight, congested }
+napi_value
+getQualityDecision(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value, congested_value;
+    struct westfield_quality_controller *controller;
+    struct westfield_quality_decision decision;
+    double now_ms;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &controller))
+    NAPI_CALL(env, napi_get_value_double(env, argv[1], &now_ms))
+
+    westfield_quality_controller_get_decision(controller, now_ms, &decision);
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "bitrateKbps", decision.bitrate_kbps);
+    set_named_double(env, return_value, "compressionLevel", decision.compression_level);
+    set_named_double(env, return_value, "maxFps", decision.max_fps);
+    set_named_double(env, return_value, "bandwidthKbps", decision.bandwidth_kbps);
+    set_named_double(env, return_value, "latencyMs", decision.latency_ms);
+    set_named_double(env, return_value, "bytesInFlight", (double) decision.bytes_in_flight);
+    NAPI_CALL(env, napi_get_boolean(env, decision.congested, &congested_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "congested", congested_value))
+    return return_value;
+}
+
+napi_value
+destroyQualityController(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_quality_controller *controller;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &controller))
+
+    westfield_quality_controller_destroy(controller);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object display
+// - boolean enabled
+napi_value
+setShmDirtyTracking(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    bool enabled;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_bool(env, argv[1], &enabled))
+
+    wl_display_set_shm_dirty_tracking(display, enabled);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object client
+// - number bufferId
+// return:
+// - Int32Array of [x, y, width, height] tuples that changed since the previous call for the same buffer, or undefined
+//   if the buffer is not an shm buffer or dirty tracking is disabled.
+napi_value
+collectShmDamage(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    struct wl_array damage;
+    uint32_t buffer_id;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &buffer_id))
+
+    wl_array_init(&damage);
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer == NULL || wl_shm_buffer_collect_damage(shm_buffer, &damage) < 0) {
+        wl_array_release(&damage);
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    return_value = create_int32_array(env, damage.data, damage.size / sizeof(int32_t));
+    wl_array_release(&damage);
+
+    return return_value;
+}
+
+static bool
+get_named_bool(napi_env env, napi_value object, const char *name) {
+    napi_value value;
+    bool has_property = false, result = false;
+
+    NAPI_CALL(env, napi_has_named_property(env, object, name, &has_property))
+    if (has_property) {
+        NAPI_CALL(env, napi_get_named_property(env, object, name, &value))
+        NAPI_CALL(env, napi_coerce_to_bool(env, value, &value))
+        NAPI_CALL(env, napi_get_value_bool(env, value, &result))
+    }
+    return result;
+}
+
+// expected arguments in order:
+// - Object display
+// - Object { populateSealed?: boolean, hugePages?: boolean, sequential?: boolean }
+napi_value
+setShmMapOptions(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    uint32_t options = 0;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+
+    if (get_named_bool(env, argv[1], "populateSealed")) {
+        options |= WL_SHM_MAP_POPULATE_SEALED;
+    }
+    if (get_named_bool(env, argv[1], "hugePages")) {
+        options |= WL_SHM_MAP_HUGEPAGE;
+    }
+    if (get_named_bool(env, argv[1], "sequential")) {
+        options |= WL_SHM_MAP_SEQUENTIAL;
+    }
+    wl_display_set_shm_map_options(display, options);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object client
+// - number bufferId
+// - Int32Array of [x, y, width, height] tuples that are about to be read
+// return:
+// - boolean true if the pages were faulted in
+napi_value
+prefaultShmBuffer(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value;
+    struct wl_client *client;
+    struct wl_shm_buffer *shm_buffer;
+    uint32_t buffer_id;
+    int32_t *damage;
+    size_t damage_length;
+    bool result = false;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &buffer_id))
+    NAPI_CALL(env, napi_get_typedarray_info(env, argv[2], NULL, &damage_length, (void **) &damage, NULL, NULL))
+
+    shm_buffer = get_shm_buffer(client, buffer_id);
+    if (shm_buffer) {
+        result = wl_shm_buffer_prefault(shm_buffer, damage, (int32_t) (damage_length / 4)) == 0;
+    }
+
+    NAPI_CALL(env, napi_get_boolean(env, result, &return_value))
+    return return_value;
+}
+
+// return:
+// - { minorFaults, majorFaults } taken by the calling thread so far. Sample before and after reading back a frame to
+//   get its fault count.
+napi_value
+getFaultCounts(napi_env env, napi_callback_info info) {
+    napi_value return_value;
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_THREAD, &usage)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "minorFaults", (double) usage.ru_minflt);
+    set_named_double(env, return_value, "majorFaults", (double) usage.ru_majflt);
+    return return_value;
+}
+
+static napi_value
+create_object_cache_stats(napi_env env, uint32_t kind) {
+    napi_value stats;
+    uint64_t allocated, reused;
+    uint32_t cached;
+
+    wl_object_cache_get_stats(kind, &allocated, &reused, &cached);
+
+    NAPI_CALL(env, napi_create_object(env, &stats))
+    set_named_double(env, stats, "allocated", (double) allocated);
+    set_named_double(env, stats, "reused", (double) reused);
+    set_named_double(env, stats, "cached", cached);
+    return stats;
+}
+
+// return:
+// - { resources, closures }, each { allocated, reused, cached }, for the object caches of the calling thread, which are
+//   the ones used by the displays this thread dispatches.
+napi_value
+getObjectCacheStats(napi_env env, napi_callback_info info) {
+    napi_value return_value;
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "resources",
+                                           create_object_cache_stats(env, WL_OBJECT_CACHE_RESOURCE)))
+    NAPI_CALL(env, napi_set_named_property(env, return_value, "closures",
+                                           create_object_cache_stats(env, WL_OBJECT_CACHE_CLOSURE)))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object client
+// return:
+// - { shmMappedBytes, shmStaleBytes, shmQuota, connectionBytes, connectionBufferedBytes, objectMapBytes }
+napi_value
+getClientMemoryStats(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct wl_client *client;
+    struct wl_connection *connection;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+
+    connection = wl_client_get_connection(client);
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "shmMappedBytes", (double) wl_client_get_shm_mapped_bytes(client));
+    set_named_double(env, return_value, "shmStaleBytes", (double) wl_client_get_shm_stale_bytes(client));
+    set_named_double(env, return_value, "shmQuota", (double) wl_client_get_shm_quota(client));
+    set_named_double(env, return_value, "connectionBytes", (double) wl_connection_get_allocated_size(connection));
+    set_named_double(env, return_value, "connectionBufferedBytes",
+                     (double) wl_connection_get_buffered_size(connection));
+    set_named_double(env, return_value, "objectMapBytes", (double) wl_client_get_object_map_size(client));
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object client
+// - number maximum bytes of mapped and stale shm pool memory, 0 for unlimited
+napi_value
+setClientShmQuota(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_client *client;
+    int64_t quota;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &quota))
+
+    wl_client_set_shm_quota(client, quota < 0 ? 0 : (uint64_t) quota);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object display
+// - number quota given to clients that connect from now on, 0 for unlimited
+napi_value
+setDefaultShmQuota(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    int64_t quota;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &quota))
+
+    wl_display_set_default_shm_quota(display, quota < 0 ? 0 : (uint64_t) quota);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+static void
+release_transfer_callbacks(struct westfield_transfer_callbacks *transfer_callbacks) {
+    napi_env env = transfer_callbacks->env;
+
+    transfer_callbacks->transfer = NULL;
+    NAPI_CALL(env, napi_delete_reference(env, transfer_callbacks->progress_cb_ref))
+    NAPI_CALL(env, napi_delete_reference(env, transfer_callbacks->done_cb_ref))
+    if (transfer_callbacks->finalized) {
+        free(transfer_callbacks);
+    }
+}
+
+static void
+finalize_transfer_cb(napi_env env, void *finalize_data, void *finalize_hint) {
+    struct westfield_transfer_callbacks *transfer_callbacks = finalize_data;
+
+    // a running transfer keeps going without its handle, it can no longer be cancelled but still reports
+    if (transfer_callbacks->transfer) {
+        transfer_callbacks->finalized = true;
+    } else {
+        free(transfer_callbacks);
+    }
+}
+
+static void
+on_transfer_progress(void *user_data, uint64_t transferred) {
+    struct westfield_transfer_callbacks *transfer_callbacks = user_data;
+    napi_env env = transfer_callbacks->env;
+    napi_value cb, global, cb_result, transferred_value;
+    napi_handle_scope scope;
+
+    NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+    NAPI_CALL(env, napi_create_double(env, (double) transferred, &transferred_value))
+    NAPI_CALL(env, napi_get_reference_value(env, transfer_callbacks->progress_cb_ref, &cb))
+    NAPI_CALL(env, napi_get_global(env, &global))
+    NAPI_CALL(env, napi_call_function(env, global, cb, 1, &transferred_value, &cb_result))
+    NAPI_CALL(env, napi_close_handle_scope(env, scope))
+}
+
+static void
+on_transfer_done(void *user_data, enum westfield_transfer_status status, uint64_t transferred, int error) {
+    struct westfield_transfer_callbacks *transfer_callbacks = user_data;
+    napi_env env = transfer_callbacks->env;
+    napi_value cb, global, cb_result, status_value, transferred_value, error_value;
+    napi_handle_scope scope;
+
+    if (transfer_callbacks->display_listener->env_gone) {
+        // the display was destroyed along with the env, JS can no longer be told. The env already ran the
+        // finalizer of the handle if it had one, else the finalizer frees us once it runs.
+        transfer_callbacks->transfer = NULL;
+        if (transfer_callbacks->finalized) {
+            free(transfer_callbacks);
+        }
+        return;
+    }
+
+    NAPI_CALL(env, napi_open_handle_scope(env, &scope))
+    NAPI_CALL(env, napi_create_uint32(env, status, &status_value))
+    NAPI_CALL(env, napi_create_double(env, (double) transferred, &transferred_value))
+    NAPI_CALL(env, napi_create_int32(env, error, &error_value))
+    napi_value argv[3] = {status_value, transferred_value, error_value};
+
+    NAPI_CALL(env, napi_get_reference_value(env, transfer_callbacks->done_cb_ref, &cb))
+    NAPI_CALL(env, napi_get_global(env, &global))
+    // the transfer is destroyed after this returns, so it can't be cancelled from the callback
+    transfer_callbacks->transfer = NULL;
+    NAPI_CALL(env, napi_call_function(env, global, cb, 3, argv, &cb_result))
+    NAPI_CALL(env, napi_close_handle_scope(env, scope))
+
+    release_transfer_callbacks(transfer_callbacks);
+}
+
+/**
+ * Start a transfer and wrap it in a JS handle. Returns NULL, with both fds closed, if it could not be started.
+ */
+// Copies a mime type argument into mime_type, throwing instead of cutting off a mime type that does not fit.
+static bool
+get_mime_type(napi_env env, napi_value value, char *mime_type, size_t size) {
+    size_t length;
+
+    if (napi_get_value_string_utf8(env, value, NULL, 0, &length) != napi_ok) {
+        GET_AND_THROW_LAST_ERROR(env)
+        return false;
+    }
+    if (length >= size) {
+        napi_throw_range_error(env, NULL, "mime type too long");
+        return false;
+    }
+    NAPI_CALL(env, napi_get_value_string_utf8(env, value, mime_type, size, NULL))
+    return true;
+}
+
+static struct westfield_transfer *
+start_transfer(napi_env env, struct wl_display *display, int source_fd, int target_fd, int64_t progress_step,
+               napi_value progress_cb, napi_value done_cb, napi_value *handle_value) {
+    struct display_destruction_listener *display_destruction_listener = get_display_listener(display);
+    struct westfield_transfer_callbacks *transfer_callbacks;
+
+    // a display that is being destroyed no longer has a loop to run the transfer on
+    transfer_callbacks = NULL;
+    if (display_destruction_listener) {
+        transfer_callbacks = calloc(1, sizeof(struct westfield_transfer_callbacks));
+    }
+    if (transfer_callbacks == NULL) {
+        close(source_fd);
+        close(target_fd);
+        return NULL;
+    }
+    transfer_callbacks->env = env;
+    transfer_callbacks->display_listener = display_destruction_listener;
+    transfer_callbacks->transfer = westfield_transfer_create(wl_display_get_event_loop(display), source_fd, target_fd,
+                                                             progress_step < 0 ? 0 : progress_step, transfer_callbacks,
+                                                             on_transfer_progress, on_transfer_done);
+    if (transfer_callbacks->transfer == NULL) {
+        free(transfer_callbacks);
+        return NULL;
+    }
+
+    NAPI_CALL(env, napi_create_reference(env, progress_cb, 1, &transfer_callbacks->progress_cb_ref))
+    NAPI_CALL(env, napi_create_reference(env, done_cb, 1, &transfer_callbacks->done_cb_ref))
+    NAPI_CALL(env, napi_create_external(env, transfer_callbacks, finalize_transfer_cb, NULL, handle_value))
+    return transfer_callbacks->transfer;
+}
+
+// expected arguments in order:
+// - Object display
+// - number sourceFd, owned by the transfer from now on
+// - number targetFd, owned by the transfer from now on
+// - number progressStep, bytes between progress callbacks or 0 for none
+// - onProgress(number transferred):void
+// - onDone(number status, number transferred, number errno):void
+// return:
+// - Object transfer or undefined if the transfer could not be started
+napi_value
+startTransfer(napi_env env, napi_callback_info info) {
+    size_t argc = 6;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    int32_t source_fd, target_fd;
+    int64_t progress_step;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+    NAPI_CALL(env, napi_get_value_int32(env, argv[1], &source_fd))
+    NAPI_CALL(env, napi_get_value_int32(env, argv[2], &target_fd))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[3], &progress_step))
+
+    if (start_transfer(env, display, source_fd, target_fd, progress_step, argv[4], argv[5], &return_value) == NULL) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    }
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object transfer
+// return:
+// - boolean true if the transfer was still running
+napi_value
+cancelTransfer(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_transfer_callbacks *transfer_callbacks;
+    bool running;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &transfer_callbacks))
+
+    running = transfer_callbacks->transfer != NULL;
+    if (running) {
+        westfield_transfer_cancel(transfer_callbacks->transfer);
+        release_transfer_callbacks(transfer_callbacks);
+    }
+
+    NAPI_CALL(env, napi_get_boolean(env, running, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - number maxBytes, total size of the cached contents
+// return:
+// - Object clipboard cache or undefined if it could not be allocated
+napi_value
+createClipboardCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_clipboard_cache *cache;
+    int64_t max_bytes;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &max_bytes))
+
+    cache = westfield_clipboard_cache_create(max_bytes < 0 ? 0 : max_bytes);
+    if (cache) {
+        NAPI_CALL(env, napi_create_external(env, cache, NULL, NULL, &return_value))
+    } else {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    }
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object clipboard cache
+napi_value
+invalidateClipboardCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_clipboard_cache *cache;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_clipboard_cache_invalidate(cache);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// expected arguments in order:
+// - Object clipboard cache
+// - Object display
+// - string mimeType, at most 255 bytes of UTF-8
+// - number targetFd, owned by the transfer if one is started
+// - number progressStep
+// - onProgress(number transferred):void
+// - onDone(number status, number transferred, number errno):void
+// return:
+// - Object transfer from the cached contents, or undefined if mimeType is not cached or the transfer could not be
+//   started. targetFd is left untouched when undefined is returned, so the caller can fall back to the source.
+napi_value
+clipboardCacheReceive(napi_env env, napi_callback_info info) {
+    size_t argc = 7;
+    napi_value argv[argc], return_value;
+    struct westfield_clipboard_cache *cache;
+    struct wl_display *display;
+    char mime_type[256];
+    int32_t source_fd, target_fd, transfer_target_fd;
+    int64_t progress_step;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &display))
+    if (!get_mime_type(env, argv[2], mime_type, sizeof(mime_type))) {
+        return NULL;
+    }
+    NAPI_CALL(env, napi_get_value_int32(env, argv[3], &target_fd))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[4], &progress_step))
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+
+    source_fd = westfield_clipboard_cache_open(cache, mime_type);
+    if (source_fd < 0) {
+        return return_value;
+    }
+
+    // the transfer gets a duplicate, so a transfer that fails to start does not close targetFd under the caller
+    transfer_target_fd = fcntl(target_fd, F_DUPFD_CLOEXEC, 0);
+    if (transfer_target_fd < 0) {
+        close(source_fd);
+        return return_value;
+    }
+    if (start_transfer(env, display, source_fd, transfer_target_fd, progress_step, argv[5], argv[6],
+                       &return_value)) {
+        close(target_fd);
+    }
+    return return_value;
+}
+
+// Like startTransfer, but also stores the transferred contents in the clipboard cache for later receives of mimeType.
+// expected arguments in order:
+// - Object clipboard cache
+// - Object display
+// - string mimeType, at most 255 bytes of UTF-8
+// - number sourceFd, owned by the transfer from now on
+// - number targetFd, owned by the transfer from now on
+// - number progressStep
+// - onProgress(number transferred):void
+// - onDone(number status, number transferred, number errno):void
+// return:
+// - Object transfer or undefined if the transfer could not be started
+napi_value
+clipboardCacheStartTransfer(napi_env env, napi_callback_info info) {
+    size_t argc = 8;
+    napi_value argv[argc], return_value;
+    struct westfield_clipboard_cache *cache;
+    struct westfield_transfer *transfer;
+    struct wl_display *display;
+    char mime_type[256];
+    int32_t source_fd, target_fd;
+    int64_t progress_step;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &display))
+    if (!get_mime_type(env, argv[2], mime_type, sizeof(mime_type))) {
+        return NULL;
+    }
+    NAPI_CALL(env, napi_get_value_int32(env, argv[3], &source_fd))
+    NAPI_CALL(env, napi_get_value_int32(env, argv[4], &target_fd))
+    NAPI_CALL(env, napi_get_value_int64(env, argv[5], &progress_step))
+
+    transfer = start_transfer(env, display, source_fd, target_fd, progress_step, argv[6], argv[7], &return_value);
+    if (transfer == NULL) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+    westfield_clipboard_cache_tap(cache, mime_type, transfer);
+
+    return return_value;
+}
+
+napi_value
+destroyClipboardCache(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_clipboard_cache *cache;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &cache))
+
+    westfield_clipboard_cache_destroy(cache);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// Make the display, created by this worker, join the process wide group of displays that share client connections.
+// The handle stays valid until the display is destroyed. Other workers refer to the shard by its id, see
+// getDisplayShardId.
+// expected arguments in order:
+// - Object display
+// return:
+// - DisplayShardHandle, or undefined on failure
+napi_value
+createDisplayShard(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct wl_display *display;
+    struct westfield_shard *shard;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &display))
+
+    shard = westfield_shard_create(display);
+    if (shard) {
+        NAPI_CALL(env, napi_create_external(env, shard, NULL, NULL, &return_value))
+    } else {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    }
+    return return_value;
+}
+
+// The id of the shard, unique within the process. Unlike the handle it can be posted to other workers.
+// expected arguments in order:
+// - DisplayShardHandle shard
+// return:
+// - number id
+napi_value
+getDisplayShardId(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    struct westfield_shard *shard;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &shard))
+
+    NAPI_CALL(env, napi_create_uint32(env, westfield_shard_get_id(shard), &return_value))
+    return return_value;
+}
+
+// The ids of all shards in the group, of every worker.
+// return:
+// - Uint32Array ids, or undefined on failure
+napi_value
+getDisplayShardIds(napi_env env, napi_callback_info info) {
+    napi_value ids_buffer, return_value;
+    struct wl_array ids;
+    void *ids_data;
+
+    wl_array_init(&ids);
+    if (!westfield_shard_get_ids(&ids)) {
+        wl_array_release(&ids);
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_arraybuffer(env, ids.size, &ids_data, &ids_buffer))
+    if (ids.size) {
+        memcpy(ids_data, ids.data, ids.size);
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint32_array, ids.size / sizeof(uint32_t), ids_buffer, 0,
+                                          &return_value))
+    wl_array_release(&ids);
+    return return_value;
+}
+
+// Hand every connection accepted on the sockets of the shard's display to the least loaded shard.
+// expected arguments in order:
+// - DisplayShardHandle shard
+// - boolean front
+// return:
+// - void
+napi_value
+setDisplayShardFront(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[argc], return_value;
+    struct westfield_shard *shard;
+    bool front;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &shard))
+    NAPI_CALL(env, napi_get_value_bool(env, argv[1], &front))
+
+    westfield_shard_set_front(shard, front);
+
+    NAPI_CALL(env, napi_get_undefined(env, &return_value))
+    return return_value;
+}
+
+// The load of any shard in the group, eg to pick the least loaded target for migrateClient.
+// expected arguments in order:
+// - number shardId
+// return:
+// - { clients, pending }, or undefined if the shard left the group
+napi_value
+getDisplayShardStats(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc], return_value;
+    uint32_t shard_id;
+    struct westfield_shard_stats stats;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &shard_id))
+
+    if (!westfield_shard_get_stats(shard_id, &stats)) {
+        NAPI_CALL(env, napi_get_undefined(env, &return_value))
+        return return_value;
+    }
+
+    NAPI_CALL(env, napi_create_object(env, &return_value))
+    set_named_double(env, return_value, "clients", stats.clients);
+    set_named_double(env, return_value, "pending", stats.pending);
+    return return_value;
+}
+
+// Move a running client to the display of another shard, of this or any other worker, see
+// westfield_shard_migrate_client. On success, onClientDestroyed is called with migrated true, and the client shows up
+// in the target worker's onClientCreated with migrated true.
+// expected arguments in order:
+// - DisplayShardHandle shard, of the display the client is on
+// - Object client
+// - number targetShardId
+// return:
+// - boolean, false if the client can not be moved (now)
+napi_value
+migrateClient(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[argc], return_value;
+    struct westfield_shard *shard;
+    struct wl_client *client;
+    struct client_destruction_listener *destruction_listener;
+    uint32_t target_id;
+    bool migrated;
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &shard))
+    NAPI_CALL(env, napi_get_value_external(env, argv[1], (void **) &client))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &target_id))
+
+    destruction_listener = get_client_listener(client);
+    destruction_listener->migrating = true;
+    migrated = westfield_shard_migrate_client(shard, client, target_id);
+    if (!migrated) {
+        destruction_listener->migrating = false;
+    }
+
+    NAPI_CALL(env, napi_get_boolean(env, migrated, &return_value))
+    return return_value;
+}
+
+struct client_objects {
+    napi_env env;
+    napi_value array;
+    uint32_t length;
+};
+
+static enum wl_iterator_result
+add_client_object(struct wl_resource *resource, void *data) {
+    struct client_objects *objects = data;
+    napi_env env = objects->env;
+    napi_value object, interface_value;
+
+    NAPI_CALL(env, napi_create_object(env, &object))
+    set_named_double(env, object, "id", wl_resource_get_id(resource));
+    set_named_double(env, object, "version", wl_resource_get_version(resource));
+    NAPI_CALL(env, napi_create_string_utf8(env, wl_resource_get_class(resource), NAPI_AUTO_LENGTH, &interface_value))
+    NAPI_CALL(env, napi_set_named_property(env, object, "interface", interface_value))
+    NAPI_CALL(env, napi_set_element(env, objects->array, objects->length++, object))
+    return WL_ITERATOR_CONTINUE;
+}
+
+// All objects the client has on the server side, eg to rebuild the proxy state of a client that migrated here.
+// expected arguments in order:
+// - Object client
+// return:
+// - Array<{ id, interface, version }>
+napi_value
+getClientObjects(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[argc];
+    struct wl_client *client;
+    struct client_objects objects = {.env = env};
+
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+    NAPI_CALL(env, napi_get_value_external(env, argv[0], (void **) &client))
+
+    NAPI_CALL(env, napi_create_array(env, &objects.array))
+    wl_client_for_each_resource(client, add_client_object, &objects);
+    return objects.array;
+}
+
+// Runs when the env goes away, eg when a worker thread exits, with displays JS didn't destroy itself.
+static void
+finalize_addon(napi_env env, void *finalize_data, void *finalize_hint) {
+    struct westfield_addon *addon = finalize_data;
+    struct display_destruction_listener *display_destruction_listener, *next;
+
+    wl_list_for_each_safe(display_destruction_listener, next, &addon->displays, link) {
+        display_destruction_listener->env_gone = true;
+        wl_display_terminate(display_destruction_listener->display);
+        wl_display_destroy_clients(display_destruction_listener->display);
+        wl_display_destroy(display_destruction_listener->display);
+    }
+    free(addon);
+}
+
+napi_value
+init(napi_env env, napi_value exports) {
+    napi_property_descriptor desc[] = {
+            // core
+            DECLARE_NAPI_METHOD("createDisplay", createDisplay),
+            DECLARE_NAPI_METHOD("destroyDisplay", destroyDisplay),
+            DECLARE_NAPI_METHOD("setLazyClients", setLazyClients),
+            DECLARE_NAPI_METHOD("addLazyGlobal", addLazyGlobal),
+            DECLARE_NAPI_METHOD("removeLazyGlobal", removeLazyGlobal),
+            DECLARE_NAPI_METHOD("addSocketAuto", addSocketAuto),
+            DECLARE_NAPI_METHOD("createDisplayShard", createDisplayShard),
+            DECLARE_NAPI_METHOD("getDisplayShardId", getDisplayShardId),
+            DECLARE_NAPI_METHOD("getDisplayShardIds", getDisplayShardIds),
+            DECLARE_NAPI_METHOD("setDisplayShardFront", setDisplayShardFront),
+            DECLARE_NAPI_METHOD("getDisplayShardStats", getDisplayShardStats),
+            DECLARE_NAPI_METHOD("migrateClient", migrateClient),
+            DECLARE_NAPI_METHOD("getClientObjects", getClientObjects),
+            DECLARE_NAPI_METHOD("getFd", getFd),
+            DECLARE_NAPI_METHOD("destroyClient", destroyClient),
+            DECLARE_NAPI_METHOD("sendEvents", sendEvents),
+            DECLARE_NAPI_METHOD("dispatchRequests", dispatchRequests),
+            DECLARE_NAPI_METHOD("flush", flush),
+            DECLARE_NAPI_METHOD("createMemoryMappedFile", createMemoryMappedFile),
+            DECLARE_NAPI_METHOD("createMemoryMappedFileAsync", createMemoryMappedFileAsync),
+            DECLARE_NAPI_METHOD("initShm", initShm),
+            DECLARE_NAPI_METHOD("setShmDirtyTracking", setShmDirtyTracking),
+            DECLARE_NAPI_METHOD("collectShmDamage", collectShmDamage),
+            DECLARE_NAPI_METHOD("setShmMapOptions", setShmMapOptions),
+            DECLARE_NAPI_METHOD("prefaultShmBuffer", prefaultShmBuffer),
+            DECLARE_NAPI_METHOD("getFaultCounts", getFaultCounts),
+            DECLARE_NAPI_METHOD("getClientMemoryStats", getClientMemoryStats),
+            DECLARE_NAPI_METHOD("getObjectCacheStats", getObjectCacheStats),
+            DECLARE_NAPI_METHOD("setClientShmQuota", setClientShmQuota),
+            DECLARE_NAPI_METHOD("setDefaultShmQuota", setDefaultShmQuota),
+            DECLARE_NAPI_METHOD("initDrm", initDrm),
+            DECLARE_NAPI_METHOD("initDrmAsync", initDrmAsync),
+            DECLARE_NAPI_METHOD("setWireMessageCallback", setWireMessageCallback),
+            DECLARE_NAPI_METHOD("setWireMessageEndCallback", setWireMessageEndCallback),
+            DECLARE_NAPI_METHOD("setClientDestroyedCallback", setClientDestroyedCallback),
+            DECLARE_NAPI_METHOD("setRegistryCreatedCallback", setRegistryCreatedCallback),
+            DECLARE_NAPI_METHOD("setSyncDoneCallback", setSyncDoneCallback),
+            DECLARE_NAPI_METHOD("emitGlobals", emitGlobals),
+            DECLARE_NAPI_METHOD("createWlMessage", createWlMessage),
+            DECLARE_NAPI_METHOD("initWlInterface", initWlInterface),
+            DECLARE_NAPI_METHOD("createWlInterface", createWlInterface),
+            DECLARE_NAPI_METHOD("createWlResource", createWlResource),
+            DECLARE_NAPI_METHOD("destroyWlResourceSilently", destroyWlResourceSilently),
+            DECLARE_NAPI_METHOD("setBufferCreatedCallback", setBufferCreatedCallback),
+            DECLARE_NAPI_METHOD("getServerObjectIdsBatch", getServerObjectIdsBatch),
+            DECLARE_NAPI_METHOD("createServerObjectIdPool", createServerObjectIdPool),
+            DECLARE_NAPI_METHOD("releaseServerObjectIds", releaseServerObjectIds),
+            DECLARE_NAPI_METHOD("makePipe", makePipe),
+            DECLARE_NAPI_METHOD("startTransfer", startTransfer),
+            DECLARE_NAPI_METHOD("cancelTransfer", cancelTransfer),
+            DECLARE_NAPI_METHOD("createClipboardCache", createClipboardCache),
+            DECLARE_NAPI_METHOD("invalidateClipboardCache", invalidateClipboardCache),
+            DECLARE_NAPI_METHOD("clipboardCacheReceive", clipboardCacheReceive),
+            DECLARE_NAPI_METHOD("clipboardCacheStartTransfer", clipboardCacheStartTransfer),
+            DECLARE_NAPI_METHOD("destroyClipboardCache", destroyClipboardCache),
+            DECLARE_NAPI_METHOD("equalValueExternal", equalValueExternal),
+            DECLARE_NAPI_METHOD("getCredentials", getCredentials),
+
+            // xwayland
+            DECLARE_NAPI_METHOD("setupXWayland", setupXWayland),
+            DECLARE_NAPI_METHOD("setupXWaylandAsync", setupXWaylandAsync),
+            DECLARE_NAPI_METHOD("teardownXWayland", teardownXWayland),
+            DECLARE_NAPI_METHOD("getXWaylandDisplay", getXWaylandDisplay),
+
+            // encoding
+            DECLARE_NAPI_METHOD("createEncoder", createEncoder),
+            DECLARE_NAPI_METHOD("encodeShmBuffer", encodeShmBuffer),
+            DECLARE_NAPI_METHOD("requestEncoderKeyframe", requestEncoderKeyframe),
+            DECLARE_NAPI_METHOD("setEncoderBitrate", setEncoderBitrate),
+            DECLARE_NAPI_METHOD("destroyEncoder", destroyEncoder),
+            DECLARE_NAPI_METHOD("createScrollDetector", createScrollDetector),
+            DECLARE_NAPI_METHOD("detectScroll", detectScroll),
+            DECLARE_NAPI_METHOD("destroyScrollDetector", destroyScrollDetector),
+            DECLARE_NAPI_METHOD("createTileClassifier", createTileClassifier),
+            DECLARE_NAPI_METHOD("classifyTiles", classifyTiles),
+            DECLARE_NAPI_METHOD("reportEncodedTile", reportEncodedTile),
+            DECLARE_NAPI_METHOD("getTileClassifierStats", getTileClassifierStats),
+            DECLARE_NAPI_METHOD("destroyTileClassifier", destroyTileClassifier),
+            DECLARE_NAPI_METHOD("createPixelCache", createPixelCache),
+            DECLARE_NAPI_METHOD("pixelCacheLookupBuffer", pixelCacheLookupBuffer),
+            DECLARE_NAPI_METHOD("pixelCacheLookupTiles", pixelCacheLookupTiles),
+            DECLARE_NAPI_METHOD("pixelCacheRemove", pixelCacheRemove),
+            DECLARE_NAPI_METHOD("pixelCacheTakeEvicted", pixelCacheTakeEvicted),
+            DECLARE_NAPI_METHOD("setPixelCacheMaxBytes", setPixelCacheMaxBytes),
+            DECLARE_NAPI_METHOD("getPixelCacheStats", getPixelCacheStats),
+            DECLARE_NAPI_METHOD("destroyPixelCache", destroyPixelCache),
+            DECLARE_NAPI_METHOD("createCursorCache", createCursorCache),
+            DECLARE_NAPI_METHOD("updateCursorImage", updateCursorImage),
+            DECLARE_NAPI_METHOD("destroyCursorCache", destroyCursorCache),
+            DECLARE_NAPI_METHOD("downscaleShmBuffer", downscaleShmBuffer),
+            DECLARE_NAPI_METHOD("createQualityController", createQualityController),
+            DECLARE_NAPI_METHOD("qualityReportSent", qualityReportSent),
+            DECLARE_NAPI_METHOD("qualityReportAcked", qualityReportAcked),
+            DECLARE_NAPI_METHOD("getQualityDecision", getQualityDecision),
+            DECLARE_NAPI_METHOD("destroyQualityController", destroyQualityController),
+    };
+
+    NAPI_CALL(env, napi_define_properties(env, exports, sizeof(desc) / sizeof(napi_property_descriptor), desc))
+
+    struct westfield_addon *addon = calloc(1, sizeof(*addon));
+    if (addon == NULL) {
+        napi_throw_error(env, NULL, "out of memory");
+        return NULL;
+    }
+    wl_list_init(&addon->displays);
+    NAPI_CALL(env, napi_set_instance_data(env, addon, finalize_addon, NULL))
 
     return exports;
 }
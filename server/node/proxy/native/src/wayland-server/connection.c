@@ -557,6 +557,7 @@ wl_closure_init(const struct wl_message *message, uint32_t size,
                 int *num_arrays, union wl_argument *args)
 {
 	struct wl_closure *closure;
+	size_t closure_size;
 	int count;
 
 	count = arg_count_for_signature(message->signature);
@@ -568,17 +569,25 @@ wl_closure_init(const struct wl_message *message, uint32_t size,
 
 	if (size) {
 		*num_arrays = wl_message_count_arrays(message);
-		closure = malloc(sizeof *closure + size +
-				 *num_arrays * sizeof(struct wl_array));
+		closure_size = sizeof *closure + size +
+			       *num_arrays * sizeof(struct wl_array);
 	} else {
-		closure = malloc(sizeof *closure);
+		closure_size = sizeof *closure;
 	}
 
+	if (closure_size <= WL_CLOSURE_CACHED_SIZE)
+		closure = wl_object_cache_alloc(WL_OBJECT_CACHE_CLOSURE,
+						WL_CLOSURE_CACHED_SIZE);
+	else
+		closure = malloc(closure_size);
+
 	if (!closure) {
 		errno = ENOMEM;
 		return NULL;
 	}
 
+	closure->cached = closure_size <= WL_CLOSURE_CACHED_SIZE;
+
 	if (args)
 		memcpy(closure->args, args, count * sizeof *args);
 
@@ -1234,6 +1243,59 @@ wl_closure_send(struct wl_closure *closure, struct wl_connection *connection)
 	return result;
 }
 
+/* Write a message made of fixed size arguments only (u, i, f, o and n)
+ * straight into the out buffer, without building a closure first. Returns 1,
+ * without writing anything, if the message has other arguments or a
+ * non-nullable object is NULL, so the caller can take the regular path. */
+int
+wl_connection_write_fixed(struct wl_connection *connection,
+			  uint32_t sender_id, uint32_t opcode,
+			  const struct wl_message *message,
+			  union wl_argument *args, bool queue)
+{
+	uint32_t buffer[2 + WL_CLOSURE_MAX_ARGS];
+	uint32_t *p = buffer + 2;
+	const char *signature = message->signature;
+	struct argument_details arg;
+	int i, count, size;
+
+	count = arg_count_for_signature(signature);
+	if (count > WL_CLOSURE_MAX_ARGS)
+		return 1;
+
+	for (i = 0; i < count; i++) {
+		signature = get_next_argument(signature, &arg);
+
+		switch (arg.type) {
+		case 'u':
+			*p++ = args[i].u;
+			break;
+		case 'i':
+			*p++ = args[i].i;
+			break;
+		case 'f':
+			*p++ = args[i].f;
+			break;
+		case 'o':
+		case 'n':
+			if (!arg.nullable && args[i].o == NULL)
+				return 1;
+			*p++ = args[i].o ? args[i].o->id : 0;
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	size = (p - buffer) * sizeof *p;
+	buffer[0] = sender_id;
+	buffer[1] = size << 16 | (opcode & 0x0000ffff);
+
+	if (queue)
+		return wl_connection_queue(connection, buffer, size);
+	return wl_connection_write(connection, buffer, size);
+}
+
 int
 wl_closure_queue(struct wl_closure *closure, struct wl_connection *connection)
 {
@@ -1373,7 +1435,10 @@ wl_closure_destroy(struct wl_closure *closure)
 		return;
 
 	wl_closure_close_fds(closure);
-	free(closure);
+	if (closure->cached)
+		wl_object_cache_free(WL_OBJECT_CACHE_CLOSURE, closure);
+	else
+		free(closure);
 }
 
 WL_EXPORT size_t
@@ -1390,3 +1455,17 @@ wl_connection_copy_fds_in(struct wl_connection *connection, int *fds_in, size_t
 	ring_buffer_copy(&connection->fds_in, fds_in, size);
 	connection->fds_in.tail += size;
 }
+
+WL_EXPORT size_t
+wl_connection_get_allocated_size(struct wl_connection *connection)
+{
+	/* The ring buffers are fixed size and part of the connection. */
+	return sizeof *connection;
+}
+
+WL_EXPORT size_t
+wl_connection_get_buffered_size(struct wl_connection *connection)
+{
+	return ring_buffer_size(&connection->in) +
+	       ring_buffer_size(&connection->out);
+}
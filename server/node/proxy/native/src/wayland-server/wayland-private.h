@@ -66,9 +66,22 @@ enum wl_map_entry_flags {
 	WL_MAP_ENTRY_ZOMBIE = (1 << 0) /* Client side only */
 };
 
+#ifdef WL_MAP_PAGED
+/* Entries in fixed size pages, growing never reallocates (and copies) the
+ * entries already there, and no more than a page is allocated ahead */
+struct wl_map_entries {
+	struct wl_array pages;
+	uint32_t count;
+};
+#else
+struct wl_map_entries {
+	struct wl_array array;
+};
+#endif
+
 struct wl_map {
-	struct wl_array client_entries;
-	struct wl_array server_entries;
+	struct wl_map_entries client_entries;
+	struct wl_map_entries server_entries;
 	uint32_t side;
 	uint32_t free_list;
 };
@@ -95,6 +108,12 @@ wl_map_reserve_new(struct wl_map *map, uint32_t i);
 void
 wl_map_remove(struct wl_map *map, uint32_t i);
 
+int
+wl_map_release_reserved(struct wl_map *map, uint32_t i);
+
+size_t
+wl_map_get_allocated_size(struct wl_map *map);
+
 void *
 wl_map_lookup(struct wl_map *map, uint32_t i);
 
@@ -136,6 +155,12 @@ wl_connection_queue(struct wl_connection *connection,
 int
 wl_connection_get_fd(struct wl_connection *connection);
 
+int
+wl_connection_write_fixed(struct wl_connection *connection,
+			  uint32_t sender_id, uint32_t opcode,
+			  const struct wl_message *message,
+			  union wl_argument *args, bool queue);
+
 struct wl_closure {
 	int count;
 	const struct wl_message *message;
@@ -144,6 +169,8 @@ struct wl_closure {
 	union wl_argument args[WL_CLOSURE_MAX_ARGS];
 	struct wl_list link;
 	struct wl_proxy *proxy;
+	/* allocated from the closure object cache */
+	bool cached;
 	struct wl_array extra[0];
 };
 
@@ -227,6 +254,14 @@ struct wl_display;
 struct wl_array *
 wl_display_get_additional_shm_formats(struct wl_display *display);
 
+struct wl_client;
+
+void
+wl_client_account_shm(struct wl_client *client, int64_t mapped, int64_t stale);
+
+bool
+wl_client_shm_quota_allows(struct wl_client *client, uint64_t size);
+
 static inline void *
 zalloc(size_t s)
 {
@@ -236,4 +271,21 @@ zalloc(size_t s)
 void
 wl_connection_close_fds_in(struct wl_connection *connection, int max);
 
+/* Per thread caches of freed objects, so steady state dispatch doesn't go
+ * through malloc. All blocks of a kind have the same size. Blocks freed on
+ * another thread than they were allocated on simply move to that thread's
+ * cache. The kinds are also defined in westfield-wayland-server-extra.h. */
+#define WL_OBJECT_CACHE_RESOURCE 0
+#define WL_OBJECT_CACHE_CLOSURE 1
+#define WL_OBJECT_CACHE_KINDS 2
+
+void *
+wl_object_cache_alloc(uint32_t kind, size_t size);
+
+void
+wl_object_cache_free(uint32_t kind, void *block);
+
+/* Closures up to this size, including their arguments, come from the cache */
+#define WL_CLOSURE_CACHED_SIZE (sizeof(struct wl_closure) + 512)
+
 #endif
@@ -89,6 +89,16 @@ struct wl_client {
 	wl_connection_wire_message_end_t wire_message_end_cb;
 	wl_registry_created_t registry_created_cb;
     wl_sync_done_t sync_done_cb;
+	/* Bytes of shm pool mappings owned by this client, see wayland-shm.c */
+	uint64_t shm_mapped_bytes;
+	uint64_t shm_stale_bytes;
+	/* 0 means unlimited */
+	uint64_t shm_quota;
+	void *user_data;
+	/* wl_display.sync requests whose done event is still queued on the event loop */
+	int pending_syncs;
+	/* moved here from another display with wl_client_detach and wl_client_attach */
+	bool migrated;
 };
 
 struct wl_display {
@@ -117,6 +127,12 @@ struct wl_display {
 
 	wl_global_cb_t global_created_cb;
 	wl_global_cb_t global_destroyed_cb;
+	int shm_dirty_tracking;
+	uint32_t shm_map_options;
+	uint64_t default_shm_quota;
+	void *user_data;
+	wl_display_client_fd_handoff_t client_fd_handoff;
+	void *client_fd_handoff_data;
 };
 
 struct wl_global {
@@ -219,6 +235,7 @@ handle_array(struct wl_resource *resource, uint32_t opcode,
 {
 	struct wl_closure *closure;
 	struct wl_object *object = &resource->object;
+	int result;
 
 	if (resource->client->error)
 		return;
@@ -228,6 +245,21 @@ handle_array(struct wl_resource *resource, uint32_t opcode,
 		return;
 	}
 
+	/* most events only carry numbers and objects, those don't need a
+	 * closure unless it's logged */
+	if (!debug_server &&
+	    wl_list_empty(&resource->client->display->protocol_loggers)) {
+		result = wl_connection_write_fixed(resource->client->connection,
+						   object->id, opcode,
+						   &object->interface->events[opcode],
+						   args,
+						   send_func == wl_closure_queue);
+		if (result < 0)
+			resource->client->error = 1;
+		if (result <= 0)
+			return;
+	}
+
 	closure = wl_closure_marshal(object, opcode, args,
 				     &object->interface->events[opcode]);
 
@@ -379,7 +411,8 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		}
 	}
 
-	while (len >= 0 && (size_t) len >= sizeof p) {
+	/* the display is gone if the client was detached from a callback */
+	while (client->display && len >= 0 && (size_t) len >= sizeof p) {
 		wl_connection_copy(connection, p, sizeof p);
 		opcode = p[1] & 0xffff;
 		size = p[1] >> 16;
@@ -398,6 +431,9 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 				len = wl_connection_pending_input(connection);
 				continue;
 			}
+			/* leave the message to the display the client moves to */
+			if (client->display == NULL)
+				break;
 		}
 
 		if (resource == NULL) {
@@ -549,6 +585,7 @@ wl_client_create(struct wl_display *display, int fd)
 
 	wl_priv_signal_init(&client->resource_created_signal);
 	client->display = display;
+	client->shm_quota = display->default_shm_quota;
 	client->source = wl_event_loop_add_fd(display->loop, fd,
 					      WL_EVENT_READABLE,
 					      wl_client_connection_data, client);
@@ -740,7 +777,10 @@ destroy_resource(void *element, void *data, uint32_t flags)
 {
 	struct wl_resource *resource = element;
 
-	wl_signal_emit(&resource->deprecated_destroy_signal, resource);
+	/* most resources have no listeners, which matters when a client
+	 * with many objects goes away */
+	if (!wl_list_empty(&resource->deprecated_destroy_signal.listener_list))
+		wl_signal_emit(&resource->deprecated_destroy_signal, resource);
 	/* Don't emit the new signal for deprecated resources, as that would
 	 * access memory outside the bounds of the deprecated struct */
 	if (!resource_is_deprecated(resource))
@@ -750,7 +790,7 @@ destroy_resource(void *element, void *data, uint32_t flags)
 		resource->destroy(resource);
 
 	if (!(flags & WL_MAP_ENTRY_LEGACY))
-		free(resource);
+		wl_object_cache_free(WL_OBJECT_CACHE_RESOURCE, resource);
 
 	return WL_ITERATOR_CONTINUE;
 }
@@ -906,9 +946,16 @@ wl_client_destroy(struct wl_client *client)
 	wl_priv_signal_final_emit(&client->destroy_signal, client);
 
 	wl_client_flush(client);
+	/* The connection is closed right after, don't serialize the events
+	 * the destructors of its resources may still post. The resources are
+	 * destroyed in a single pass over the map, without taking their ids
+	 * out one by one, as the map is released as a whole. */
+	client->error = 1;
 	wl_map_for_each(&client->objects, destroy_resource, &serial);
 	wl_map_release(&client->objects);
-	wl_event_source_remove(client->source);
+	/* a detached client has no display to be dispatched by */
+	if (client->source)
+		wl_event_source_remove(client->source);
 	close(wl_connection_destroy(client->connection));
 	wl_list_remove(&client->link);
 	wl_list_remove(&client->resource_created_signal.listener_list);
@@ -982,9 +1029,11 @@ struct callback_done_args {
 void
 on_callback_done(void *data) {
     struct callback_done_args *callback_done_args = data;
+    callback_done_args->client->pending_syncs--;
     if (callback_done_args->client->sync_done_cb) {
         callback_done_args->client->sync_done_cb(callback_done_args->client, callback_done_args->callback_id);
     }
+    free(callback_done_args);
 }
 
 static void
@@ -1003,6 +1052,7 @@ display_sync(struct wl_client *client,
     struct callback_done_args *callback_done_args = calloc(1, sizeof(*callback_done_args));
     callback_done_args->callback_id = id;
     callback_done_args->client = client;
+    client->pending_syncs++;
     wl_event_loop_add_idle(wl_event_loop, on_callback_done, callback_done_args);
 }
 
@@ -1142,9 +1192,18 @@ wl_display_create(void)
 
 	display->global_filter = NULL;
 	display->global_filter_data = NULL;
+	display->global_created_cb = NULL;
+	display->global_destroyed_cb = NULL;
+	display->user_data = NULL;
 
 	wl_array_init(&display->additional_shm_formats);
 
+	display->shm_dirty_tracking = 0;
+	display->shm_map_options = 0;
+	display->default_shm_quota = 0;
+	display->client_fd_handoff = NULL;
+	display->client_fd_handoff_data = NULL;
+
 	return display;
 
 err_term_source:
@@ -1529,6 +1588,10 @@ socket_data(int fd, uint32_t mask, void *data)
 					 &length);
 	if (client_fd < 0)
 		wl_log("failed to accept: %s\n", strerror(errno));
+	else if (display->client_fd_handoff &&
+		 display->client_fd_handoff(display, client_fd,
+					    display->client_fd_handoff_data))
+		return 1;
 	else
 		if (!wl_client_create(display, client_fd))
 			close(client_fd);
@@ -1873,7 +1936,7 @@ wl_resource_create(struct wl_client *client,
 {
 	struct wl_resource *resource;
 
-	resource = malloc(sizeof *resource);
+	resource = wl_object_cache_alloc(WL_OBJECT_CACHE_RESOURCE, sizeof *resource);
 	if (resource == NULL)
 		return NULL;
 /*
@@ -1898,7 +1961,7 @@ wl_resource_create(struct wl_client *client,
 		wl_resource_post_error(client->display_resource,
 				       WL_DISPLAY_ERROR_INVALID_OBJECT,
 				       "invalid new id %d", id);
-		free(resource);
+		wl_object_cache_free(WL_OBJECT_CACHE_RESOURCE, resource);
 		return NULL;
 	}
 
@@ -2463,6 +2526,209 @@ wl_resource_destroy_silently(struct wl_resource *resource)
 	flags = wl_map_lookup_flags(&client->objects, id);
 	destroy_resource(resource, NULL, flags);
 
-	// browser compositor server side resources ids are recycled in the browser compositor, hence we don't make the ids available, and just NULL the resource
+	// browser compositor server side resources ids are recycled in the browser compositor, hence we don't make the ids available, and just NULL the resource.
+	// The id is only reused once the browser compositor confirmed it's done with it, see wl_client_release_server_object_ids
 	wl_map_insert_at(&client->objects, 0, id, NULL);
 }
+
+WL_EXPORT uint32_t
+wl_client_release_server_object_ids(struct wl_client *client, const uint32_t *ids, uint32_t amount)
+{
+	uint32_t released = 0;
+
+	for (uint32_t i = 0; i < amount; ++i) {
+		if (wl_map_release_reserved(&client->objects, ids[i]) == 0)
+			released++;
+	}
+
+	return released;
+}
+
+WL_EXPORT size_t
+wl_client_get_object_map_size(struct wl_client *client)
+{
+	return wl_map_get_allocated_size(&client->objects);
+}
+
+WL_EXPORT void
+wl_display_set_shm_dirty_tracking(struct wl_display *display, int enabled)
+{
+	display->shm_dirty_tracking = enabled;
+}
+
+WL_EXPORT int
+wl_display_get_shm_dirty_tracking(struct wl_display *display)
+{
+	return display->shm_dirty_tracking;
+}
+
+WL_EXPORT void
+wl_display_set_shm_map_options(struct wl_display *display, uint32_t options)
+{
+	display->shm_map_options = options;
+}
+
+WL_EXPORT uint32_t
+wl_display_get_shm_map_options(struct wl_display *display)
+{
+	return display->shm_map_options;
+}
+
+void
+wl_client_account_shm(struct wl_client *client, int64_t mapped, int64_t stale)
+{
+	client->shm_mapped_bytes += mapped;
+	client->shm_stale_bytes += stale;
+}
+
+bool
+wl_client_shm_quota_allows(struct wl_client *client, uint64_t size)
+{
+	return client->shm_quota == 0 ||
+	       client->shm_mapped_bytes + client->shm_stale_bytes + size <= client->shm_quota;
+}
+
+WL_EXPORT uint64_t
+wl_client_get_shm_mapped_bytes(struct wl_client *client)
+{
+	return client->shm_mapped_bytes;
+}
+
+WL_EXPORT uint64_t
+wl_client_get_shm_stale_bytes(struct wl_client *client)
+{
+	return client->shm_stale_bytes;
+}
+
+WL_EXPORT void
+wl_client_set_shm_quota(struct wl_client *client, uint64_t quota)
+{
+	client->shm_quota = quota;
+}
+
+WL_EXPORT uint64_t
+wl_client_get_shm_quota(struct wl_client *client)
+{
+	return client->shm_quota;
+}
+
+WL_EXPORT void
+wl_display_set_default_shm_quota(struct wl_display *display, uint64_t quota)
+{
+	display->default_shm_quota = quota;
+}
+
+WL_EXPORT void
+wl_client_set_user_data(struct wl_client *client, void *data)
+{
+	client->user_data = data;
+}
+
+WL_EXPORT void *
+wl_client_get_user_data(struct wl_client *client)
+{
+	return client->user_data;
+}
+
+WL_EXPORT void
+wl_display_set_user_data(struct wl_display *display, void *data)
+{
+	display->user_data = data;
+}
+
+WL_EXPORT void *
+wl_display_get_user_data(struct wl_display *display)
+{
+	return display->user_data;
+}
+
+WL_EXPORT void
+wl_display_set_client_fd_handoff(struct wl_display *display,
+				 wl_display_client_fd_handoff_t handoff,
+				 void *data)
+{
+	display->client_fd_handoff = handoff;
+	display->client_fd_handoff_data = data;
+}
+
+static enum wl_iterator_result
+move_registry(struct wl_resource *resource, void *data)
+{
+	struct wl_display *display = data;
+
+	if (resource->object.interface != &wl_registry_interface)
+		return WL_ITERATOR_CONTINUE;
+
+	wl_list_remove(&resource->link);
+	if (display) {
+		resource->data = display;
+		wl_list_insert(&display->registry_resource_list,
+			       &resource->link);
+	} else {
+		resource->data = NULL;
+		wl_list_init(&resource->link);
+	}
+
+	return WL_ITERATOR_CONTINUE;
+}
+
+WL_EXPORT int
+wl_client_detach(struct wl_client *client)
+{
+	if (client->pending_syncs > 0 || client->error) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* Everything that tracks the client on this display lets go of it,
+	 * the client itself, its objects and its connection stay as they are. */
+	wl_priv_signal_final_emit(&client->destroy_signal, client);
+	wl_priv_signal_init(&client->destroy_signal);
+	wl_priv_signal_init(&client->resource_created_signal);
+	client->wire_message_cb = NULL;
+	client->wire_message_end_cb = NULL;
+	client->registry_created_cb = NULL;
+	client->sync_done_cb = NULL;
+	client->user_data = NULL;
+
+	wl_client_for_each_resource(client, move_registry, NULL);
+	wl_event_source_remove(client->source);
+	client->source = NULL;
+	wl_list_remove(&client->link);
+	wl_list_init(&client->link);
+	client->display_resource->data = NULL;
+	client->display = NULL;
+
+	return 0;
+}
+
+WL_EXPORT int
+wl_client_attach(struct wl_client *client, struct wl_display *display)
+{
+	client->source = wl_event_loop_add_fd(display->loop,
+					      wl_connection_get_fd(client->connection),
+					      WL_EVENT_READABLE,
+					      wl_client_connection_data, client);
+	if (client->source == NULL)
+		return -1;
+
+	client->display = display;
+	client->display_resource->data = display;
+	client->migrated = true;
+	wl_client_for_each_resource(client, move_registry, display);
+	wl_list_insert(display->client_list.prev, &client->link);
+
+	wl_priv_signal_emit(&display->create_client_signal, client);
+
+	/* requests read before the client was detached are still buffered */
+	if (wl_connection_pending_input(client->connection) > 0)
+		wl_event_source_check(client->source);
+
+	return 0;
+}
+
+WL_EXPORT bool
+wl_client_is_migrated(struct wl_client *client)
+{
+	return client->migrated;
+}
@@ -48,6 +48,10 @@
 #include "wayland-util.h"
 #include "wayland-private.h"
 #include "wayland-server.h"
+#include "westfield-wayland-server-extra.h"
+
+/* Rows of a buffer are hashed in chunks of this many bytes for dirty tracking. */
+#define SHM_DIRTY_CHUNK_SIZE 4096
 
 /* This once_t is used to synchronize installing the SIGBUS handler
  * and creating the TLS key. This will be done in the first call
@@ -64,6 +68,9 @@ struct wl_shm_pool_mapping {
 
 struct wl_shm_pool {
 	struct wl_resource *resource;
+	/* The client the mappings are accounted to, NULL once all of its
+	 * resources that use the pool are gone. */
+	struct wl_client *client;
 	int internal_refcount;
 	int external_refcount;
 	char *data;
@@ -74,8 +81,12 @@ struct wl_shm_pool {
 	int mmap_flags;
 	int mmap_prot;
 	bool sigbus_is_impossible;
+	/* The fd is sealed against shrinking, see shm_pool_populate. */
+	bool sealed;
     /* list of struct wl_shm_pool_mapping */
     struct wl_list mappings;
+	/* total size of mappings */
+	ssize_t stale_size;
 };
 
 /** \class wl_shm_buffer
@@ -94,6 +105,8 @@ struct wl_shm_buffer {
 	uint32_t format;
 	int offset;
 	struct wl_shm_pool *pool;
+	/* Per row chunk content hashes, see wl_shm_buffer_collect_damage. */
+	uint64_t *chunk_hashes;
 };
 
 struct wl_shm_sigbus_data {
@@ -102,14 +115,78 @@ struct wl_shm_sigbus_data {
 	int fallback_mapping_used;
 };
 
+static uint32_t
+shm_client_map_options(struct wl_client *client)
+{
+	return wl_display_get_shm_map_options(wl_client_get_display(client));
+}
+
+static void
+shm_advise(void *data, size_t size, uint32_t options)
+{
+	/* Advice only, failing to follow it is harmless. */
+#ifdef MADV_HUGEPAGE
+	if (options & WL_SHM_MAP_HUGEPAGE)
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+	if (options & WL_SHM_MAP_SEQUENTIAL)
+		madvise(data, size, MADV_SEQUENTIAL);
+}
+
+static int
+shm_prefault(const char *start, const char *end)
+{
+	uintptr_t page_mask = (uintptr_t) sysconf(_SC_PAGESIZE) - 1;
+	uintptr_t first = (uintptr_t) start & ~page_mask;
+	uintptr_t last = ((uintptr_t) end + page_mask) & ~page_mask;
+
+	if (last <= first)
+		return 0;
+
+#ifdef MADV_POPULATE_READ
+	/* Maps the pages right away. Kernels before 5.14 don't know it and
+	 * return EINVAL, in which case fall back to WILLNEED. */
+	if (madvise((void *) first, last - first, MADV_POPULATE_READ) == 0)
+		return 0;
+	if (errno != EINVAL)
+		return -1;
+#endif
+	/* Only brings the pages into memory, the first access still takes a
+	 * (cheap) minor fault to map them. */
+	return madvise((void *) first, last - first, MADV_WILLNEED);
+}
+
+/* Populate [offset, end) of the pool mapping if the map options ask for it.
+ * Only done for sealed pools whose file is known to be large enough, anything
+ * else could be truncated by the client behind our back. */
+static void
+shm_pool_populate(struct wl_shm_pool *pool, uint32_t options, ssize_t offset)
+{
+	struct stat statbuf;
+
+	if (!(options & WL_SHM_MAP_POPULATE_SEALED) || !pool->sealed ||
+	    offset >= pool->size)
+		return;
+
+	if (fstat(pool->mmap_fd, &statbuf) < 0 || statbuf.st_size < pool->size)
+		return;
+
+	shm_prefault(pool->data + offset, pool->data + pool->size);
+}
+
+/* Sets fresh if the returned mapping is a new one rather than the old one
+ * resized, in which case none of its pages are populated yet. */
 static void *
-shm_pool_grow_mapping(struct wl_shm_pool *pool)
+shm_pool_grow_mapping(struct wl_shm_pool *pool, bool *fresh)
 {
 	void *data;
 
 #ifdef MREMAP_MAYMOVE
+	/* An old size of 0 duplicates the mapping, leaving the old one intact. */
+	*fresh = pool->external_refcount > 0;
 	data = mremap(pool->data, pool->external_refcount ? 0 : pool->size, pool->new_size, MREMAP_MAYMOVE);
 #else
+	*fresh = true;
 	data = wl_os_mremap_maymove(pool->mmap_fd, pool->data, &pool->size,
 				    pool->new_size, pool->mmap_prot,
 				    pool->mmap_flags, pool->external_refcount > 0);
@@ -122,6 +199,13 @@ shm_pool_grow_mapping(struct wl_shm_pool *pool)
 	return data;
 }
 
+static void
+shm_pool_account(struct wl_shm_pool *pool, int64_t mapped, int64_t stale)
+{
+	if (pool->client)
+		wl_client_account_shm(pool->client, mapped, stale);
+}
+
 static void
 shm_pool_unref(struct wl_shm_pool *pool, bool external)
 {
@@ -137,10 +221,18 @@ shm_pool_unref(struct wl_shm_pool *pool, bool external)
 				free(mapping);
 			}
 			wl_list_init(&pool->mappings);
+			shm_pool_account(pool, 0, -pool->stale_size);
+			pool->stale_size = 0;
 		}
 	} else {
 		pool->internal_refcount--;
 		assert(pool->internal_refcount >= 0);
+		/* Only the compositor is left using the pool, the client can't
+		 * be charged for it any longer and may be about to go away. */
+		if (pool->internal_refcount == 0) {
+			shm_pool_account(pool, -pool->size, -pool->stale_size);
+			pool->client = NULL;
+		}
 	}
 
 	if (pool->internal_refcount + pool->external_refcount > 0)
@@ -157,6 +249,7 @@ destroy_buffer(struct wl_resource *resource)
 	struct wl_shm_buffer *buffer = wl_resource_get_user_data(resource);
 
 	shm_pool_unref(buffer->pool, false);
+	free(buffer->chunk_hashes);
 	free(buffer);
 }
 
@@ -229,6 +322,7 @@ shm_pool_create_buffer(struct wl_client *client, struct wl_resource *resource,
 	buffer->stride = stride;
 	buffer->offset = offset;
 	buffer->pool = pool;
+	buffer->chunk_hashes = NULL;
 	pool->internal_refcount++;
 
 	buffer->resource =
@@ -265,6 +359,9 @@ shm_pool_resize(struct wl_client *client, struct wl_resource *resource,
 {
 	struct wl_shm_pool *pool = wl_resource_get_user_data(resource);
 	struct wl_shm_pool_mapping *mapping;
+	uint32_t options = shm_client_map_options(client);
+	ssize_t old_size = pool->size;
+	bool fresh;
 	void *data;
 
 	if (size < pool->size) {
@@ -274,33 +371,55 @@ shm_pool_resize(struct wl_client *client, struct wl_resource *resource,
 		return;
 	}
 
-	pool->new_size = size;
-
+	if (size == pool->size)
+		return;
 
-	if (pool->size == pool->new_size)
+	/* Old mappings that are kept alive count against the quota as well,
+	 * hence the full new size. */
+	if (!wl_client_shm_quota_allows(client, pool->external_refcount ? size : size - pool->size)) {
+		wl_client_post_no_memory(client);
 		return;
+	}
 
-	data = shm_pool_grow_mapping(pool);
+	pool->new_size = size;
 
-	/*
-	 * keep track of previous mappings, we clean them up once the pool external_refcount drops to zero.
-	 */
-	if(pool->external_refcount && data != pool->data) {
-		mapping = malloc(sizeof(struct wl_shm_pool_mapping));
-		mapping->data = pool->data;
-		mapping->size = pool->size;
-		wl_list_insert(&pool->mappings, &mapping->link);
+	/* Allocate up front so the old mapping can't get lost after a successful mremap. */
+	mapping = pool->external_refcount ? malloc(sizeof(struct wl_shm_pool_mapping)) : NULL;
+	if (pool->external_refcount && mapping == NULL) {
+		wl_client_post_no_memory(client);
+		return;
 	}
 
+	data = shm_pool_grow_mapping(pool, &fresh);
+
 	if (data == MAP_FAILED) {
+		free(mapping);
 		wl_resource_post_error(pool->resource,
 								WL_SHM_ERROR_INVALID_FD,
 								"failed mremap");
 		return;
 	}
 
+	/*
+	 * keep track of previous mappings, we clean them up once the pool external_refcount drops to zero.
+	 */
+	if (mapping && data != pool->data) {
+		mapping->data = pool->data;
+		mapping->size = pool->size;
+		wl_list_insert(&pool->mappings, &mapping->link);
+		pool->stale_size += pool->size;
+		shm_pool_account(pool, 0, pool->size);
+	} else {
+		free(mapping);
+	}
+
+	shm_pool_account(pool, pool->new_size - old_size, 0);
 	pool->data = data;
 	pool->size = pool->new_size;
+
+	shm_advise(pool->data, pool->size, options);
+	/* mremap keeps the pages it moves populated, only the tail is new. */
+	shm_pool_populate(pool, options, fresh ? 0 : old_size);
 }
 
 static const struct wl_shm_pool_interface shm_pool_interface = {
@@ -315,9 +434,11 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 {
 	struct wl_shm_pool *pool;
 	struct stat statbuf;
+	uint32_t options = shm_client_map_options(client);
 	int seals;
 	int prot;
 	int flags;
+	int populate = 0;
 
 	if (size <= 0) {
 		wl_resource_post_error(resource,
@@ -326,6 +447,11 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 		goto err_close;
 	}
 
+	if (!wl_client_shm_quota_allows(client, size)) {
+		wl_client_post_no_memory(client);
+		goto err_close;
+	}
+
 	pool = malloc(sizeof *pool);
 	if (pool == NULL) {
 		wl_client_post_no_memory(client);
@@ -337,27 +463,36 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 	if (seals == -1)
 		seals = 0;
 
-	if ((seals & F_SEAL_SHRINK) && fstat(fd, &statbuf) >= 0)
+	pool->sealed = (seals & F_SEAL_SHRINK) != 0;
+	if (pool->sealed && fstat(fd, &statbuf) >= 0)
 		pool->sigbus_is_impossible = statbuf.st_size >= size;
 	else
 		pool->sigbus_is_impossible = false;
 #else
+	pool->sealed = false;
 	pool->sigbus_is_impossible = false;
 #endif
 
+#ifdef MAP_POPULATE
+	/* Large pools would otherwise fault in every page on first read. */
+	if ((options & WL_SHM_MAP_POPULATE_SEALED) && pool->sigbus_is_impossible)
+		populate = MAP_POPULATE;
+#endif
+
 	pool->internal_refcount = 1;
 	pool->external_refcount = 0;
 	pool->size = size;
 	pool->new_size = size;
 	prot = PROT_READ | PROT_WRITE;
 	flags = MAP_SHARED;
-	pool->data = mmap(NULL, size, prot, flags, fd, 0);
+	pool->data = mmap(NULL, size, prot, flags | populate, fd, 0);
 	if (pool->data == MAP_FAILED) {
 		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
 				       "failed mmap fd %d: %s", fd,
 				       strerror(errno));
 		goto err_free;
 	}
+	shm_advise(pool->data, size, options);
 	/* We may need to keep the fd, prot and flags to emulate mremap(). */
 	pool->mmap_fd = fd;
 	pool->mmap_prot = prot;
@@ -371,6 +506,9 @@ shm_create_pool(struct wl_client *client, struct wl_resource *resource,
 		return;
 	}
 	wl_list_init(&pool->mappings);
+	pool->stale_size = 0;
+	pool->client = client;
+	shm_pool_account(pool, pool->size, 0);
 
 	wl_resource_set_implementation(pool->resource,
 				       &shm_pool_interface,
@@ -695,6 +833,209 @@ wl_shm_buffer_end_access(struct wl_shm_buffer *buffer)
 	}
 }
 
+static uint64_t
+shm_hash_chunk(const char *data, size_t size)
+{
+	uint64_t h = 0x27d4eb2f165667c5ULL + size;
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&word, data + i, sizeof word);
+		h ^= word * 0xc2b2ae3d27d4eb4fULL;
+		h = ((h << 31) | (h >> 33)) * 0x9e3779b185ebca87ULL;
+	}
+	for (; i < size; i++)
+		h = (h ^ (unsigned char) data[i]) * 0x9e3779b185ebca87ULL;
+
+	h ^= h >> 33;
+	h *= 0xc2b2ae3d27d4eb4fULL;
+	h ^= h >> 29;
+	return h;
+}
+
+static int
+shm_add_damage(struct wl_array *damage, int32_t x, int32_t y,
+	       int32_t width, int32_t height)
+{
+	int32_t *rect;
+
+	rect = wl_array_add(damage, 4 * sizeof *rect);
+	if (rect == NULL)
+		return -1;
+
+	rect[0] = x;
+	rect[1] = y;
+	rect[2] = width;
+	rect[3] = height;
+	return 0;
+}
+
+/** Collect the damage of an shm buffer by comparing its contents
+ *
+ * \param buffer The SHM buffer
+ * \param damage Array to append x, y, width, height int32_t tuples to
+ * \return The number of rects appended, or -1 if dirty tracking is
+ * disabled or memory could not be allocated
+ *
+ * Each row of the buffer is split in chunks that are hashed and compared
+ * with the hashes recorded by the previous call. Consecutive rows with
+ * changed chunks are merged into a single rect spanning the changed
+ * chunks of all its rows. The first call for a buffer records the
+ * hashes and reports the whole buffer as damaged.
+ *
+ * Write protecting the pool pages (userfaultfd or soft-dirty bits) would
+ * be cheaper, but both only observe writes made through the page tables
+ * of the compositor process, not writes made by the client to its own
+ * mapping of the same memory.
+ *
+ * \memberof wl_shm_buffer
+ */
+WL_EXPORT int
+wl_shm_buffer_collect_damage(struct wl_shm_buffer *buffer,
+			     struct wl_array *damage)
+{
+	struct wl_client *client = wl_resource_get_client(buffer->resource);
+	int32_t bpp, row_size, chunks_per_row, chunk, chunk_size;
+	int32_t band_start = -1, band_x0 = 0, band_x1 = 0;
+	int32_t x0, x1, y, count = 0;
+	bool baseline;
+	uint64_t hash, *hashes;
+	const char *data, *row;
+
+	if (!wl_display_get_shm_dirty_tracking(wl_client_get_display(client)))
+		return -1;
+
+	/* Only the mandatory formats have a known pixel size, damage of
+	 * other formats always spans full rows. */
+	if ((buffer->format == WL_SHM_FORMAT_ARGB8888 ||
+	     buffer->format == WL_SHM_FORMAT_XRGB8888) &&
+	    buffer->width <= buffer->stride / 4)
+		bpp = 4;
+	else
+		bpp = 0;
+
+	row_size = bpp ? buffer->width * bpp : buffer->stride;
+	chunks_per_row = (row_size + SHM_DIRTY_CHUNK_SIZE - 1) /
+			 SHM_DIRTY_CHUNK_SIZE;
+
+	baseline = buffer->chunk_hashes == NULL;
+	if (baseline) {
+		buffer->chunk_hashes = calloc((size_t) buffer->height *
+					      chunks_per_row,
+					      sizeof *buffer->chunk_hashes);
+		if (buffer->chunk_hashes == NULL)
+			return -1;
+	}
+
+	wl_shm_buffer_begin_access(buffer);
+	data = wl_shm_buffer_get_data(buffer);
+
+	for (y = 0; y <= buffer->height; y++) {
+		x0 = -1;
+		x1 = -1;
+
+		if (y < buffer->height) {
+			row = data + (size_t) y * buffer->stride;
+			hashes = buffer->chunk_hashes +
+				 (size_t) y * chunks_per_row;
+
+			for (chunk = 0; chunk < chunks_per_row; chunk++) {
+				chunk_size = row_size - chunk * SHM_DIRTY_CHUNK_SIZE;
+				if (chunk_size > SHM_DIRTY_CHUNK_SIZE)
+					chunk_size = SHM_DIRTY_CHUNK_SIZE;
+
+				hash = shm_hash_chunk(row + chunk * SHM_DIRTY_CHUNK_SIZE,
+						      chunk_size);
+				if (!baseline && hash == hashes[chunk])
+					continue;
+
+				hashes[chunk] = hash;
+				if (x0 < 0)
+					x0 = bpp ? chunk * SHM_DIRTY_CHUNK_SIZE / bpp : 0;
+				x1 = bpp ? (chunk * SHM_DIRTY_CHUNK_SIZE + chunk_size) / bpp :
+				     buffer->width;
+			}
+		}
+
+		if (x0 >= 0) {
+			if (band_start < 0) {
+				band_start = y;
+				band_x0 = x0;
+				band_x1 = x1;
+			} else {
+				band_x0 = x0 < band_x0 ? x0 : band_x0;
+				band_x1 = x1 > band_x1 ? x1 : band_x1;
+			}
+		} else if (band_start >= 0) {
+			if (shm_add_damage(damage, band_x0, band_start,
+					   band_x1 - band_x0,
+					   y - band_start) < 0) {
+				count = -1;
+				break;
+			}
+			count++;
+			band_start = -1;
+		}
+	}
+
+	wl_shm_buffer_end_access(buffer);
+
+	return count;
+}
+
+/** Fault in the pages backing regions of an shm buffer
+ *
+ * \param buffer The SHM buffer
+ * \param rects x, y, width, height int32_t tuples in buffer coordinates
+ * \param rect_count The number of tuples in rects
+ * \return 0 on success, or -1 if the kernel refused for any of the rects
+ *
+ * Formats other than the mandatory ones are prefaulted in full rows.
+ *
+ * \memberof wl_shm_buffer
+ */
+WL_EXPORT int
+wl_shm_buffer_prefault(struct wl_shm_buffer *buffer, const int32_t *rects,
+		       int32_t rect_count)
+{
+	const char *data = buffer->pool->data + buffer->offset;
+	int32_t bpp, x0, y0, x1, y1, i;
+	int ret = 0;
+
+	if ((buffer->format == WL_SHM_FORMAT_ARGB8888 ||
+	     buffer->format == WL_SHM_FORMAT_XRGB8888) &&
+	    buffer->width <= buffer->stride / 4)
+		bpp = 4;
+	else
+		bpp = 0;
+
+	for (i = 0; i < rect_count; i++) {
+		const int32_t *rect = rects + 4 * i;
+
+		x0 = rect[0] < 0 ? 0 : rect[0];
+		y0 = rect[1] < 0 ? 0 : rect[1];
+		x1 = rect[0] + rect[2] > buffer->width ? buffer->width : rect[0] + rect[2];
+		y1 = rect[1] + rect[3] > buffer->height ? buffer->height : rect[1] + rect[3];
+		if (x0 >= x1 || y0 >= y1)
+			continue;
+
+		if (!bpp) {
+			x0 = 0;
+			x1 = buffer->stride;
+		} else {
+			x0 *= bpp;
+			x1 *= bpp;
+		}
+
+		if (shm_prefault(data + (size_t) y0 * buffer->stride + x0,
+				 data + (size_t) (y1 - 1) * buffer->stride + x1) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
 /** \cond */ /* Deprecated functions below. */
 
 WL_EXPORT struct wl_shm_buffer *
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "wayland-util.h"
 #include "wayland-private.h"
@@ -176,6 +177,102 @@ union map_entry {
 #define map_entry_is_free(entry) ((entry).next & 0x1)
 #define map_entry_get_data(entry) ((void *)((entry).next & ~(uintptr_t)0x3))
 #define map_entry_get_flags(entry) (((entry).next >> 1) & 0x1)
+/* Terminates the free list inside the entries. Unlike the 0 that marks an
+ * empty free_list, it has the free bit set, so the last free entry can be
+ * told apart from an entry without data. */
+#define map_free_list_end (~(uintptr_t)0)
+
+#ifdef WL_MAP_PAGED
+
+#define map_page_shift 9
+#define map_page_size (1u << map_page_shift)
+#define map_page_mask (map_page_size - 1)
+
+static inline uint32_t
+map_entries_count(struct wl_map_entries *entries)
+{
+	return entries->count;
+}
+
+static inline union map_entry *
+map_entries_at(struct wl_map_entries *entries, uint32_t i)
+{
+	union map_entry **pages = entries->pages.data;
+
+	return &pages[i >> map_page_shift][i & map_page_mask];
+}
+
+/* Growing only ever adds a page, entries never move */
+static union map_entry *
+map_entries_add(struct wl_map_entries *entries)
+{
+	union map_entry **page;
+
+	if ((entries->count & map_page_mask) == 0) {
+		page = wl_array_add(&entries->pages, sizeof *page);
+		if (!page)
+			return NULL;
+		*page = malloc(map_page_size * sizeof **page);
+		if (!*page) {
+			entries->pages.size -= sizeof *page;
+			return NULL;
+		}
+	}
+
+	return map_entries_at(entries, entries->count++);
+}
+
+static void
+map_entries_release(struct wl_map_entries *entries)
+{
+	union map_entry **page;
+
+	wl_array_for_each(page, &entries->pages)
+		free(*page);
+	wl_array_release(&entries->pages);
+}
+
+static size_t
+map_entries_allocated_size(struct wl_map_entries *entries)
+{
+	return entries->pages.alloc +
+	       entries->pages.size / sizeof(union map_entry *) *
+	       map_page_size * sizeof(union map_entry);
+}
+
+#else
+
+static inline uint32_t
+map_entries_count(struct wl_map_entries *entries)
+{
+	return entries->array.size / sizeof(union map_entry);
+}
+
+static inline union map_entry *
+map_entries_at(struct wl_map_entries *entries, uint32_t i)
+{
+	return &((union map_entry *) entries->array.data)[i];
+}
+
+static union map_entry *
+map_entries_add(struct wl_map_entries *entries)
+{
+	return wl_array_add(&entries->array, sizeof(union map_entry));
+}
+
+static void
+map_entries_release(struct wl_map_entries *entries)
+{
+	wl_array_release(&entries->array);
+}
+
+static size_t
+map_entries_allocated_size(struct wl_map_entries *entries)
+{
+	return entries->array.alloc;
+}
+
+#endif
 
 void
 wl_map_init(struct wl_map *map, uint32_t side)
@@ -187,16 +284,16 @@ wl_map_init(struct wl_map *map, uint32_t side)
 void
 wl_map_release(struct wl_map *map)
 {
-	wl_array_release(&map->client_entries);
-	wl_array_release(&map->server_entries);
+	map_entries_release(&map->client_entries);
+	map_entries_release(&map->server_entries);
 }
 
 uint32_t
 wl_map_insert_new(struct wl_map *map, uint32_t flags, void *data)
 {
-	union map_entry *start, *entry;
-	struct wl_array *entries;
-	uint32_t base;
+	union map_entry *entry;
+	struct wl_map_entries *entries;
+	uint32_t base, i;
 
 	if (map->side == WL_MAP_CLIENT_SIDE) {
 		entries = &map->client_entries;
@@ -207,28 +304,29 @@ wl_map_insert_new(struct wl_map *map, uint32_t flags, void *data)
 	}
 
 	if (map->free_list) {
-		start = entries->data;
-		entry = &start[map->free_list >> 1];
-		map->free_list = entry->next;
+		i = map->free_list >> 1;
+		entry = map_entries_at(entries, i);
+		map->free_list = entry->next == map_free_list_end ?
+				 0 : entry->next;
 	} else {
-		entry = wl_array_add(entries, sizeof *entry);
+		i = map_entries_count(entries);
+		entry = map_entries_add(entries);
 		if (!entry)
 			return 0;
-		start = entries->data;
 	}
 
 	entry->data = data;
 	entry->next |= (flags & 0x1) << 1;
 
-	return (entry - start) + base;
+	return i + base;
 }
 
 int
 wl_map_insert_at(struct wl_map *map, uint32_t flags, uint32_t i, void *data)
 {
-	union map_entry *start;
+	union map_entry *entry;
 	uint32_t count;
-	struct wl_array *entries;
+	struct wl_map_entries *entries;
 
 	if (i < WL_SERVER_ID_START) {
 		entries = &map->client_entries;
@@ -237,16 +335,20 @@ wl_map_insert_at(struct wl_map *map, uint32_t flags, uint32_t i, void *data)
 		i -= WL_SERVER_ID_START;
 	}
 
-	count = entries->size / sizeof *start;
+	count = map_entries_count(entries);
 	if (count < i)
 		return -1;
 
-	if (count == i)
-		wl_array_add(entries, sizeof *start);
+	if (count == i) {
+		entry = map_entries_add(entries);
+		if (!entry)
+			return -1;
+	} else {
+		entry = map_entries_at(entries, i);
+	}
 
-	start = entries->data;
-	start[i].data = data;
-	start[i].next |= (flags & 0x1) << 1;
+	entry->data = data;
+	entry->next |= (flags & 0x1) << 1;
 
 	return 0;
 }
@@ -254,9 +356,9 @@ wl_map_insert_at(struct wl_map *map, uint32_t flags, uint32_t i, void *data)
 int
 wl_map_reserve_new(struct wl_map *map, uint32_t i)
 {
-	union map_entry *start;
+	union map_entry *entry;
 	uint32_t count;
-	struct wl_array *entries;
+	struct wl_map_entries *entries;
 
 	if (i < WL_SERVER_ID_START) {
 		if (map->side == WL_MAP_CLIENT_SIDE)
@@ -271,18 +373,19 @@ wl_map_reserve_new(struct wl_map *map, uint32_t i)
 		i -= WL_SERVER_ID_START;
 	}
 
-	count = entries->size / sizeof *start;
+	count = map_entries_count(entries);
 
 	if (count < i)
 		return -1;
 
 	if (count == i) {
-		wl_array_add(entries, sizeof *start);
-		start = entries->data;
-		start[i].data = NULL;
+		entry = map_entries_add(entries);
+		if (!entry)
+			return -1;
+		entry->data = NULL;
 	} else {
-		start = entries->data;
-		if (start[i].data != NULL) {
+		entry = map_entries_at(entries, i);
+		if (entry->data != NULL) {
 			return -1;
 		}
 	}
@@ -293,8 +396,7 @@ wl_map_reserve_new(struct wl_map *map, uint32_t i)
 void
 wl_map_remove(struct wl_map *map, uint32_t i)
 {
-	union map_entry *start;
-	struct wl_array *entries;
+	struct wl_map_entries *entries;
 
 	if (i < WL_SERVER_ID_START) {
 		if (map->side == WL_MAP_SERVER_SIDE)
@@ -309,17 +411,46 @@ wl_map_remove(struct wl_map *map, uint32_t i)
 		i -= WL_SERVER_ID_START;
 	}
 
-	start = entries->data;
-	start[i].next = map->free_list;
+	map_entries_at(entries, i)->next =
+		map->free_list ? map->free_list : map_free_list_end;
 	map->free_list = (i << 1) | 1;
 }
 
+/* Free a server side entry that is in use, but no longer points to anything */
+int
+wl_map_release_reserved(struct wl_map *map, uint32_t i)
+{
+	union map_entry *entry;
+
+	if (i < WL_SERVER_ID_START || map->side == WL_MAP_CLIENT_SIDE)
+		return -1;
+
+	i -= WL_SERVER_ID_START;
+	if (i >= map_entries_count(&map->server_entries))
+		return -1;
+
+	entry = map_entries_at(&map->server_entries, i);
+	if (map_entry_is_free(*entry) || map_entry_get_data(*entry) != NULL)
+		return -1;
+
+	entry->next = map->free_list ? map->free_list : map_free_list_end;
+	map->free_list = (i << 1) | 1;
+
+	return 0;
+}
+
+size_t
+wl_map_get_allocated_size(struct wl_map *map)
+{
+	return map_entries_allocated_size(&map->client_entries) +
+	       map_entries_allocated_size(&map->server_entries);
+}
+
 void *
 wl_map_lookup(struct wl_map *map, uint32_t i)
 {
-	union map_entry *start;
-	uint32_t count;
-	struct wl_array *entries;
+	union map_entry entry;
+	struct wl_map_entries *entries;
 
 	if (i < WL_SERVER_ID_START) {
 		entries = &map->client_entries;
@@ -328,11 +459,11 @@ wl_map_lookup(struct wl_map *map, uint32_t i)
 		i -= WL_SERVER_ID_START;
 	}
 
-	start = entries->data;
-	count = entries->size / sizeof *start;
-
-	if (i < count && !map_entry_is_free(start[i]))
-		return map_entry_get_data(start[i]);
+	if (i < map_entries_count(entries)) {
+		entry = *map_entries_at(entries, i);
+		if (!map_entry_is_free(entry))
+			return map_entry_get_data(entry);
+	}
 
 	return NULL;
 }
@@ -340,9 +471,8 @@ wl_map_lookup(struct wl_map *map, uint32_t i)
 uint32_t
 wl_map_lookup_flags(struct wl_map *map, uint32_t i)
 {
-	union map_entry *start;
-	uint32_t count;
-	struct wl_array *entries;
+	union map_entry entry;
+	struct wl_map_entries *entries;
 
 	if (i < WL_SERVER_ID_START) {
 		entries = &map->client_entries;
@@ -351,27 +481,26 @@ wl_map_lookup_flags(struct wl_map *map, uint32_t i)
 		i -= WL_SERVER_ID_START;
 	}
 
-	start = entries->data;
-	count = entries->size / sizeof *start;
-
-	if (i < count && !map_entry_is_free(start[i]))
-		return map_entry_get_flags(start[i]);
+	if (i < map_entries_count(entries)) {
+		entry = *map_entries_at(entries, i);
+		if (!map_entry_is_free(entry))
+			return map_entry_get_flags(entry);
+	}
 
 	return 0;
 }
 
 static enum wl_iterator_result
-for_each_helper(struct wl_array *entries, wl_iterator_func_t func, void *data)
+for_each_helper(struct wl_map_entries *entries, wl_iterator_func_t func, void *data)
 {
 	enum wl_iterator_result ret = WL_ITERATOR_CONTINUE;
-	union map_entry entry, *start;
-	size_t count;
+	union map_entry entry;
+	uint32_t count;
 
-	start = (union map_entry *) entries->data;
-	count = entries->size / sizeof(union map_entry);
+	count = map_entries_count(entries);
 
-	for (size_t idx = 0; idx < count; idx++) {
-		entry = start[idx];
+	for (uint32_t idx = 0; idx < count; idx++) {
+		entry = *map_entries_at(entries, idx);
 		if (entry.data && !map_entry_is_free(entry)) {
 			ret = func(map_entry_get_data(entry), data, map_entry_get_flags(entry));
 			if (ret != WL_ITERATOR_CONTINUE)
@@ -423,3 +552,108 @@ wl_abort(const char *fmt, ...)
 }
 
 /** \endcond */
+
+/** \cond */
+
+struct object_cache {
+	/* singly linked through the first word of each block */
+	void *free;
+	uint32_t cached;
+	uint64_t allocated;
+	uint64_t reused;
+};
+
+/* resources are kept around by the thousands, closures are only ever used one
+ * at a time per dispatch */
+static const uint32_t object_cache_max_cached[WL_OBJECT_CACHE_KINDS] = {
+	[WL_OBJECT_CACHE_RESOURCE] = 4096,
+	[WL_OBJECT_CACHE_CLOSURE] = 64,
+};
+
+static __thread struct object_cache object_caches[WL_OBJECT_CACHE_KINDS];
+static __thread bool object_caches_registered;
+static pthread_key_t object_cache_key;
+static pthread_once_t object_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+object_caches_release(void *data)
+{
+	struct object_cache *caches = data;
+	void *block;
+
+	for (uint32_t kind = 0; kind < WL_OBJECT_CACHE_KINDS; kind++) {
+		while ((block = caches[kind].free)) {
+			caches[kind].free = *(void **) block;
+			free(block);
+		}
+		caches[kind].cached = 0;
+	}
+}
+
+static void
+object_cache_key_create(void)
+{
+	pthread_key_create(&object_cache_key, object_caches_release);
+}
+
+static struct object_cache *
+object_cache_get(uint32_t kind)
+{
+	if (!object_caches_registered) {
+		/* first use on this thread, free the caches when it exits */
+		pthread_once(&object_cache_once, object_cache_key_create);
+		pthread_setspecific(object_cache_key, object_caches);
+		object_caches_registered = true;
+	}
+
+	return &object_caches[kind];
+}
+
+void *
+wl_object_cache_alloc(uint32_t kind, size_t size)
+{
+	struct object_cache *cache = object_cache_get(kind);
+	void *block = cache->free;
+
+	if (block) {
+		cache->free = *(void **) block;
+		cache->cached--;
+		cache->reused++;
+		return block;
+	}
+
+	block = malloc(size);
+	if (block)
+		cache->allocated++;
+	return block;
+}
+
+void
+wl_object_cache_free(uint32_t kind, void *block)
+{
+	struct object_cache *cache = object_cache_get(kind);
+
+	if (block == NULL)
+		return;
+
+	if (cache->cached >= object_cache_max_cached[kind]) {
+		free(block);
+		return;
+	}
+
+	*(void **) block = cache->free;
+	cache->free = block;
+	cache->cached++;
+}
+
+/** \endcond */
+
+WL_EXPORT void
+wl_object_cache_get_stats(uint32_t kind, uint64_t *allocated, uint64_t *reused, uint32_t *cached)
+{
+	struct object_cache *cache = object_cache_get(kind);
+
+	*allocated = cache->allocated;
+	*reused = cache->reused;
+	*cached = cache->cached;
+}
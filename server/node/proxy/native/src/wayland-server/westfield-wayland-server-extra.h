@@ -84,4 +84,159 @@ void
 wl_resource_destroy_silently(struct wl_resource *resource);
 
 void
-wl_get_server_object_ids_batch(struct wl_client *client, uint32_t *ids, uint32_t amount);
\ No newline at end of file
+wl_get_server_object_ids_batch(struct wl_client *client, uint32_t *ids, uint32_t amount);
+
+/** Make server side ids available again for wl_get_server_object_ids_batch and wl_resource_create.
+ *
+ * Ids of destroyed resources are kept reserved by wl_resource_destroy_silently, as the browser compositor may still
+ * refer to them. Once the object is gone on both ends, and the browser compositor confirmed it won't use the id anymore,
+ * it can be released here. Ids that still have a resource, or that are not reserved, are skipped. Returns the number of
+ * ids released.
+ */
+uint32_t
+wl_client_release_server_object_ids(struct wl_client *client, const uint32_t *ids, uint32_t amount);
+
+/** Bytes allocated for the object map of the client. */
+size_t
+wl_client_get_object_map_size(struct wl_client *client);
+
+/** Enable content based damage tracking of shm buffers created by clients of this display.
+ *
+ * Clients can't be trusted to report damage correctly. With tracking enabled,
+ * wl_shm_buffer_collect_damage compares the buffer contents with what they
+ * were the last time it was called and reports the rows that actually changed.
+ */
+void
+wl_display_set_shm_dirty_tracking(struct wl_display *display, int enabled);
+
+int
+wl_display_get_shm_dirty_tracking(struct wl_display *display);
+
+/** Append the damage of an shm buffer since the previous call as x, y, width, height int32_t tuples.
+ *
+ * The first call for a buffer reports the whole buffer. Returns the number of
+ * rects appended, or -1 if dirty tracking is disabled or memory ran out, in
+ * which case the damage reported by the client should be used.
+ */
+int
+wl_shm_buffer_collect_damage(struct wl_shm_buffer *buffer, struct wl_array *damage);
+
+/* Map pools sealed against shrinking with MAP_POPULATE, so reading them doesn't fault page by page. */
+#define WL_SHM_MAP_POPULATE_SEALED (1 << 0)
+/* Ask for transparent huge pages. Only effective when shmem_enabled is set to advise (or always). */
+#define WL_SHM_MAP_HUGEPAGE (1 << 1)
+/* Pools are read front to back, so let the kernel read ahead aggressively. */
+#define WL_SHM_MAP_SEQUENTIAL (1 << 2)
+
+/** Set the WL_SHM_MAP_* flags used when mapping shm pools of clients of this display.
+ *
+ * Only pools created or resized after the call are affected.
+ */
+void
+wl_display_set_shm_map_options(struct wl_display *display, uint32_t options);
+
+uint32_t
+wl_display_get_shm_map_options(struct wl_display *display);
+
+/** Fault in the pages backing the given x, y, width, height int32_t tuples of an shm buffer.
+ *
+ * Meant to be called right before the damaged regions are read back, so the
+ * read doesn't take a page fault every 4 KiB. Returns 0 on success or -1 if
+ * the kernel refused, in which case the read will simply fault as usual.
+ */
+int
+wl_shm_buffer_prefault(struct wl_shm_buffer *buffer, const int32_t *rects, int32_t rect_count);
+
+size_t
+wl_connection_get_allocated_size(struct wl_connection *connection);
+
+/** The number of bytes queued in the in and out ring buffers of the connection. */
+size_t
+wl_connection_get_buffered_size(struct wl_connection *connection);
+
+/** The number of bytes of shm pools the client currently has mapped. */
+uint64_t
+wl_client_get_shm_mapped_bytes(struct wl_client *client);
+
+/** The number of bytes of old shm pool mappings kept alive after a resize because the compositor still references them. */
+uint64_t
+wl_client_get_shm_stale_bytes(struct wl_client *client);
+
+/** Limit the mapped plus stale shm bytes of a client, 0 means unlimited.
+ *
+ * Creating or growing a pool beyond the quota fails with a no memory error,
+ * which disconnects the client. The quota is not enforced retroactively.
+ */
+void
+wl_client_set_shm_quota(struct wl_client *client, uint64_t quota);
+
+uint64_t
+wl_client_get_shm_quota(struct wl_client *client);
+
+/** The shm quota given to clients that connect after the call, 0 means unlimited. */
+void
+wl_display_set_default_shm_quota(struct wl_display *display, uint64_t quota);
+
+/** Attach a pointer to the client, retrieved in constant time with wl_client_get_user_data.
+ *
+ * Unlike wl_client_get_destroy_listener this doesn't walk the listener list,
+ * which matters for lookups done for every message.
+ */
+void
+wl_client_set_user_data(struct wl_client *client, void *data);
+
+void *
+wl_client_get_user_data(struct wl_client *client);
+
+void
+wl_display_set_user_data(struct wl_display *display, void *data);
+
+void *
+wl_display_get_user_data(struct wl_display *display);
+
+/** Called with every connection accepted on a socket of the display, before a client is created for it.
+ *
+ * Return non-zero to take ownership of client_fd, eg to create the client on
+ * another display. Return 0 to have the client created on this display as usual.
+ */
+typedef int (*wl_display_client_fd_handoff_t)(struct wl_display *display, int client_fd, void *data);
+
+void
+wl_display_set_client_fd_handoff(struct wl_display *display, wl_display_client_fd_handoff_t handoff, void *data);
+
+/** Take a client away from its display, without disconnecting it, so it can be attached to another display.
+ *
+ * Its destroy listeners are notified and dropped, its client callbacks and
+ * user data are cleared and its connection is no longer dispatched. Objects,
+ * buffered requests, queued events and received fds stay with the client.
+ * Fails with EBUSY while a wl_display.sync is being answered. Must be called on
+ * the thread of the display. A detached client can still be disconnected with
+ * wl_client_destroy.
+ */
+int
+wl_client_detach(struct wl_client *client);
+
+/** Let display serve a client taken from another display with wl_client_detach.
+ *
+ * Client created listeners of display are notified as if the client just
+ * connected. Registries of the client are moved to display, so display must
+ * announce the same globals as the old one. Must be called on the thread of
+ * display.
+ */
+int
+wl_client_attach(struct wl_client *client, struct wl_display *display);
+
+bool
+wl_client_is_migrated(struct wl_client *client);
+
+#define WL_OBJECT_CACHE_RESOURCE 0
+#define WL_OBJECT_CACHE_CLOSURE 1
+
+/** Usage of the calling thread's cache of freed wl_resource or wl_closure objects.
+ *
+ * allocated counts the objects that had to be malloc'ed, reused the ones taken
+ * from the cache and cached the objects sitting in the cache right now. Once
+ * dispatch reaches a steady state, only reused should grow.
+ */
+void
+wl_object_cache_get_stats(uint32_t kind, uint64_t *allocated, uint64_t *reused, uint32_t *cached);
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "wayland-server/wayland-util.h"
+#include "westfield-clipboard-cache.h"
+
+struct cache_entry {
+    // link in westfield_clipboard_cache::entries, most recently used first
+    struct wl_list link;
+    // NULL once the entry was dropped while its transfer was still filling it
+    struct westfield_clipboard_cache *cache;
+    char *mime_type;
+    int fd;
+    uint64_t size;
+    bool complete;
+};
+
+struct westfield_clipboard_cache {
+    struct wl_list entries;
+    // sum of the size of all complete entries
+    uint64_t bytes;
+    uint64_t max_bytes;
+};
+
+static void
+free_entry(struct cache_entry *entry) {
+    wl_list_remove(&entry->link);
+    if (entry->complete && entry->cache) {
+        entry->cache->bytes -= entry->size;
+    }
+    close(entry->fd);
+    free(entry->mime_type);
+    free(entry);
+}
+
+static struct cache_entry *
+find_entry(struct westfield_clipboard_cache *cache, const char *mime_type) {
+    struct cache_entry *entry;
+
+    wl_list_for_each(entry, &cache->entries, link) {
+        if (strcmp(entry->mime_type, mime_type) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void
+evict(struct westfield_clipboard_cache *cache, struct cache_entry *keep) {
+    struct cache_entry *entry, *prev;
+
+    wl_list_for_each_reverse_safe(entry, prev, &cache->entries, link) {
+        if (cache->bytes <= cache->max_bytes) {
+            return;
+        }
+        if (entry->complete && entry != keep) {
+            free_entry(entry);
+        }
+    }
+}
+
+static void
+on_tap_done(void *tap_data, int tap_fd, uint64_t size, bool complete) {
+    struct cache_entry *entry = tap_data;
+    struct westfield_clipboard_cache *cache = entry->cache;
+
+    if (cache == NULL || !complete) {
+        free_entry(entry);
+        return;
+    }
+
+    // receivers only ever read it, make sure nothing else can change it either
+    fcntl(tap_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+    entry->complete = true;
+    entry->size = size;
+    cache->bytes += size;
+    wl_list_remove(&entry->link);
+    wl_list_insert(&cache->entries, &entry->link);
+
+    evict(cache, entry);
+}
+
+struct westfield_clipboard_cache *
+westfield_clipboard_cache_create(uint64_t max_bytes) {
+    struct westfield_clipboard_cache *cache;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    wl_list_init(&cache->entries);
+    cache->max_bytes = max_bytes;
+
+    return cache;
+}
+
+void
+westfield_clipboard_cache_destroy(struct westfield_clipboard_cache *cache) {
+    westfield_clipboard_cache_invalidate(cache);
+    free(cache);
+}
+
+void
+westfield_clipboard_cache_invalidate(struct westfield_clipboard_cache *cache) {
+    struct cache_entry *entry, *next;
+
+    wl_list_for_each_safe(entry, next, &cache->entries, link) {
+        if (entry->complete) {
+            free_entry(entry);
+        } else {
+            // still filling, on_tap_done frees it
+            wl_list_remove(&entry->link);
+            wl_list_init(&entry->link);
+            entry->cache = NULL;
+        }
+    }
+}
+
+int
+westfield_clipboard_cache_open(struct westfield_clipboard_cache *cache, const char *mime_type) {
+    struct cache_entry *entry = find_entry(cache, mime_type);
+
+    if (entry == NULL || !entry->complete) {
+        return -1;
+    }
+
+    wl_list_remove(&entry->link);
+    wl_list_insert(&cache->entries, &entry->link);
+
+    // transfers read files at their own offset, so all receivers can share the open file
+    return fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void
+westfield_clipboard_cache_tap(struct westfield_clipboard_cache *cache, const char *mime_type,
+                              struct westfield_transfer *transfer) {
+    struct cache_entry *entry;
+
+    if (cache->max_bytes == 0 || find_entry(cache, mime_type)) {
+        return;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return;
+    }
+    entry->mime_type = strdup(mime_type);
+    entry->fd = memfd_create("westfield-clipboard", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (entry->mime_type == NULL || entry->fd < 0) {
+        if (entry->fd >= 0) {
+            close(entry->fd);
+        }
+        free(entry->mime_type);
+        free(entry);
+        return;
+    }
+    entry->cache = cache;
+    wl_list_insert(&cache->entries, &entry->link);
+
+    if (!westfield_transfer_set_tap(transfer, entry->fd, cache->max_bytes, entry, on_tap_done)) {
+        free_entry(entry);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef WESTFIELD_WESTFIELD_CLIPBOARD_CACHE_H
+#define WESTFIELD_WESTFIELD_CLIPBOARD_CACHE_H
+
+#include <stdint.h>
+#include "westfield-transfer.h"
+
+/**
+ * Keeps the contents of the current selection, per mime type, so pasting it again doesn't need another round trip to
+ * the source.
+ *
+ * The first transfer of a mime type is tapped into a memfd while it streams to its receiver. Once it completed, later
+ * receives of the same mime type are served from that memfd, any number of them at the same time. All entries are
+ * dropped when the selection changes. Entries are evicted least recently used first to stay below max_bytes.
+ */
+struct westfield_clipboard_cache;
+
+struct westfield_clipboard_cache *
+westfield_clipboard_cache_create(uint64_t max_bytes);
+
+void
+westfield_clipboard_cache_destroy(struct westfield_clipboard_cache *cache);
+
+/**
+ * Drop all entries, to be called whenever a new selection is set. Transfers that are still filling the cache for the
+ * old selection are not stored.
+ */
+void
+westfield_clipboard_cache_invalidate(struct westfield_clipboard_cache *cache);
+
+/**
+ * Return a new fd with the cached contents for mime_type, to be used as the source of a transfer, or -1 if they are
+ * not cached (yet). The fd is sealed and must be closed by the caller.
+ */
+int
+westfield_clipboard_cache_open(struct westfield_clipboard_cache *cache, const char *mime_type);
+
+/**
+ * Store what the given, just created, transfer reads for mime_type once it completes. Does nothing if the mime type is
+ * already cached or being cached.
+ */
+void
+westfield_clipboard_cache_tap(struct westfield_clipboard_cache *cache, const char *mime_type,
+                              struct westfield_transfer *transfer);
+
+#endif //WESTFIELD_WESTFIELD_CLIPBOARD_CACHE_H
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-cursor.h"
+#include "westfield-hash.h"
+
+struct cursor_entry {
+    // link in westfield_cursor_cache::lru, most recently used first
+    struct wl_list link;
+    uint64_t hash;
+    uint32_t id;
+};
+
+struct westfield_cursor_cache {
+    struct wl_list lru;
+    uint32_t cursor_count;
+    uint32_t max_cursors;
+    uint32_t next_id;
+};
+
+static uint64_t
+cursor_hash(const uint8_t *pixels, int32_t width, int32_t height, int32_t hotspot_x, int32_t hotspot_y) {
+    int32_t header[4] = {width, height, hotspot_x, hotspot_y};
+    return westfield_hash64(pixels, (size_t) width * height * 4, westfield_hash64(header, sizeof(header), 0));
+}
+
+static uint8_t *
+copy_pixels(struct wl_shm_buffer *buffer, uint32_t format, int32_t width, int32_t height) {
+    int32_t stride = wl_shm_buffer_get_stride(buffer);
+    const uint8_t *data;
+    uint8_t *pixels;
+
+    pixels = malloc((size_t) width * height * 4);
+    if (pixels == NULL) {
+        return NULL;
+    }
+
+    wl_shm_buffer_begin_access(buffer);
+    data = wl_shm_buffer_get_data(buffer);
+    for (int32_t y = 0; y < height; y++) {
+        memcpy(pixels + (size_t) y * width * 4, data + (size_t) y * stride, (size_t) width * 4);
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    if (format == WL_SHM_FORMAT_XRGB8888) {
+        // the browser always gets ARGB, an X channel is undefined and must be made opaque
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            pixels[i * 4 + 3] = 0xff;
+        }
+    }
+
+    return pixels;
+}
+
+struct westfield_cursor_cache *
+westfield_cursor_cache_create(uint32_t max_cursors) {
+    struct westfield_cursor_cache *cache;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    wl_list_init(&cache->lru);
+    cache->max_cursors = max_cursors ? max_cursors : 1;
+    cache->next_id = 1;
+
+    return cache;
+}
+
+void
+westfield_cursor_cache_destroy(struct westfield_cursor_cache *cache) {
+    struct cursor_entry *entry, *next;
+
+    wl_list_for_each_safe(entry, next, &cache->lru, link) {
+        free(entry);
+    }
+    free(cache);
+}
+
+bool
+westfield_cursor_cache_update(struct westfield_cursor_cache *cache, struct wl_shm_buffer *buffer,
+                              int32_t hotspot_x, int32_t hotspot_y,
+                              struct westfield_cursor *cursor, struct wl_array *evicted_ids) {
+    struct cursor_entry *entry;
+    uint64_t hash;
+    uint32_t format;
+
+    format = wl_shm_buffer_get_format(buffer);
+    if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+        return false;
+    }
+
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->width = wl_shm_buffer_get_width(buffer);
+    cursor->height = wl_shm_buffer_get_height(buffer);
+    cursor->hotspot_x = hotspot_x;
+    cursor->hotspot_y = hotspot_y;
+
+    // hash a copy: the client can write to its buffer at any time, and the id must match the pixels handed out
+    cursor->pixels = copy_pixels(buffer, format, cursor->width, cursor->height);
+    if (cursor->pixels == NULL) {
+        return false;
+    }
+    hash = cursor_hash(cursor->pixels, cursor->width, cursor->height, hotspot_x, hotspot_y);
+
+    wl_list_for_each(entry, &cache->lru, link) {
+        if (entry->hash == hash) {
+            wl_list_remove(&entry->link);
+            wl_list_insert(&cache->lru, &entry->link);
+            free(cursor->pixels);
+            cursor->pixels = NULL;
+            cursor->id = entry->id;
+            return true;
+        }
+    }
+    cursor->is_new = true;
+
+    if (cache->cursor_count == cache->max_cursors) {
+        uint32_t *evicted_id;
+
+        entry = wl_container_of(cache->lru.prev, entry, link);
+        evicted_id = wl_array_add(evicted_ids, sizeof(*evicted_id));
+        if (evicted_id) {
+            *evicted_id = entry->id;
+        }
+        wl_list_remove(&entry->link);
+        cache->cursor_count--;
+    } else {
+        entry = calloc(1, sizeof(*entry));
+        if (entry == NULL) {
+            free(cursor->pixels);
+            cursor->pixels = NULL;
+            return false;
+        }
+    }
+
+    entry->hash = hash;
+    entry->id = cache->next_id++;
+    if (cache->next_id == 0) {
+        cache->next_id = 1;
+    }
+    wl_list_insert(&cache->lru, &entry->link);
+    cache->cursor_count++;
+    cursor->id = entry->id;
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef WESTFIELD_WESTFIELD_CURSOR_H
+#define WESTFIELD_WESTFIELD_CURSOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+
+/**
+ * Cache of the cursor images the browser has been sent, keyed by a hash of the cursor pixels and hotspot.
+ *
+ * Toolkits attach the same few cursor images over and over, from every client. Once an image is known, a cursor-role
+ * surface commit can be forwarded as a cursor id instead of a full buffer upload. The number of cached cursors is
+ * capped; the least recently used cursor ids are evicted and must be dropped by the browser.
+ */
+struct westfield_cursor_cache;
+
+struct westfield_cursor {
+    uint32_t id;
+    // true if the browser doesn't know this cursor yet, in which case pixels holds its image
+    bool is_new;
+    int32_t width, height;
+    int32_t hotspot_x, hotspot_y;
+    // tightly packed ARGB8888 pixels, owned by the caller and must be free()'d. NULL if is_new is false.
+    uint8_t *pixels;
+};
+
+struct westfield_cursor_cache *
+westfield_cursor_cache_create(uint32_t max_cursors);
+
+void
+westfield_cursor_cache_destroy(struct westfield_cursor_cache *cache);
+
+/**
+ * Look up the cursor shown by an ARGB8888 or XRGB8888 shm buffer with the given hotspot, adding it if it's unknown.
+ * Ids of cursors evicted to make room are appended to evicted_ids as uint32_t.
+ *
+ * Returns false if the buffer format is not supported.
+ */
+bool
+westfield_cursor_cache_update(struct westfield_cursor_cache *cache, struct wl_shm_buffer *buffer,
+                              int32_t hotspot_x, int32_t hotspot_y,
+                              struct westfield_cursor *cursor, struct wl_array *evicted_ids);
+
+#endif //WESTFIELD_WESTFIELD_CURSOR_H
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-downscale.h"
+
+struct source {
+    const uint8_t *data;
+    int32_t width, height, stride;
+};
+
+static inline const uint32_t *
+source_row(const struct source *source, int32_t y) {
+    return (const uint32_t *) (source->data + (size_t) y * source->stride);
+}
+
+static inline uint32_t
+average(uint32_t sum_b, uint32_t sum_g, uint32_t sum_r, uint32_t sum_a, uint32_t count) {
+    uint32_t half = count / 2;
+    return ((sum_a + half) / count) << 24 | ((sum_r + half) / count) << 16 |
+           ((sum_g + half) / count) << 8 | ((sum_b + half) / count);
+}
+
+static uint32_t
+box_pixel(const struct source *source, int32_t scale, int32_t dx, int32_t dy) {
+    int32_t x0 = dx * scale, y0 = dy * scale;
+    int32_t x1 = x0 + scale > source->width ? source->width : x0 + scale;
+    int32_t y1 = y0 + scale > source->height ? source->height : y0 + scale;
+    uint32_t sum_b = 0, sum_g = 0, sum_r = 0, sum_a = 0;
+
+    for (int32_t y = y0; y < y1; y++) {
+        const uint32_t *row = source_row(source, y);
+        for (int32_t x = x0; x < x1; x++) {
+            sum_b += row[x] & 0xff;
+            sum_g += (row[x] >> 8) & 0xff;
+            sum_r += (row[x] >> 16) & 0xff;
+            sum_a += row[x] >> 24;
+        }
+    }
+
+    return average(sum_b, sum_g, sum_r, sum_a, (x1 - x0) * (y1 - y0));
+}
+
+/**
+ * Average 2x2 blocks of two source rows into count destination pixels. Returns the number of pixels written, which
+ * can be less than count if the remainder has to be done by the scalar code.
+ */
+static int32_t
+box2_row(const uint32_t *row0, const uint32_t *row1, uint32_t *dst, int32_t count) {
+    int32_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *) (row0 + 2 * i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *) (row0 + 2 * i + 4));
+        __m128i b0 = _mm_loadu_si128((const __m128i *) (row1 + 2 * i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *) (row1 + 2 * i + 4));
+
+        // vertical sums of source pixels 0-1, 2-3, 4-5 and 6-7, 16 bits per channel
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // add horizontal neighbours, giving destination pixels 0-1 and 2-3
+        __m128i d01 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        __m128i d23 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+
+        d01 = _mm_srli_epi16(_mm_add_epi16(d01, two), 2);
+        d23 = _mm_srli_epi16(_mm_add_epi16(d23, two), 2);
+
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(d01, d23));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint32_t p00 = row0[2 * i], p01 = row0[2 * i + 1], p10 = row1[2 * i], p11 = row1[2 * i + 1];
+        dst[i] = average((p00 & 0xff) + (p01 & 0xff) + (p10 & 0xff) + (p11 & 0xff),
+                         ((p00 >> 8) & 0xff) + ((p01 >> 8) & 0xff) + ((p10 >> 8) & 0xff) + ((p11 >> 8) & 0xff),
+                         ((p00 >> 16) & 0xff) + ((p01 >> 16) & 0xff) + ((p10 >> 16) & 0xff) + ((p11 >> 16) & 0xff),
+                         (p00 >> 24) + (p01 >> 24) + (p10 >> 24) + (p11 >> 24), 4);
+    }
+
+    return i;
+}
+
+static void
+box_rect(const struct source *source, int32_t scale, const struct westfield_rect *rect, uint32_t *dst) {
+    for (int32_t dy = rect->y; dy < rect->y + rect->height; dy++) {
+        uint32_t *dst_row = dst + (size_t) (dy - rect->y) * rect->width;
+        int32_t dx = rect->x, done = 0;
+
+        if (scale == 2 && dy * 2 + 1 < source->height) {
+            // only whole 2x2 blocks can take the fast path
+            int32_t whole = (source->width / 2 < rect->x + rect->width ? source->width / 2 : rect->x + rect->width) -
+                            rect->x;
+            if (whole > 0) {
+                done = box2_row(source_row(source, dy * 2) + rect->x * 2, source_row(source, dy * 2 + 1) + rect->x * 2,
+                                dst_row, whole);
+            }
+        }
+
+        for (dx += done; dx < rect->x + rect->width; dx++) {
+            dst_row[dx - rect->x] = box_pixel(source, scale, dx, dy);
+        }
+    }
+}
+
+static inline uint32_t
+lerp_channel(uint32_t p00, uint32_t p01, uint32_t p10, uint32_t p11, int shift, uint32_t fx, uint32_t fy) {
+    uint32_t c00 = (p00 >> shift) & 0xff, c01 = (p01 >> shift) & 0xff;
+    uint32_t c10 = (p10 >> shift) & 0xff, c11 = (p11 >> shift) & 0xff;
+    uint32_t top = c00 * (256 - fx) + c01 * fx;
+    uint32_t bottom = c10 * (256 - fx) + c11 * fx;
+    return ((top * (256 - fy) + bottom * fy + (1 << 15)) >> 16) << shift;
+}
+
+static void
+bilinear_rect(const struct source *source, float scale, const struct westfield_rect *rect, uint32_t *dst) {
+    for (int32_t dy = rect->y; dy < rect->y + rect->height; dy++) {
+        uint32_t *dst_row = dst + (size_t) (dy - rect->y) * rect->width;
+        float sy = ((float) dy + 0.5f) * scale - 0.5f;
+        int32_t y0 = sy < 0 ? 0 : (int32_t) sy;
+        int32_t y1 = y0 + 1 < source->height ? y0 + 1 : source->height - 1;
+        uint32_t fy = sy < 0 ? 0 : (uint32_t) ((sy - (float) y0) * 256.0f);
+        const uint32_t *row0 = source_row(source, y0 < source->height ? y0 : source->height - 1);
+        const uint32_t *row1 = source_row(source, y1);
+
+        for (int32_t dx = rect->x; dx < rect->x + rect->width; dx++) {
+            float sx = ((float) dx + 0.5f) * scale - 0.5f;
+            int32_t x0 = sx < 0 ? 0 : (int32_t) sx;
+            int32_t x1, xs;
+            uint32_t fx, p00, p01, p10, p11;
+
+            xs = x0 < source->width ? x0 : source->width - 1;
+            x1 = xs + 1 < source->width ? xs + 1 : source->width - 1;
+            fx = sx < 0 ? 0 : (uint32_t) ((sx - (float) x0) * 256.0f);
+            p00 = row0[xs];
+            p01 = row0[x1];
+            p10 = row1[xs];
+            p11 = row1[x1];
+
+            dst_row[dx - rect->x] = lerp_channel(p00, p01, p10, p11, 0, fx, fy) |
+                                    lerp_channel(p00, p01, p10, p11, 8, fx, fy) |
+                                    lerp_channel(p00, p01, p10, p11, 16, fx, fy) |
+                                    lerp_channel(p00, p01, p10, p11, 24, fx, fy);
+        }
+    }
+}
+
+bool
+westfield_downscale_shm_buffer(struct wl_shm_buffer *buffer, enum westfield_downscale_filter filter, float scale,
+                               const struct westfield_rect *damage, uint32_t damage_count,
+                               struct westfield_downscaled *downscaled) {
+    struct source source;
+    uint32_t format, *dst;
+    int32_t box_scale = 0;
+    size_t pixel_count = 0;
+
+    memset(downscaled, 0, sizeof(*downscaled));
+
+    format = wl_shm_buffer_get_format(buffer);
+    if ((format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) || !(scale >= 1.0f)) {
+        return false;
+    }
+
+    source.width = wl_shm_buffer_get_width(buffer);
+    source.height = wl_shm_buffer_get_height(buffer);
+    source.stride = wl_shm_buffer_get_stride(buffer);
+
+    if (filter == WESTFIELD_DOWNSCALE_BOX) {
+        box_scale = (int32_t) lroundf(scale);
+        downscaled->width = (source.width + box_scale - 1) / box_scale;
+        downscaled->height = (source.height + box_scale - 1) / box_scale;
+    } else if (filter == WESTFIELD_DOWNSCALE_BILINEAR) {
+        downscaled->width = (int32_t) lroundf((float) source.width / scale);
+        downscaled->height = (int32_t) lroundf((float) source.height / scale);
+        downscaled->width = downscaled->width > 0 ? downscaled->width : 1;
+        downscaled->height = downscaled->height > 0 ? downscaled->height : 1;
+    } else {
+        return false;
+    }
+
+    downscaled->rects = calloc(damage_count ? damage_count : 1, sizeof(*downscaled->rects));
+    if (downscaled->rects == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < damage_count; i++) {
+        float effective_scale = box_scale ? (float) box_scale : scale;
+        int32_t x0 = (int32_t) floorf((float) damage[i].x / effective_scale);
+        int32_t y0 = (int32_t) floorf((float) damage[i].y / effective_scale);
+        // widened, damage comes from the client and the sums can overflow
+        float fx1 = ceilf((float) ((int64_t) damage[i].x + damage[i].width) / effective_scale);
+        float fy1 = ceilf((float) ((int64_t) damage[i].y + damage[i].height) / effective_scale);
+        int32_t x1 = fx1 > (float) downscaled->width ? downscaled->width : (int32_t) fx1;
+        int32_t y1 = fy1 > (float) downscaled->height ? downscaled->height : (int32_t) fy1;
+        struct westfield_rect *rect;
+
+        x0 = x0 < 0 ? 0 : x0;
+        y0 = y0 < 0 ? 0 : y0;
+        if (x0 >= x1 || y0 >= y1) {
+            continue;
+        }
+
+        rect = &downscaled->rects[downscaled->rect_count++];
+        rect->x = x0;
+        rect->y = y0;
+        rect->width = x1 - x0;
+        rect->height = y1 - y0;
+        pixel_count += (size_t) rect->width * rect->height;
+    }
+
+    downscaled->pixels_size = pixel_count * 4;
+    downscaled->pixels = malloc(downscaled->pixels_size ? downscaled->pixels_size : 1);
+    if (downscaled->pixels == NULL) {
+        westfield_downscaled_release(downscaled);
+        return false;
+    }
+
+    wl_shm_buffer_begin_access(buffer);
+    source.data = wl_shm_buffer_get_data(buffer);
+    dst = (uint32_t *) downscaled->pixels;
+    for (uint32_t i = 0; i < downscaled->rect_count; i++) {
+        const struct westfield_rect *rect = &downscaled->rects[i];
+
+        if (box_scale) {
+            box_rect(&source, box_scale, rect, dst);
+        } else {
+            bilinear_rect(&source, scale, rect, dst);
+        }
+        dst += (size_t) rect->width * rect->height;
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    return true;
+}
+
+void
+westfield_downscaled_release(struct westfield_downscaled *downscaled) {
+    free(downscaled->rects);
+    free(downscaled->pixels);
+    memset(downscaled, 0, sizeof(*downscaled));
+}
@@ -0,0 +1,41 @@
+#ifndef WESTFIELD_WESTFIELD_DOWNSCALE_H
+#define WESTFIELD_WESTFIELD_DOWNSCALE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+#include "westfield-util.h"
+
+enum westfield_downscale_filter {
+    // averages scale x scale blocks, scale is rounded to an integer. Exact and fastest for 2x HiDPI content.
+    WESTFIELD_DOWNSCALE_BOX = 0,
+    // samples the 4 nearest source pixels, works for fractional scales like 1.5
+    WESTFIELD_DOWNSCALE_BILINEAR = 1,
+};
+
+struct westfield_downscaled {
+    // size of the whole downscaled buffer
+    int32_t width, height;
+    // damaged regions in downscaled coordinates
+    struct westfield_rect *rects;
+    uint32_t rect_count;
+    // tightly packed 32-bit pixels of each rect, one after the other in rect order. Must be free()'d by the receiver.
+    uint8_t *pixels;
+    size_t pixels_size;
+};
+
+/**
+ * Downscale the damaged regions of an ARGB8888 or XRGB8888 shm buffer by scale (>= 1).
+ *
+ * Each damage rect is mapped to the smallest downscaled rect that covers it, so the result can be composited over the
+ * previously downscaled frame. Returns false if the format or scale is not supported or memory ran out.
+ */
+bool
+westfield_downscale_shm_buffer(struct wl_shm_buffer *buffer, enum westfield_downscale_filter filter, float scale,
+                               const struct westfield_rect *damage, uint32_t damage_count,
+                               struct westfield_downscaled *downscaled);
+
+void
+westfield_downscaled_release(struct westfield_downscaled *downscaled);
+
+#endif //WESTFIELD_WESTFIELD_DOWNSCALE_H
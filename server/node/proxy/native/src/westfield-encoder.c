@@ -0,0 +1,540 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#ifdef HAVE_X264
+#include <x264.h>
+#endif
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-encoder.h"
+#include "westfield-util.h"
+
+#define DEFAULT_BITRATE_KBPS 4000
+#define DEFAULT_KEYFRAME_INTERVAL 300
+#define DEFAULT_MAX_FRAMES_IN_FLIGHT 2
+
+struct westfield_encoder_job {
+    struct wl_list link;
+    int32_t width, height;
+    // tightly packed snapshot of the shm buffer, 4 bytes per pixel in B, G, R, X order
+    uint8_t *pixels;
+    struct westfield_encoded_frame frame;
+};
+
+struct westfield_encoder {
+    void *user_data;
+    westfield_encoder_frame_done_func_t frame_done_func;
+
+    int done_fd;
+    // NULL once the event loop is destroyed, frames can no longer be handed back after that
+    struct wl_event_source *done_source;
+    struct wl_listener loop_destroy_listener;
+
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    // state below is protected by mutex
+    struct westfield_encoder_config config;
+    // list of struct westfield_encoder_job
+    struct wl_list pending_jobs;
+    struct wl_list done_jobs;
+    bool quit;
+    bool force_keyframe;
+    bool bitrate_changed;
+
+    // state below is only touched on the event loop thread
+    uint32_t frames_in_flight;
+    bool dispatching;
+    bool destroy_pending;
+
+    // state below is only touched by the worker thread
+#ifdef HAVE_X264
+    x264_t *x264;
+    x264_picture_t picture;
+#endif
+    int32_t encoder_width, encoder_height;
+    int64_t pts;
+};
+
+static inline uint8_t
+rgb_to_y(int r, int g, int b) {
+    return (uint8_t) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t
+rgb_to_u(int r, int g, int b) {
+    return (uint8_t) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t
+rgb_to_v(int r, int g, int b) {
+    return (uint8_t) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+/*
+ * BT.601 limited range conversion. The destination planes have even dimensions of at least width x height, source
+ * pixels are edge-replicated to fill them.
+ */
+static void
+bgrx_to_i420(const uint8_t *bgrx, int32_t width, int32_t height,
+             uint8_t *y_plane, int y_stride,
+             uint8_t *u_plane, int u_stride,
+             uint8_t *v_plane, int v_stride,
+             int32_t plane_width, int32_t plane_height) {
+    const int src_stride = width * 4;
+
+    for (int32_t y = 0; y < plane_height; y += 2) {
+        const uint8_t *rows[2] = {
+                bgrx + (y < height ? y : height - 1) * src_stride,
+                bgrx + (y + 1 < height ? y + 1 : height - 1) * src_stride,
+        };
+        uint8_t *y_rows[2] = {y_plane + y * y_stride, y_plane + (y + 1) * y_stride};
+        uint8_t *u_row = u_plane + (y / 2) * u_stride;
+        uint8_t *v_row = v_plane + (y / 2) * v_stride;
+
+        for (int32_t x = 0; x < plane_width; x += 2) {
+            const int xs[2] = {(x < width ? x : width - 1) * 4, (x + 1 < width ? x + 1 : width - 1) * 4};
+            int r_sum = 0, g_sum = 0, b_sum = 0;
+
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    const uint8_t *pixel = rows[dy] + xs[dx];
+                    const int b = pixel[0], g = pixel[1], r = pixel[2];
+
+                    y_rows[dy][x + dx] = rgb_to_y(r, g, b);
+                    r_sum += r;
+                    g_sum += g;
+                    b_sum += b;
+                }
+            }
+
+            u_row[x / 2] = rgb_to_u((r_sum + 2) >> 2, (g_sum + 2) >> 2, (b_sum + 2) >> 2);
+            v_row[x / 2] = rgb_to_v((r_sum + 2) >> 2, (g_sum + 2) >> 2, (b_sum + 2) >> 2);
+        }
+    }
+}
+
+#ifdef HAVE_X264
+static void
+encoder_close_x264(struct westfield_encoder *encoder) {
+    if (encoder->x264 == NULL) {
+        return;
+    }
+
+    x264_picture_clean(&encoder->picture);
+    x264_encoder_close(encoder->x264);
+    encoder->x264 = NULL;
+    encoder->encoder_width = 0;
+    encoder->encoder_height = 0;
+}
+
+static void
+encoder_apply_bitrate(x264_param_t *param, uint32_t bitrate_kbps) {
+    param->rc.i_rc_method = X264_RC_ABR;
+    param->rc.i_bitrate = (int) bitrate_kbps;
+    param->rc.i_vbv_max_bitrate = (int) bitrate_kbps;
+    param->rc.i_vbv_buffer_size = (int) bitrate_kbps;
+}
+
+static bool
+encoder_open_x264(struct westfield_encoder *encoder, int32_t width, int32_t height,
+                  uint32_t bitrate_kbps, uint32_t keyframe_interval) {
+    x264_param_t param;
+
+    if (x264_param_default_preset(&param, "ultrafast", "zerolatency") < 0) {
+        return false;
+    }
+
+    param.i_csp = X264_CSP_I420;
+    param.i_width = width;
+    param.i_height = height;
+    param.i_threads = 1;
+    param.i_fps_num = 60;
+    param.i_fps_den = 1;
+    param.i_keyint_max = (int) keyframe_interval;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    encoder_apply_bitrate(&param, bitrate_kbps);
+
+    if (x264_param_apply_profile(&param, "baseline") < 0) {
+        return false;
+    }
+
+    encoder->x264 = x264_encoder_open(&param);
+    if (encoder->x264 == NULL) {
+        return false;
+    }
+
+    if (x264_picture_alloc(&encoder->picture, X264_CSP_I420, width, height) < 0) {
+        x264_encoder_close(encoder->x264);
+        encoder->x264 = NULL;
+        return false;
+    }
+
+    encoder->encoder_width = width;
+    encoder->encoder_height = height;
+
+    return true;
+}
+
+static void
+encoder_encode_job(struct westfield_encoder *encoder, struct westfield_encoder_job *job,
+                   bool force_keyframe, uint32_t bitrate_kbps, bool bitrate_changed,
+                   uint32_t keyframe_interval) {
+    // I420 needs even dimensions
+    const int32_t width = (job->width + 1) & ~1, height = (job->height + 1) & ~1;
+    x264_picture_t picture_out;
+    x264_param_t param;
+    x264_nal_t *nals;
+    int nal_count, frame_size;
+
+    if (encoder->x264 && (encoder->encoder_width != width || encoder->encoder_height != height)) {
+        encoder_close_x264(encoder);
+    }
+
+    if (encoder->x264 == NULL) {
+        if (!encoder_open_x264(encoder, width, height, bitrate_kbps, keyframe_interval)) {
+            wfl_log(stderr, "Failed to open x264 encoder for %dx%d.", width, height);
+            return;
+        }
+        force_keyframe = true;
+    } else if (bitrate_changed) {
+        x264_encoder_parameters(encoder->x264, &param);
+        encoder_apply_bitrate(&param, bitrate_kbps);
+        x264_encoder_reconfig(encoder->x264, &param);
+    }
+
+    bgrx_to_i420(job->pixels, job->width, job->height,
+                 encoder->picture.img.plane[0], encoder->picture.img.i_stride[0],
+                 encoder->picture.img.plane[1], encoder->picture.img.i_stride[1],
+                 encoder->picture.img.plane[2], encoder->picture.img.i_stride[2],
+                 width, height);
+
+    encoder->picture.i_pts = encoder->pts++;
+    encoder->picture.i_type = force_keyframe ? X264_TYPE_IDR : X264_TYPE_AUTO;
+
+    frame_size = x264_encoder_encode(encoder->x264, &nals, &nal_count, &encoder->picture, &picture_out);
+    if (frame_size <= 0) {
+        return;
+    }
+
+    // nal payloads are guaranteed to be sequential in memory
+    job->frame.data = malloc((size_t) frame_size);
+    if (job->frame.data == NULL) {
+        return;
+    }
+    memcpy(job->frame.data, nals[0].p_payload, (size_t) frame_size);
+    job->frame.size = (size_t) frame_size;
+    job->frame.keyframe = picture_out.b_keyframe;
+}
+#else
+
+static void
+encoder_encode_job(struct westfield_encoder *encoder, struct westfield_encoder_job *job,
+                   bool force_keyframe, uint32_t bitrate_kbps, bool bitrate_changed,
+                   uint32_t keyframe_interval) {
+    // not reached, westfield_encoder_create fails without a software encoder
+    (void) encoder;
+    (void) job;
+    (void) force_keyframe;
+    (void) bitrate_kbps;
+    (void) bitrate_changed;
+    (void) keyframe_interval;
+}
+
+#endif
+
+static void *
+encoder_worker(void *data) {
+    struct westfield_encoder *encoder = data;
+    struct westfield_encoder_job *job;
+    bool force_keyframe, bitrate_changed;
+    uint32_t bitrate_kbps, keyframe_interval;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&encoder->mutex);
+    while (true) {
+        while (!encoder->quit && wl_list_empty(&encoder->pending_jobs)) {
+            pthread_cond_wait(&encoder->cond, &encoder->mutex);
+        }
+        if (encoder->quit) {
+            break;
+        }
+
+        job = wl_container_of(encoder->pending_jobs.next, job, link);
+        wl_list_remove(&job->link);
+        force_keyframe = encoder->force_keyframe;
+        encoder->force_keyframe = false;
+        bitrate_changed = encoder->bitrate_changed;
+        encoder->bitrate_changed = false;
+        bitrate_kbps = encoder->config.bitrate_kbps;
+        keyframe_interval = encoder->config.keyframe_interval;
+        pthread_mutex_unlock(&encoder->mutex);
+
+        encoder_encode_job(encoder, job, force_keyframe, bitrate_kbps, bitrate_changed, keyframe_interval);
+        free(job->pixels);
+        job->pixels = NULL;
+
+        pthread_mutex_lock(&encoder->mutex);
+        wl_list_insert(encoder->done_jobs.prev, &job->link);
+        if (write(encoder->done_fd, &one, sizeof(one)) < 0) {
+            wfl_log_errno(stderr, "Failed to signal encoded frame");
+        }
+    }
+    pthread_mutex_unlock(&encoder->mutex);
+
+#ifdef HAVE_X264
+    encoder_close_x264(encoder);
+#endif
+
+    return NULL;
+}
+
+static void
+encoder_free_jobs(struct wl_list *jobs) {
+    struct westfield_encoder_job *job, *tmp;
+
+    wl_list_for_each_safe(job, tmp, jobs, link) {
+        wl_list_remove(&job->link);
+        free(job->pixels);
+        free(job->frame.data);
+        free(job);
+    }
+}
+
+static void
+encoder_finalize(struct westfield_encoder *encoder) {
+    pthread_mutex_lock(&encoder->mutex);
+    encoder->quit = true;
+    pthread_cond_signal(&encoder->cond);
+    pthread_mutex_unlock(&encoder->mutex);
+    pthread_join(encoder->worker, NULL);
+
+    encoder_free_jobs(&encoder->pending_jobs);
+    encoder_free_jobs(&encoder->done_jobs);
+
+    wl_list_remove(&encoder->loop_destroy_listener.link);
+    if (encoder->done_source) {
+        wl_event_source_remove(encoder->done_source);
+    }
+    close(encoder->done_fd);
+    pthread_cond_destroy(&encoder->cond);
+    pthread_mutex_destroy(&encoder->mutex);
+    free(encoder);
+}
+
+static int
+encoder_handle_frames_done(int fd, uint32_t mask, void *data) {
+    struct westfield_encoder *encoder = data;
+    struct westfield_encoder_job *job, *tmp;
+    struct wl_list done_jobs;
+    uint64_t count;
+
+    (void) mask;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        return 0;
+    }
+
+    wl_list_init(&done_jobs);
+    pthread_mutex_lock(&encoder->mutex);
+    wl_list_insert_list(&done_jobs, &encoder->done_jobs);
+    wl_list_init(&encoder->done_jobs);
+    pthread_mutex_unlock(&encoder->mutex);
+
+    // the frame done callback is allowed to destroy the encoder
+    encoder->dispatching = true;
+    wl_list_for_each_safe(job, tmp, &done_jobs, link) {
+        wl_list_remove(&job->link);
+        encoder->frames_in_flight--;
+        if (!encoder->destroy_pending) {
+            encoder->frame_done_func(encoder->user_data, &job->frame);
+        } else {
+            free(job->frame.data);
+        }
+        free(job);
+    }
+    encoder->dispatching = false;
+
+    if (encoder->destroy_pending) {
+        encoder_finalize(encoder);
+    }
+
+    return 0;
+}
+
+static void
+encoder_handle_loop_destroyed(struct wl_listener *listener, void *data) {
+    struct westfield_encoder *encoder = wl_container_of(listener, encoder, loop_destroy_listener);
+
+    (void) data;
+
+    // sources have to be removed before their loop is destroyed, the encoder itself lives on until it is destroyed
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+    wl_event_source_remove(encoder->done_source);
+    encoder->done_source = NULL;
+}
+
+struct westfield_encoder *
+westfield_encoder_create(struct wl_event_loop *loop,
+                         const struct westfield_encoder_config *config,
+                         void *user_data,
+                         westfield_encoder_frame_done_func_t frame_done_func) {
+#ifndef HAVE_X264
+    (void) loop;
+    (void) config;
+    (void) user_data;
+    (void) frame_done_func;
+    wfl_log(stderr, "Westfield was built without a software video encoder, video encoding disabled.");
+    errno = ENOTSUP;
+    return NULL;
+#else
+    struct westfield_encoder *encoder;
+
+    encoder = calloc(1, sizeof(*encoder));
+    if (encoder == NULL) {
+        return NULL;
+    }
+
+    encoder->user_data = user_data;
+    encoder->frame_done_func = frame_done_func;
+    encoder->config.bitrate_kbps = config->bitrate_kbps ? config->bitrate_kbps : DEFAULT_BITRATE_KBPS;
+    encoder->config.keyframe_interval = config->keyframe_interval ? config->keyframe_interval
+                                                                  : DEFAULT_KEYFRAME_INTERVAL;
+    encoder->config.max_frames_in_flight = config->max_frames_in_flight ? config->max_frames_in_flight
+                                                                        : DEFAULT_MAX_FRAMES_IN_FLIGHT;
+    wl_list_init(&encoder->pending_jobs);
+    wl_list_init(&encoder->done_jobs);
+
+    encoder->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (encoder->done_fd < 0) {
+        wfl_log_errno(stderr, "Failed to create encoder eventfd");
+        goto err_free;
+    }
+
+    encoder->done_source = wl_event_loop_add_fd(loop, encoder->done_fd, WL_EVENT_READABLE,
+                                                encoder_handle_frames_done, encoder);
+    if (encoder->done_source == NULL) {
+        goto err_close;
+    }
+    encoder->loop_destroy_listener.notify = encoder_handle_loop_destroyed;
+    wl_event_loop_add_destroy_listener(loop, &encoder->loop_destroy_listener);
+
+    pthread_mutex_init(&encoder->mutex, NULL);
+    pthread_cond_init(&encoder->cond, NULL);
+    if (pthread_create(&encoder->worker, NULL, encoder_worker, encoder) != 0) {
+        wfl_log(stderr, "Failed to start encoder worker thread.");
+        pthread_cond_destroy(&encoder->cond);
+        pthread_mutex_destroy(&encoder->mutex);
+        goto err_source;
+    }
+
+    return encoder;
+
+    err_source:
+    wl_list_remove(&encoder->loop_destroy_listener.link);
+    wl_event_source_remove(encoder->done_source);
+    err_close:
+    close(encoder->done_fd);
+    err_free:
+    free(encoder);
+    return NULL;
+#endif
+}
+
+void
+westfield_encoder_destroy(struct westfield_encoder *encoder) {
+    if (encoder->dispatching) {
+        encoder->destroy_pending = true;
+        return;
+    }
+
+    encoder_finalize(encoder);
+}
+
+bool
+westfield_encoder_encode_shm_buffer(struct westfield_encoder *encoder, struct wl_shm_buffer *buffer,
+                                    uint32_t serial) {
+    struct westfield_encoder_job *job;
+    int32_t width, height, stride;
+    uint32_t format;
+    const uint8_t *data;
+
+    format = wl_shm_buffer_get_format(buffer);
+    if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+        return false;
+    }
+
+    if (encoder->destroy_pending || encoder->done_source == NULL ||
+        encoder->frames_in_flight >= encoder->config.max_frames_in_flight) {
+        return false;
+    }
+
+    width = wl_shm_buffer_get_width(buffer);
+    height = wl_shm_buffer_get_height(buffer);
+    stride = wl_shm_buffer_get_stride(buffer);
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        return false;
+    }
+    job->pixels = malloc((size_t) width * 4 * height);
+    if (job->pixels == NULL) {
+        free(job);
+        return false;
+    }
+    job->width = width;
+    job->height = height;
+    job->frame.serial = serial;
+    job->frame.width = width;
+    job->frame.height = height;
+
+    // Take a snapshot so the client can reuse the buffer as soon as it's released.
+    wl_shm_buffer_begin_access(buffer);
+    data = wl_shm_buffer_get_data(buffer);
+    for (int32_t y = 0; y < height; y++) {
+        memcpy(job->pixels + (size_t) y * width * 4, data + (size_t) y * stride, (size_t) width * 4);
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    pthread_mutex_lock(&encoder->mutex);
+    wl_list_insert(encoder->pending_jobs.prev, &job->link);
+    pthread_cond_signal(&encoder->cond);
+    pthread_mutex_unlock(&encoder->mutex);
+
+    encoder->frames_in_flight++;
+
+    return true;
+}
+
+void
+westfield_encoder_request_keyframe(struct westfield_encoder *encoder) {
+    pthread_mutex_lock(&encoder->mutex);
+    encoder->force_keyframe = true;
+    pthread_mutex_unlock(&encoder->mutex);
+}
+
+void
+westfield_encoder_set_bitrate(struct westfield_encoder *encoder, uint32_t bitrate_kbps) {
+    if (bitrate_kbps == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&encoder->mutex);
+    if (encoder->config.bitrate_kbps != bitrate_kbps) {
+        encoder->config.bitrate_kbps = bitrate_kbps;
+        encoder->bitrate_changed = true;
+    }
+    pthread_mutex_unlock(&encoder->mutex);
+}
+
+uint32_t
+westfield_encoder_get_frames_in_flight(struct westfield_encoder *encoder) {
+    return encoder->frames_in_flight;
+}
@@ -0,0 +1,70 @@
+#ifndef WESTFIELD_WESTFIELD_ENCODER_H
+#define WESTFIELD_WESTFIELD_ENCODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "wayland-server/wayland-server-core.h"
+
+/**
+ * A per-surface software video encoder session.
+ *
+ * Committed shm buffers are snapshotted on the calling thread, converted from RGB to I420 and encoded on a worker
+ * thread owned by the session. Encoded frames are handed back on the event loop the session was created with, so the
+ * frame done callback always runs on the same thread that dispatches the wl_display.
+ *
+ * A session can outlive its event loop. It stops accepting frames once the loop is destroyed, but still has to be
+ * destroyed with westfield_encoder_destroy.
+ */
+struct westfield_encoder;
+
+struct westfield_encoder_config {
+    uint32_t bitrate_kbps;
+    uint32_t keyframe_interval;
+    // maximum number of frames that can be queued or encoding before new frames are rejected
+    uint32_t max_frames_in_flight;
+};
+
+struct westfield_encoded_frame {
+    uint32_t serial;
+    int32_t width, height;
+    bool keyframe;
+    // Annex B H.264 bitstream, owned by the receiver of the frame. NULL if encoding failed.
+    uint8_t *data;
+    size_t size;
+};
+
+/**
+ * Called on the event loop thread for every frame accepted by westfield_encoder_encode_shm_buffer, in submission
+ * order. The callee takes ownership of frame->data and must free() it.
+ */
+typedef void (*westfield_encoder_frame_done_func_t)(void *user_data, struct westfield_encoded_frame *frame);
+
+struct westfield_encoder *
+westfield_encoder_create(struct wl_event_loop *loop,
+                         const struct westfield_encoder_config *config,
+                         void *user_data,
+                         westfield_encoder_frame_done_func_t frame_done_func);
+
+void
+westfield_encoder_destroy(struct westfield_encoder *encoder);
+
+/**
+ * Snapshot the contents of an ARGB8888 or XRGB8888 shm buffer and queue it for encoding.
+ *
+ * Returns false if the buffer format is not supported, if the frames in flight limit is reached or if the event loop
+ * is gone, in which case no frame done callback will follow for this serial.
+ */
+bool
+westfield_encoder_encode_shm_buffer(struct westfield_encoder *encoder, struct wl_shm_buffer *buffer, uint32_t serial);
+
+void
+westfield_encoder_request_keyframe(struct westfield_encoder *encoder);
+
+void
+westfield_encoder_set_bitrate(struct westfield_encoder *encoder, uint32_t bitrate_kbps);
+
+uint32_t
+westfield_encoder_get_frames_in_flight(struct westfield_encoder *encoder);
+
+#endif //WESTFIELD_WESTFIELD_ENCODER_H
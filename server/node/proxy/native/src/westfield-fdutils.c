@@ -27,6 +27,7 @@
 #define _GNU_SOURCE
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -82,3 +83,44 @@ westfield_os_create_anonymous_file(size_t size) {
 
     return fd;
 }
+
+int
+westfield_os_write_all(int fd, const void *contents, size_t size) {
+    const char *data = contents;
+    ssize_t written;
+
+    while (size > 0) {
+        written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+
+        data += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+int
+westfield_os_create_sealed_file(const void *contents, size_t size) {
+#ifdef MFD_ALLOW_SEALING
+    int fd;
+
+    fd = memfd_create("westfield-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+
+    if (westfield_os_write_all(fd, contents, size) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
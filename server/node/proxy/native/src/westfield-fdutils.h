@@ -6,4 +6,15 @@
 int
 westfield_os_create_anonymous_file(size_t size);
 
+int
+westfield_os_write_all(int fd, const void *contents, size_t size);
+
+/**
+ * Create a memfd holding contents, sealed against writing, shrinking and growing. The returned fd can be mapped by any
+ * number of clients without them being able to change it or make it SIGBUS the others. Returns -1 if memfd or sealing
+ * is not supported.
+ */
+int
+westfield_os_create_sealed_file(const void *contents, size_t size);
+
 #endif //WESTFIELD_WESTFIELD_FDUTILS_H
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <string.h>
+
+#include "westfield-hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t
+hash_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= hash_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static inline uint64_t
+hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t
+hash_merge_lanes(uint64_t v1, uint64_t v2, uint64_t v3, uint64_t v4) {
+    uint64_t h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = hash_merge_round(h, v1);
+    h = hash_merge_round(h, v2);
+    h = hash_merge_round(h, v3);
+    h = hash_merge_round(h, v4);
+    return h;
+}
+
+static uint64_t
+hash_finalize(uint64_t h, const uint8_t *p, size_t size) {
+    const uint8_t *end = p + size;
+
+    while (p + 8 <= end) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    return hash_avalanche(h);
+}
+
+uint64_t
+westfield_hash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        const uint8_t *limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = hash_merge_lanes(v1, v2, v3, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t) size;
+
+    return hash_finalize(h, p, end - p);
+}
+
+void
+westfield_hash64_reset(struct westfield_hash64_state *state, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v1 = seed + PRIME64_1 + PRIME64_2;
+    state->v2 = seed + PRIME64_2;
+    state->v3 = seed;
+    state->v4 = seed - PRIME64_1;
+}
+
+void
+westfield_hash64_update(struct westfield_hash64_state *state, const void *data, size_t size) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+
+    state->total_size += size;
+
+    if (state->buffer_size + size < 32) {
+        memcpy(state->buffer + state->buffer_size, p, size);
+        state->buffer_size += size;
+        return;
+    }
+
+    if (state->buffer_size) {
+        size_t fill = 32 - state->buffer_size;
+        memcpy(state->buffer + state->buffer_size, p, fill);
+        state->v1 = hash_round(state->v1, read64(state->buffer));
+        state->v2 = hash_round(state->v2, read64(state->buffer + 8));
+        state->v3 = hash_round(state->v3, read64(state->buffer + 16));
+        state->v4 = hash_round(state->v4, read64(state->buffer + 24));
+        p += fill;
+        state->buffer_size = 0;
+    }
+
+    while (p + 32 <= end) {
+        state->v1 = hash_round(state->v1, read64(p));
+        state->v2 = hash_round(state->v2, read64(p + 8));
+        state->v3 = hash_round(state->v3, read64(p + 16));
+        state->v4 = hash_round(state->v4, read64(p + 24));
+        p += 32;
+    }
+
+    if (p < end) {
+        memcpy(state->buffer, p, end - p);
+        state->buffer_size = end - p;
+    }
+}
+
+uint64_t
+westfield_hash64_digest(const struct westfield_hash64_state *state) {
+    uint64_t h;
+
+    if (state->total_size >= 32) {
+        h = hash_merge_lanes(state->v1, state->v2, state->v3, state->v4);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+
+    h += state->total_size;
+
+    return hash_finalize(h, state->buffer, state->buffer_size);
+}
@@ -0,0 +1,35 @@
+#ifndef WESTFIELD_WESTFIELD_HASH_H
+#define WESTFIELD_WESTFIELD_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * XXH64 of a block of memory. Fast enough to hash every row of a committed buffer and well distributed enough to use
+ * as a content key, but not a cryptographic hash: callers that act on a match must be prepared for collisions.
+ */
+uint64_t
+westfield_hash64(const void *data, size_t size, uint64_t seed);
+
+/**
+ * Streaming variant of westfield_hash64, for data that isn't contiguous in memory like the rows of a buffer with
+ * padding between them. Feeding the same bytes in any number of updates yields the same digest as westfield_hash64.
+ */
+struct westfield_hash64_state {
+    uint64_t total_size;
+    uint64_t v1, v2, v3, v4;
+    uint8_t buffer[32];
+    uint32_t buffer_size;
+    uint64_t seed;
+};
+
+void
+westfield_hash64_reset(struct westfield_hash64_state *state, uint64_t seed);
+
+void
+westfield_hash64_update(struct westfield_hash64_state *state, const void *data, size_t size);
+
+uint64_t
+westfield_hash64_digest(const struct westfield_hash64_state *state);
+
+#endif //WESTFIELD_WESTFIELD_HASH_H
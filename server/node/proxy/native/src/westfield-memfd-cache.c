@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "wayland-server/wayland-util.h"
+#include "westfield-memfd-cache.h"
+#include "westfield-fdutils.h"
+#include "westfield-hash.h"
+
+// distinct payloads are few (a keymap per layout), this only guards against unbounded growth
+#define MAX_ENTRIES 16
+
+struct cache_entry {
+    // link in cache_lru, most recently used first
+    struct wl_list link;
+    uint64_t hash;
+    size_t size;
+    int fd;
+    // read-only mapping of fd, to tell hash collisions apart
+    void *data;
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct wl_list cache_lru = {&cache_lru, &cache_lru};
+static int cache_entry_count;
+
+static void
+destroy_entry(struct cache_entry *entry) {
+    wl_list_remove(&entry->link);
+    if (entry->size) {
+        munmap(entry->data, entry->size);
+    }
+    close(entry->fd);
+    free(entry);
+    cache_entry_count--;
+}
+
+static struct cache_entry *
+find_entry(uint64_t hash, const void *contents, size_t size) {
+    struct cache_entry *entry;
+
+    wl_list_for_each(entry, &cache_lru, link) {
+        if (entry->hash == hash && entry->size == size && (size == 0 || memcmp(entry->data, contents, size) == 0)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static struct cache_entry *
+create_entry(uint64_t hash, const void *contents, size_t size) {
+    struct cache_entry *entry, *oldest;
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->fd = westfield_os_create_sealed_file(contents, size);
+    if (entry->fd < 0) {
+        free(entry);
+        return NULL;
+    }
+
+    if (size) {
+        entry->data = mmap(NULL, size, PROT_READ, MAP_SHARED, entry->fd, 0);
+        if (entry->data == MAP_FAILED) {
+            close(entry->fd);
+            free(entry);
+            return NULL;
+        }
+    }
+    entry->hash = hash;
+    entry->size = size;
+
+    if (cache_entry_count == MAX_ENTRIES) {
+        oldest = wl_container_of(cache_lru.prev, oldest, link);
+        destroy_entry(oldest);
+    }
+    wl_list_insert(&cache_lru, &entry->link);
+    cache_entry_count++;
+
+    return entry;
+}
+
+static int
+create_uncached(const void *contents, size_t size) {
+    int fd;
+
+    fd = westfield_os_create_anonymous_file(size);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (westfield_os_write_all(fd, contents, size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+westfield_memfd_cache_get(const void *contents, size_t size) {
+    uint64_t hash = westfield_hash64(contents, size, 0);
+    struct cache_entry *entry;
+    int fd = -1;
+
+    pthread_mutex_lock(&cache_mutex);
+    entry = find_entry(hash, contents, size);
+    if (entry == NULL) {
+        entry = create_entry(hash, contents, size);
+    }
+    if (entry) {
+        wl_list_remove(&entry->link);
+        wl_list_insert(&cache_lru, &entry->link);
+        // sealed, so sharing the open file description with the cache is harmless
+        fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (entry == NULL) {
+        fd = create_uncached(contents, size);
+    }
+
+    return fd;
+}
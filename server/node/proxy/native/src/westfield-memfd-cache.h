@@ -0,0 +1,17 @@
+#ifndef WESTFIELD_WESTFIELD_MEMFD_CACHE_H
+#define WESTFIELD_WESTFIELD_MEMFD_CACHE_H
+
+#include <stddef.h>
+
+/**
+ * Return an fd holding a read-only copy of contents, to be sent to a client.
+ *
+ * Identical contents, like the XKB keymap every client gets, share one sealed memfd: the first call creates it and
+ * later calls return a duplicate of the cached fd, so connecting clients cost neither a new file nor a copy. The caller
+ * owns the returned fd and must close it. Falls back to an uncached file in XDG_RUNTIME_DIR if memfds can't be sealed.
+ * Safe to call from any thread. Returns -1 on failure.
+ */
+int
+westfield_memfd_cache_get(const void *contents, size_t size);
+
+#endif //WESTFIELD_WESTFIELD_MEMFD_CACHE_H
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-pixel-cache.h"
+#include "westfield-hash.h"
+
+#define INITIAL_BUCKETS 256
+
+struct cache_entry {
+    // link in westfield_pixel_cache::lru, most recently used first
+    struct wl_list link;
+    // next entry in the same bucket
+    struct cache_entry *next;
+    uint64_t hash;
+    uint64_t size;
+};
+
+struct westfield_pixel_cache {
+    struct cache_entry **buckets;
+    uint32_t bucket_count;
+    struct wl_list lru;
+    // uint64_t hashes evicted but not yet taken
+    struct wl_array evicted;
+    struct westfield_pixel_cache_stats stats;
+};
+
+static struct cache_entry **
+find_entry(struct westfield_pixel_cache *cache, uint64_t hash) {
+    struct cache_entry **entry = &cache->buckets[hash & (cache->bucket_count - 1)];
+
+    while (*entry && (*entry)->hash != hash) {
+        entry = &(*entry)->next;
+    }
+    return entry;
+}
+
+static void
+remove_entry(struct westfield_pixel_cache *cache, struct cache_entry **slot) {
+    struct cache_entry *entry = *slot;
+
+    *slot = entry->next;
+    wl_list_remove(&entry->link);
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->size;
+    free(entry);
+}
+
+static void
+grow_buckets(struct westfield_pixel_cache *cache) {
+    uint32_t bucket_count = cache->bucket_count * 2;
+    struct cache_entry **buckets, *entry;
+
+    buckets = calloc(bucket_count, sizeof(*buckets));
+    if (buckets == NULL) {
+        // keep using the current buckets, chains just get longer
+        return;
+    }
+
+    wl_list_for_each(entry, &cache->lru, link) {
+        struct cache_entry **bucket = &buckets[entry->hash & (bucket_count - 1)];
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+static void
+evict(struct westfield_pixel_cache *cache) {
+    while (cache->stats.bytes > cache->stats.max_bytes && !wl_list_empty(&cache->lru)) {
+        struct cache_entry *entry = wl_container_of(cache->lru.prev, entry, link);
+        uint64_t *evicted_hash = wl_array_add(&cache->evicted, sizeof(*evicted_hash));
+
+        if (evicted_hash) {
+            *evicted_hash = entry->hash;
+        }
+        cache->stats.evictions++;
+        remove_entry(cache, find_entry(cache, entry->hash));
+    }
+}
+
+struct westfield_pixel_cache *
+westfield_pixel_cache_create(uint64_t max_bytes) {
+    struct westfield_pixel_cache *cache;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->buckets = calloc(INITIAL_BUCKETS, sizeof(*cache->buckets));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->bucket_count = INITIAL_BUCKETS;
+    cache->stats.max_bytes = max_bytes;
+    wl_list_init(&cache->lru);
+    wl_array_init(&cache->evicted);
+
+    return cache;
+}
+
+void
+westfield_pixel_cache_destroy(struct westfield_pixel_cache *cache) {
+    struct cache_entry *entry, *next;
+
+    wl_list_for_each_safe(entry, next, &cache->lru, link) {
+        free(entry);
+    }
+    wl_array_release(&cache->evicted);
+    free(cache->buckets);
+    free(cache);
+}
+
+void
+westfield_pixel_cache_set_max_bytes(struct westfield_pixel_cache *cache, uint64_t max_bytes) {
+    cache->stats.max_bytes = max_bytes;
+    evict(cache);
+}
+
+bool
+westfield_pixel_cache_lookup_or_insert(struct westfield_pixel_cache *cache, uint64_t hash, uint64_t size) {
+    struct cache_entry **slot, *entry;
+
+    cache->stats.lookups++;
+
+    slot = find_entry(cache, hash);
+    if (*slot) {
+        cache->stats.hits++;
+        wl_list_remove(&(*slot)->link);
+        wl_list_insert(&cache->lru, &(*slot)->link);
+        return true;
+    }
+
+    if (size > cache->stats.max_bytes) {
+        return false;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return false;
+    }
+    entry->hash = hash;
+    entry->size = size;
+    *slot = entry;
+    wl_list_insert(&cache->lru, &entry->link);
+    cache->stats.entries++;
+    cache->stats.bytes += size;
+
+    evict(cache);
+    if (cache->stats.entries > cache->bucket_count) {
+        grow_buckets(cache);
+    }
+
+    return false;
+}
+
+void
+westfield_pixel_cache_remove(struct westfield_pixel_cache *cache, uint64_t hash) {
+    struct cache_entry **slot = find_entry(cache, hash);
+
+    if (*slot) {
+        remove_entry(cache, slot);
+    }
+}
+
+void
+westfield_pixel_cache_take_evicted(struct westfield_pixel_cache *cache, struct wl_array *evicted) {
+    *evicted = cache->evicted;
+    wl_array_init(&cache->evicted);
+}
+
+void
+westfield_pixel_cache_get_stats(struct westfield_pixel_cache *cache, struct westfield_pixel_cache_stats *stats) {
+    *stats = cache->stats;
+}
+
+bool
+westfield_pixel_cache_hash_shm_buffer(struct wl_shm_buffer *buffer, const struct westfield_rect *region,
+                                      uint64_t *hash, uint64_t *size) {
+    struct westfield_hash64_state state;
+    struct westfield_rect whole;
+    int32_t width, height, stride;
+    uint32_t format, header[3];
+    const uint8_t *data;
+
+    format = wl_shm_buffer_get_format(buffer);
+    if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+        return false;
+    }
+
+    width = wl_shm_buffer_get_width(buffer);
+    height = wl_shm_buffer_get_height(buffer);
+    stride = wl_shm_buffer_get_stride(buffer);
+
+    if (region == NULL) {
+        whole.x = 0;
+        whole.y = 0;
+        whole.width = width;
+        whole.height = height;
+        region = &whole;
+    }
+
+    if (region->x < 0 || region->y < 0 || region->width <= 0 || region->height <= 0 ||
+        region->width > width - region->x || region->height > height - region->y) {
+        return false;
+    }
+
+    header[0] = format;
+    header[1] = region->width;
+    header[2] = region->height;
+    westfield_hash64_reset(&state, 0);
+    westfield_hash64_update(&state, header, sizeof(header));
+
+    wl_shm_buffer_begin_access(buffer);
+    data = wl_shm_buffer_get_data(buffer);
+    for (int32_t y = region->y; y < region->y + region->height; y++) {
+        westfield_hash64_update(&state, data + (size_t) y * stride + (size_t) region->x * 4,
+                                (size_t) region->width * 4);
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    *hash = westfield_hash64_digest(&state);
+    *size = (uint64_t) region->width * region->height * 4;
+
+    return true;
+}
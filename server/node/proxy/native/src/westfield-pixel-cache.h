@@ -0,0 +1,73 @@
+#ifndef WESTFIELD_WESTFIELD_PIXEL_CACHE_H
+#define WESTFIELD_WESTFIELD_PIXEL_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "wayland-server/wayland-server-core.h"
+#include "westfield-util.h"
+
+/**
+ * Mirror of the pixel data the browser holds, keyed by content hash.
+ *
+ * The cache doesn't store pixels, only the hashes and sizes of what has been sent, so it can be shared by every client
+ * and surface of a display. Entries are kept in least recently used order. When the total size of the entries exceeds
+ * the memory cap, the least recently used entries are evicted and their hashes queued so the browser can be told to
+ * drop them as well.
+ */
+struct westfield_pixel_cache;
+
+struct westfield_pixel_cache_stats {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t max_bytes;
+};
+
+struct westfield_pixel_cache *
+westfield_pixel_cache_create(uint64_t max_bytes);
+
+void
+westfield_pixel_cache_destroy(struct westfield_pixel_cache *cache);
+
+/**
+ * Lower or raise the memory cap. Lowering it evicts entries right away.
+ */
+void
+westfield_pixel_cache_set_max_bytes(struct westfield_pixel_cache *cache, uint64_t max_bytes);
+
+/**
+ * Returns true if the hash is already held by the browser. Otherwise the hash is inserted, under the assumption that
+ * the caller sends the pixels next, and false is returned. Entries larger than the memory cap are never inserted.
+ */
+bool
+westfield_pixel_cache_lookup_or_insert(struct westfield_pixel_cache *cache, uint64_t hash, uint64_t size);
+
+/**
+ * Forget a hash, e.g. because the browser dropped the pixels on its own.
+ */
+void
+westfield_pixel_cache_remove(struct westfield_pixel_cache *cache, uint64_t hash);
+
+/**
+ * Move the hashes evicted since the last call to evicted, as uint64_t.
+ */
+void
+westfield_pixel_cache_take_evicted(struct westfield_pixel_cache *cache, struct wl_array *evicted);
+
+void
+westfield_pixel_cache_get_stats(struct westfield_pixel_cache *cache, struct westfield_pixel_cache_stats *stats);
+
+/**
+ * Hash the pixels of a region of an ARGB8888 or XRGB8888 shm buffer. The buffer format and region size are part of the
+ * hash, so equal bytes in a different layout don't collide. A NULL region hashes the whole buffer.
+ *
+ * Returns false if the format is not supported or if the region doesn't lie within the buffer.
+ */
+bool
+westfield_pixel_cache_hash_shm_buffer(struct wl_shm_buffer *buffer, const struct westfield_rect *region,
+                                      uint64_t *hash, uint64_t *size);
+
+#endif //WESTFIELD_WESTFIELD_PIXEL_CACHE_H
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "westfield-quality.h"
+
+#define INTERVAL_MS 250.0
+#define BANDWIDTH_EMA_WEIGHT 0.25
+#define LATENCY_EMA_WEIGHT 0.125
+// how long the baseline (minimum) latency is trusted before it's allowed to creep up again
+#define BASELINE_LATENCY_WINDOW_MS 10000.0
+
+// latency above baseline * factor + slack means frames are queueing up somewhere
+#define CONGESTION_LATENCY_FACTOR 1.5
+#define CONGESTION_LATENCY_SLACK_MS 20.0
+// unacknowledged data worth more than this much time at the estimated bandwidth means the link can't keep up
+#define CONGESTION_IN_FLIGHT_MS 200.0
+
+#define DECREASE_FACTOR 0.7
+#define INCREASE_STEP_FRACTION 0.05
+// when congested, leave headroom below the measured bandwidth for input events and protocol traffic
+#define BANDWIDTH_HEADROOM 0.85
+
+#define MAX_COMPRESSION_LEVEL 9
+#define MIN_FPS 5
+#define FPS_STEP 5
+
+#define DEFAULT_MIN_BITRATE_KBPS 250
+#define DEFAULT_MAX_BITRATE_KBPS 20000
+#define DEFAULT_MAX_FPS 60
+
+struct westfield_quality_controller {
+    struct westfield_quality_config config;
+    struct westfield_quality_decision decision;
+
+    double interval_start_ms;
+    uint64_t interval_acked_bytes;
+    bool interval_started;
+
+    uint64_t sent_bytes;
+    uint64_t acked_bytes;
+
+    bool have_bandwidth;
+    bool have_latency;
+    double baseline_latency_ms;
+    double baseline_latency_time_ms;
+};
+
+static uint64_t
+bytes_in_flight(const struct westfield_quality_controller *controller) {
+    return controller->sent_bytes > controller->acked_bytes ? controller->sent_bytes - controller->acked_bytes : 0;
+}
+
+static bool
+is_congested(const struct westfield_quality_controller *controller) {
+    const struct westfield_quality_decision *decision = &controller->decision;
+
+    if (controller->have_latency &&
+        decision->latency_ms > controller->baseline_latency_ms * CONGESTION_LATENCY_FACTOR + CONGESTION_LATENCY_SLACK_MS) {
+        return true;
+    }
+
+    // kbps is bits per ms, so this is the number of bytes the link drains in CONGESTION_IN_FLIGHT_MS
+    if (controller->have_bandwidth &&
+        (double) decision->bytes_in_flight > decision->bandwidth_kbps * CONGESTION_IN_FLIGHT_MS / 8.0) {
+        return true;
+    }
+
+    return false;
+}
+
+static void
+decide(struct westfield_quality_controller *controller) {
+    struct westfield_quality_decision *decision = &controller->decision;
+    const struct westfield_quality_config *config = &controller->config;
+    double bitrate = decision->bitrate_kbps;
+
+    decision->bytes_in_flight = bytes_in_flight(controller);
+    decision->congested = is_congested(controller);
+
+    if (decision->congested) {
+        bitrate *= DECREASE_FACTOR;
+        // the acknowledged rate is what the link actually drains while it's saturated, don't stay above it
+        if (controller->have_bandwidth && decision->bandwidth_kbps * BANDWIDTH_HEADROOM < bitrate) {
+            bitrate = decision->bandwidth_kbps * BANDWIDTH_HEADROOM;
+        }
+        if (decision->compression_level < MAX_COMPRESSION_LEVEL) {
+            decision->compression_level++;
+        }
+        decision->max_fps = decision->max_fps * 3 / 4 > MIN_FPS ? decision->max_fps * 3 / 4 : MIN_FPS;
+    } else {
+        // While the link isn't saturated the acknowledged rate only mirrors what was sent, so keep probing upwards
+        // until latency or unacknowledged data says otherwise.
+        if (bitrate < config->max_bitrate_kbps) {
+            bitrate += config->max_bitrate_kbps * INCREASE_STEP_FRACTION;
+            // there's room to spare, so spend less time compressing
+            if (decision->compression_level > 0) {
+                decision->compression_level--;
+            }
+        }
+        decision->max_fps = decision->max_fps + FPS_STEP < config->max_fps ? decision->max_fps + FPS_STEP
+                                                                           : config->max_fps;
+    }
+
+    if (bitrate < config->min_bitrate_kbps) {
+        bitrate = config->min_bitrate_kbps;
+    } else if (bitrate > config->max_bitrate_kbps) {
+        bitrate = config->max_bitrate_kbps;
+    }
+    decision->bitrate_kbps = (uint32_t) bitrate;
+}
+
+static void
+end_interval(struct westfield_quality_controller *controller, double now_ms) {
+    double elapsed_ms = now_ms - controller->interval_start_ms;
+    double bandwidth_kbps = (double) controller->interval_acked_bytes * 8.0 / elapsed_ms;
+
+    // An interval without acknowledgements while nothing was in flight says nothing about the link.
+    if (controller->interval_acked_bytes || bytes_in_flight(controller)) {
+        if (controller->have_bandwidth) {
+            controller->decision.bandwidth_kbps += (bandwidth_kbps - controller->decision.bandwidth_kbps) *
+                                                   BANDWIDTH_EMA_WEIGHT;
+        } else {
+            controller->decision.bandwidth_kbps = bandwidth_kbps;
+            controller->have_bandwidth = controller->interval_acked_bytes > 0;
+        }
+    }
+
+    controller->interval_start_ms = now_ms;
+    controller->interval_acked_bytes = 0;
+
+    decide(controller);
+}
+
+struct westfield_quality_controller *
+westfield_quality_controller_create(const struct westfield_quality_config *config) {
+    struct westfield_quality_controller *controller;
+
+    controller = calloc(1, sizeof(*controller));
+    if (controller == NULL) {
+        return NULL;
+    }
+
+    controller->config = *config;
+    if (controller->config.min_bitrate_kbps == 0) {
+        controller->config.min_bitrate_kbps = DEFAULT_MIN_BITRATE_KBPS;
+    }
+    if (controller->config.max_bitrate_kbps < controller->config.min_bitrate_kbps) {
+        controller->config.max_bitrate_kbps = controller->config.min_bitrate_kbps > DEFAULT_MAX_BITRATE_KBPS
+                                              ? controller->config.min_bitrate_kbps : DEFAULT_MAX_BITRATE_KBPS;
+    }
+    if (controller->config.max_fps == 0) {
+        controller->config.max_fps = DEFAULT_MAX_FPS;
+    }
+
+    // start conservatively and let the controller find its way up
+    controller->decision.bitrate_kbps = controller->config.min_bitrate_kbps +
+                                        (controller->config.max_bitrate_kbps - controller->config.min_bitrate_kbps) / 4;
+    controller->decision.compression_level = MAX_COMPRESSION_LEVEL / 2;
+    controller->decision.max_fps = controller->config.max_fps;
+
+    return controller;
+}
+
+void
+westfield_quality_controller_destroy(struct westfield_quality_controller *controller) {
+    free(controller);
+}
+
+void
+westfield_quality_controller_report_sent(struct westfield_quality_controller *controller, uint64_t bytes,
+                                         double now_ms) {
+    if (!controller->interval_started) {
+        controller->interval_started = true;
+        controller->interval_start_ms = now_ms;
+    }
+    controller->sent_bytes += bytes;
+}
+
+void
+westfield_quality_controller_report_acked(struct westfield_quality_controller *controller, uint64_t bytes,
+                                          double latency_ms, double now_ms) {
+    controller->acked_bytes += bytes;
+    controller->interval_acked_bytes += bytes;
+
+    if (!controller->have_latency || latency_ms <= controller->baseline_latency_ms ||
+        now_ms - controller->baseline_latency_time_ms > BASELINE_LATENCY_WINDOW_MS) {
+        controller->baseline_latency_ms = latency_ms;
+        controller->baseline_latency_time_ms = now_ms;
+    }
+
+    if (!controller->have_latency) {
+        controller->decision.latency_ms = latency_ms;
+        controller->have_latency = true;
+    } else {
+        controller->decision.latency_ms += (latency_ms - controller->decision.latency_ms) * LATENCY_EMA_WEIGHT;
+    }
+}
+
+void
+westfield_quality_controller_get_decision(struct westfield_quality_controller *controller, double now_ms,
+                                          struct westfield_quality_decision *decision) {
+    if (controller->interval_started && now_ms - controller->interval_start_ms >= INTERVAL_MS) {
+        end_interval(controller, now_ms);
+    }
+
+    *decision = controller->decision;
+    decision->bytes_in_flight = bytes_in_flight(controller);
+}
@@ -0,0 +1,59 @@
+#ifndef WESTFIELD_WESTFIELD_QUALITY_H
+#define WESTFIELD_WESTFIELD_QUALITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Per-surface controller that adapts encoding quality to how fast the browser link drains.
+ *
+ * The caller reports every frame it sends and every frame the browser acknowledges, together with the time it took.
+ * At the end of each measuring interval the controller updates its estimate of the available bandwidth (acknowledged
+ * bytes per second) and of the frame delivery latency. It then picks a new bitrate, tile compression level and frame
+ * rate with additive increase, multiplicative decrease: quality creeps up while the link keeps up and drops sharply
+ * as soon as latency or the amount of unacknowledged data starts to build up.
+ *
+ * All times are in milliseconds on a monotonic clock chosen by the caller.
+ */
+struct westfield_quality_controller;
+
+struct westfield_quality_config {
+    uint32_t min_bitrate_kbps;
+    uint32_t max_bitrate_kbps;
+    uint32_t max_fps;
+};
+
+struct westfield_quality_decision {
+    uint32_t bitrate_kbps;
+    // 0 is fastest, 9 is smallest
+    uint32_t compression_level;
+    uint32_t max_fps;
+    // estimates the decision was based on
+    double bandwidth_kbps;
+    double latency_ms;
+    uint64_t bytes_in_flight;
+    bool congested;
+};
+
+struct westfield_quality_controller *
+westfield_quality_controller_create(const struct westfield_quality_config *config);
+
+void
+westfield_quality_controller_destroy(struct westfield_quality_controller *controller);
+
+void
+westfield_quality_controller_report_sent(struct westfield_quality_controller *controller, uint64_t bytes,
+                                         double now_ms);
+
+void
+westfield_quality_controller_report_acked(struct westfield_quality_controller *controller, uint64_t bytes,
+                                          double latency_ms, double now_ms);
+
+/**
+ * Close the measuring interval if it has elapsed and return the current decision.
+ */
+void
+westfield_quality_controller_get_decision(struct westfield_quality_controller *controller, double now_ms,
+                                          struct westfield_quality_decision *decision);
+
+#endif //WESTFIELD_WESTFIELD_QUALITY_H
@@ -0,0 +1,479 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-scroll-detect.h"
+#include "westfield-hash.h"
+
+// Shorter runs of moved rows or columns are cheaper to send as damage than as a separate copy operation.
+#define MIN_SCROLL_RUN 8
+
+#define COLUMN_HASH_BASIS 0xcbf29ce484222325ULL
+#define COLUMN_HASH_PRIME 0x100000001b3ULL
+
+struct westfield_scroll_detector {
+    // tightly packed 32-bit pixels of the previous frame
+    uint32_t *prev;
+    size_t prev_capacity;
+    int32_t prev_width, prev_height;
+
+    // tightly packed 32-bit pixels of the frame being processed, swapped with prev when done
+    uint32_t *cur;
+    size_t cur_capacity;
+};
+
+struct line_hash {
+    uint64_t hash;
+    int32_t index;
+};
+
+static int
+line_hash_compare(const void *a, const void *b) {
+    const struct line_hash *la = a;
+    const struct line_hash *lb = b;
+
+    if (la->hash < lb->hash) {
+        return -1;
+    }
+    if (la->hash > lb->hash) {
+        return 1;
+    }
+    return la->index - lb->index;
+}
+
+/**
+ * Find the index of the line in sorted that has the given hash, or -1 if there is no such line or if the hash is
+ * shared by more than one line. Repeated lines (e.g. blank rows) say nothing about how content moved.
+ */
+static int32_t
+find_unique_line(const struct line_hash *sorted, int32_t count, uint64_t hash) {
+    int32_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (sorted[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == count || sorted[lo].hash != hash) {
+        return -1;
+    }
+    if (lo + 1 < count && sorted[lo + 1].hash == hash) {
+        return -1;
+    }
+    return sorted[lo].index;
+}
+
+/**
+ * Let every line of cur that appears exactly once in prev vote for the offset it moved by and return the winning
+ * offset, or 0 if no offset got enough votes.
+ */
+static int32_t
+vote_offset(const uint64_t *prev_hashes, const uint64_t *cur_hashes, int32_t count) {
+    struct line_hash *sorted;
+    uint32_t *votes;
+    uint32_t best_votes = 0, min_votes;
+    int32_t best_offset = 0;
+
+    if (count < MIN_SCROLL_RUN) {
+        return 0;
+    }
+
+    sorted = malloc(sizeof(*sorted) * count);
+    votes = calloc(2 * count - 1, sizeof(*votes));
+    if (sorted == NULL || votes == NULL) {
+        free(sorted);
+        free(votes);
+        return 0;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        sorted[i].hash = prev_hashes[i];
+        sorted[i].index = i;
+    }
+    qsort(sorted, count, sizeof(*sorted), line_hash_compare);
+
+    for (int32_t i = 0; i < count; i++) {
+        int32_t prev_index = find_unique_line(sorted, count, cur_hashes[i]);
+        if (prev_index >= 0 && prev_index != i) {
+            votes[i - prev_index + count - 1]++;
+        }
+    }
+
+    min_votes = count / 8 > MIN_SCROLL_RUN ? count / 8 : MIN_SCROLL_RUN;
+    for (int32_t i = 0; i < 2 * count - 1; i++) {
+        if (votes[i] >= min_votes && votes[i] > best_votes) {
+            best_votes = votes[i];
+            best_offset = i - (count - 1);
+        }
+    }
+
+    free(sorted);
+    free(votes);
+
+    return best_offset;
+}
+
+static void
+add_damage(struct wl_array *damage_rects, int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct westfield_rect *rect = wl_array_add(damage_rects, sizeof(*rect));
+    if (rect == NULL) {
+        return;
+    }
+    rect->x = x;
+    rect->y = y;
+    rect->width = width;
+    rect->height = height;
+}
+
+static void
+add_copy(struct wl_array *copy_rects, int32_t src_x, int32_t src_y, int32_t dst_x, int32_t dst_y, int32_t width,
+         int32_t height) {
+    struct westfield_copy_rect *rect = wl_array_add(copy_rects, sizeof(*rect));
+    if (rect == NULL) {
+        return;
+    }
+    rect->src_x = src_x;
+    rect->src_y = src_y;
+    rect->dst_x = dst_x;
+    rect->dst_y = dst_y;
+    rect->width = width;
+    rect->height = height;
+}
+
+/**
+ * Turn consecutive changed rows that are not covered by a copy into damage rects, each spanning the union of the
+ * changed columns of its rows.
+ */
+static void
+add_row_band_damage(struct wl_array *damage_rects, const int32_t *row_min_x, const int32_t *row_max_x,
+                    const bool *covered, int32_t y0, int32_t y1) {
+    int32_t band_start = -1, band_min_x = 0, band_max_x = 0;
+
+    for (int32_t y = y0; y <= y1; y++) {
+        bool damaged = y < y1 && row_min_x[y] >= 0 && (covered == NULL || !covered[y]);
+
+        if (damaged) {
+            if (band_start < 0) {
+                band_start = y;
+                band_min_x = row_min_x[y];
+                band_max_x = row_max_x[y];
+            } else {
+                band_min_x = row_min_x[y] < band_min_x ? row_min_x[y] : band_min_x;
+                band_max_x = row_max_x[y] > band_max_x ? row_max_x[y] : band_max_x;
+            }
+        } else if (band_start >= 0) {
+            add_damage(damage_rects, band_min_x, band_start, band_max_x - band_min_x + 1, y - band_start);
+            band_start = -1;
+        }
+    }
+}
+
+static bool
+detect_vertical(struct westfield_scroll_detector *detector, int32_t width,
+                int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                const int32_t *row_min_x, const int32_t *row_max_x,
+                struct wl_array *copy_rects, struct wl_array *damage_rects) {
+    const int32_t count = y1 - y0;
+    const size_t span_size = (size_t) (x1 - x0) * 4;
+    uint64_t *prev_hashes, *cur_hashes;
+    bool *covered;
+    int32_t dy, run_start = -1;
+    bool found = false;
+
+    prev_hashes = malloc(sizeof(*prev_hashes) * count);
+    cur_hashes = malloc(sizeof(*cur_hashes) * count);
+    covered = calloc(y1, sizeof(*covered));
+    if (prev_hashes == NULL || cur_hashes == NULL || covered == NULL) {
+        goto out;
+    }
+
+    for (int32_t y = y0; y < y1; y++) {
+        prev_hashes[y - y0] = westfield_hash64(detector->prev + (size_t) y * width + x0, span_size, 0);
+        cur_hashes[y - y0] = westfield_hash64(detector->cur + (size_t) y * width + x0, span_size, 0);
+    }
+
+    dy = vote_offset(prev_hashes, cur_hashes, count);
+    if (dy == 0) {
+        goto out;
+    }
+
+    for (int32_t y = y0; y <= y1; y++) {
+        int32_t py = y - dy;
+        bool match = y < y1 && py >= y0 && py < y1 &&
+                     cur_hashes[y - y0] == prev_hashes[py - y0] &&
+                     memcmp(detector->cur + (size_t) y * width + x0,
+                            detector->prev + (size_t) py * width + x0, span_size) == 0;
+
+        if (match) {
+            if (run_start < 0) {
+                run_start = y;
+            }
+        } else if (run_start >= 0) {
+            if (y - run_start >= MIN_SCROLL_RUN) {
+                add_copy(copy_rects, x0, run_start - dy, x0, run_start, x1 - x0, y - run_start);
+                for (int32_t i = run_start; i < y; i++) {
+                    covered[i] = true;
+                }
+                found = true;
+            }
+            run_start = -1;
+        }
+    }
+
+    if (found) {
+        add_row_band_damage(damage_rects, row_min_x, row_max_x, covered, y0, y1);
+    }
+
+out:
+    free(prev_hashes);
+    free(cur_hashes);
+    free(covered);
+
+    return found;
+}
+
+static bool
+columns_equal(const uint32_t *a, const uint32_t *b, int32_t width, int32_t y0, int32_t y1) {
+    for (int32_t y = y0; y < y1; y++) {
+        if (a[(size_t) y * width] != b[(size_t) y * width]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+detect_horizontal(struct westfield_scroll_detector *detector, int32_t width,
+                  int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                  struct wl_array *copy_rects, struct wl_array *damage_rects) {
+    const int32_t count = x1 - x0;
+    uint64_t *prev_hashes, *cur_hashes;
+    bool *column_changed;
+    int32_t dx, run_start = -1, band_start = -1;
+    bool found = false;
+
+    prev_hashes = malloc(sizeof(*prev_hashes) * count);
+    cur_hashes = malloc(sizeof(*cur_hashes) * count);
+    column_changed = calloc(count, sizeof(*column_changed));
+    if (prev_hashes == NULL || cur_hashes == NULL || column_changed == NULL) {
+        goto out;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        prev_hashes[i] = COLUMN_HASH_BASIS;
+        cur_hashes[i] = COLUMN_HASH_BASIS;
+    }
+
+    // Walk the pixels in memory order and fold each one into the hash of its column.
+    for (int32_t y = y0; y < y1; y++) {
+        const uint32_t *prev_row = detector->prev + (size_t) y * width + x0;
+        const uint32_t *cur_row = detector->cur + (size_t) y * width + x0;
+        for (int32_t i = 0; i < count; i++) {
+            prev_hashes[i] = (prev_hashes[i] ^ prev_row[i]) * COLUMN_HASH_PRIME;
+            cur_hashes[i] = (cur_hashes[i] ^ cur_row[i]) * COLUMN_HASH_PRIME;
+            column_changed[i] |= prev_row[i] != cur_row[i];
+        }
+    }
+
+    dx = vote_offset(prev_hashes, cur_hashes, count);
+    if (dx == 0) {
+        goto out;
+    }
+
+    for (int32_t i = 0; i <= count; i++) {
+        int32_t pi = i - dx;
+        bool match = i < count && pi >= 0 && pi < count &&
+                     cur_hashes[i] == prev_hashes[pi] &&
+                     columns_equal(detector->cur + x0 + i, detector->prev + x0 + pi, width, y0, y1);
+
+        if (match) {
+            if (run_start < 0) {
+                run_start = i;
+            }
+        } else if (run_start >= 0) {
+            if (i - run_start >= MIN_SCROLL_RUN) {
+                add_copy(copy_rects, x0 + run_start - dx, y0, x0 + run_start, y0, i - run_start, y1 - y0);
+                for (int32_t j = run_start; j < i; j++) {
+                    // covered by the copy, so no longer damaged
+                    column_changed[j] = false;
+                }
+                found = true;
+            }
+            run_start = -1;
+        }
+    }
+
+    if (!found) {
+        goto out;
+    }
+
+    for (int32_t i = 0; i <= count; i++) {
+        if (i < count && column_changed[i]) {
+            if (band_start < 0) {
+                band_start = i;
+            }
+        } else if (band_start >= 0) {
+            add_damage(damage_rects, x0 + band_start, y0, i - band_start, y1 - y0);
+            band_start = -1;
+        }
+    }
+
+out:
+    free(prev_hashes);
+    free(cur_hashes);
+    free(column_changed);
+
+    return found;
+}
+
+static bool
+ensure_capacity(uint32_t **pixels, size_t *capacity, size_t size) {
+    uint32_t *new_pixels;
+
+    if (*capacity >= size) {
+        return true;
+    }
+
+    new_pixels = realloc(*pixels, size * sizeof(**pixels));
+    if (new_pixels == NULL) {
+        return false;
+    }
+    *pixels = new_pixels;
+    *capacity = size;
+
+    return true;
+}
+
+static void
+finish_result(struct westfield_scroll_result *result, struct wl_array *copy_rects, struct wl_array *damage_rects) {
+    result->copy_rects = copy_rects->data;
+    result->copy_rect_count = copy_rects->size / sizeof(struct westfield_copy_rect);
+    result->damage_rects = damage_rects->data;
+    result->damage_rect_count = damage_rects->size / sizeof(struct westfield_rect);
+}
+
+struct westfield_scroll_detector *
+westfield_scroll_detector_create(void) {
+    return calloc(1, sizeof(struct westfield_scroll_detector));
+}
+
+void
+westfield_scroll_detector_destroy(struct westfield_scroll_detector *detector) {
+    free(detector->prev);
+    free(detector->cur);
+    free(detector);
+}
+
+bool
+westfield_scroll_detector_process_shm_buffer(struct westfield_scroll_detector *detector,
+                                             struct wl_shm_buffer *buffer,
+                                             struct westfield_scroll_result *result) {
+    struct wl_array copy_rects, damage_rects;
+    int32_t width, height, stride;
+    int32_t x0, y0 = -1, x1 = 0, y1 = 0;
+    int32_t *row_min_x = NULL, *row_max_x = NULL;
+    uint32_t format, *swap;
+    size_t swap_capacity;
+    const uint8_t *data;
+
+    memset(result, 0, sizeof(*result));
+    wl_array_init(&copy_rects);
+    wl_array_init(&damage_rects);
+
+    format = wl_shm_buffer_get_format(buffer);
+    width = wl_shm_buffer_get_width(buffer);
+    height = wl_shm_buffer_get_height(buffer);
+    stride = wl_shm_buffer_get_stride(buffer);
+
+    if ((format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) ||
+        !ensure_capacity(&detector->cur, &detector->cur_capacity, (size_t) width * height)) {
+        detector->prev_width = 0;
+        detector->prev_height = 0;
+        return false;
+    }
+
+    wl_shm_buffer_begin_access(buffer);
+    data = wl_shm_buffer_get_data(buffer);
+    for (int32_t y = 0; y < height; y++) {
+        memcpy(detector->cur + (size_t) y * width, data + (size_t) y * stride, (size_t) width * 4);
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    if (detector->prev_width != width || detector->prev_height != height) {
+        add_damage(&damage_rects, 0, 0, width, height);
+        goto done;
+    }
+
+    row_min_x = malloc(sizeof(*row_min_x) * height);
+    row_max_x = malloc(sizeof(*row_max_x) * height);
+    if (row_min_x == NULL || row_max_x == NULL) {
+        add_damage(&damage_rects, 0, 0, width, height);
+        goto done;
+    }
+
+    x0 = width;
+    for (int32_t y = 0; y < height; y++) {
+        const uint32_t *prev_row = detector->prev + (size_t) y * width;
+        const uint32_t *cur_row = detector->cur + (size_t) y * width;
+        int32_t min_x, max_x;
+
+        if (memcmp(prev_row, cur_row, (size_t) width * 4) == 0) {
+            row_min_x[y] = -1;
+            row_max_x[y] = -1;
+            continue;
+        }
+
+        for (min_x = 0; prev_row[min_x] == cur_row[min_x]; min_x++);
+        for (max_x = width - 1; prev_row[max_x] == cur_row[max_x]; max_x--);
+        row_min_x[y] = min_x;
+        row_max_x[y] = max_x;
+
+        x0 = min_x < x0 ? min_x : x0;
+        x1 = max_x + 1 > x1 ? max_x + 1 : x1;
+        if (y0 < 0) {
+            y0 = y;
+        }
+        y1 = y + 1;
+    }
+
+    if (y0 < 0) {
+        // nothing changed
+        goto done;
+    }
+
+    if (detect_vertical(detector, width, x0, y0, x1, y1, row_min_x, row_max_x, &copy_rects, &damage_rects)) {
+        goto done;
+    }
+    if (detect_horizontal(detector, width, x0, y0, x1, y1, &copy_rects, &damage_rects)) {
+        goto done;
+    }
+    add_row_band_damage(&damage_rects, row_min_x, row_max_x, NULL, y0, y1);
+
+done:
+    free(row_min_x);
+    free(row_max_x);
+
+    swap = detector->prev;
+    swap_capacity = detector->prev_capacity;
+    detector->prev = detector->cur;
+    detector->prev_capacity = detector->cur_capacity;
+    detector->prev_width = width;
+    detector->prev_height = height;
+    detector->cur = swap;
+    detector->cur_capacity = swap_capacity;
+
+    finish_result(result, &copy_rects, &damage_rects);
+
+    return true;
+}
+
+void
+westfield_scroll_result_release(struct westfield_scroll_result *result) {
+    free(result->copy_rects);
+    free(result->damage_rects);
+    memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,60 @@
+#ifndef WESTFIELD_WESTFIELD_SCROLL_DETECT_H
+#define WESTFIELD_WESTFIELD_SCROLL_DETECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+#include "westfield-util.h"
+
+/**
+ * Detects regions that moved between two consecutive frames of a surface.
+ *
+ * The detector keeps a snapshot of the last frame it was given. When a new frame arrives, the bounding box of all
+ * changed pixels is computed first. Rows (or columns) inside that box are hashed in both frames and every row whose
+ * hash is unique in the old frame votes for the offset at which it reappears in the new frame. The winning offset is
+ * verified pixel by pixel, so copy rects are always exact. Whatever changed but isn't covered by a copy rect is
+ * reported as residual damage.
+ *
+ * Only a single scroll offset per frame is detected, which covers the common case of one scrolling view inside an
+ * otherwise static surface.
+ */
+struct westfield_scroll_detector;
+
+struct westfield_copy_rect {
+    int32_t src_x, src_y;
+    int32_t dst_x, dst_y;
+    int32_t width, height;
+};
+
+/**
+ * Copy rects are expressed against the previous frame and must be applied before the damage rects are repainted.
+ */
+struct westfield_scroll_result {
+    struct westfield_copy_rect *copy_rects;
+    uint32_t copy_rect_count;
+    struct westfield_rect *damage_rects;
+    uint32_t damage_rect_count;
+};
+
+struct westfield_scroll_detector *
+westfield_scroll_detector_create(void);
+
+void
+westfield_scroll_detector_destroy(struct westfield_scroll_detector *detector);
+
+/**
+ * Compare an ARGB8888 or XRGB8888 shm buffer with the previous frame and remember it as the new previous frame.
+ *
+ * If there is no previous frame, or its size differs, the whole buffer is reported as damage. Returns false if the
+ * buffer format is not supported or memory could not be allocated, in which case the previous frame is dropped.
+ * The result must be released with westfield_scroll_result_release.
+ */
+bool
+westfield_scroll_detector_process_shm_buffer(struct westfield_scroll_detector *detector,
+                                             struct wl_shm_buffer *buffer,
+                                             struct westfield_scroll_result *result);
+
+void
+westfield_scroll_result_release(struct westfield_scroll_result *result);
+
+#endif //WESTFIELD_WESTFIELD_SCROLL_DETECT_H
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "wayland-server/westfield-wayland-server.h"
+#include "westfield-shard.h"
+#include "wlr_drm.h"
+#include "wlr_linux_dmabuf_v1.h"
+
+// a connection or a running client, handed to another shard
+struct shard_handoff {
+    // -1 for a running client
+    int client_fd;
+    // detached from its old display, NULL for a new connection
+    struct wl_client *client;
+};
+
+struct shard_client {
+    struct wl_listener destroy_listener;
+    struct westfield_shard *shard;
+    // link in westfield_shard::clients
+    struct wl_list link;
+};
+
+struct westfield_shard {
+    // link in shard_group
+    struct wl_list link;
+    // unique within the process, never reused
+    uint32_t id;
+    struct wl_display *display;
+    // eventfd, signaled when connections were queued for this shard
+    int queue_fd;
+    struct wl_event_source *queue_source;
+    // struct shard_handoff, handed to this shard but not picked up by its thread yet, guarded by group_mutex
+    struct wl_array queue;
+    // guarded by group_mutex, so other shards can read it
+    uint32_t client_count;
+    // struct shard_client::link, only used on the thread of the shard
+    struct wl_list clients;
+    // struct pending_migration::link, clients detached from this shard that wait to be handed off
+    struct wl_list migrations;
+    struct wl_listener client_created_listener;
+    struct wl_listener display_destroy_listener;
+};
+
+static pthread_mutex_t group_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct wl_list shard_group = {&shard_group, &shard_group};
+// guarded by group_mutex
+static uint32_t next_shard_id = 1;
+
+// group_mutex must be held
+static struct westfield_shard *
+find_shard(uint32_t id) {
+    struct westfield_shard *candidate;
+
+    wl_list_for_each(candidate, &shard_group, link) {
+        if (candidate->id == id) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+// group_mutex must be held
+static uint32_t
+shard_load(struct westfield_shard *shard) {
+    return shard->client_count + shard->queue.size / sizeof(struct shard_handoff);
+}
+
+static void
+on_client_destroyed(struct wl_listener *listener, void *data) {
+    struct shard_client *shard_client = wl_container_of(listener, shard_client, destroy_listener);
+
+    pthread_mutex_lock(&group_mutex);
+    shard_client->shard->client_count--;
+    pthread_mutex_unlock(&group_mutex);
+
+    wl_list_remove(&shard_client->link);
+    free(shard_client);
+}
+
+static void
+on_client_created(struct wl_listener *listener, void *data) {
+    struct westfield_shard *shard = wl_container_of(listener, shard, client_created_listener);
+    struct wl_client *client = data;
+    struct shard_client *shard_client;
+
+    shard_client = calloc(1, sizeof(*shard_client));
+    if (shard_client == NULL) {
+        return;
+    }
+    shard_client->shard = shard;
+    shard_client->destroy_listener.notify = on_client_destroyed;
+    wl_client_add_destroy_listener(client, &shard_client->destroy_listener);
+    wl_list_insert(&shard->clients, &shard_client->link);
+
+    pthread_mutex_lock(&group_mutex);
+    shard->client_count++;
+    pthread_mutex_unlock(&group_mutex);
+}
+
+// group_mutex must be held
+static bool
+enqueue(struct westfield_shard *target, int client_fd, struct wl_client *client) {
+    static const uint64_t one = 1;
+    struct shard_handoff *handoff;
+
+    handoff = wl_array_add(&target->queue, sizeof(*handoff));
+    if (handoff == NULL) {
+        return false;
+    }
+    handoff->client_fd = client_fd;
+    handoff->client = client;
+    // can only fail if the counter overflows, in which case the shard is signaled already
+    write(target->queue_fd, &one, sizeof(one));
+    return true;
+}
+
+static int
+handoff_client_fd(struct wl_display *display, int client_fd, void *data) {
+    struct westfield_shard *shard = data, *target = data, *candidate;
+    bool queued;
+
+    pthread_mutex_lock(&group_mutex);
+    wl_list_for_each(candidate, &shard_group, link) {
+        if (shard_load(candidate) < shard_load(target)) {
+            target = candidate;
+        }
+    }
+    queued = target != shard && enqueue(target, client_fd, NULL);
+    pthread_mutex_unlock(&group_mutex);
+
+    return queued;
+}
+
+static void
+take_handoff(struct westfield_shard *shard, struct shard_handoff *handoff) {
+    if (handoff->client == NULL) {
+        if (!wl_client_create(shard->display, handoff->client_fd)) {
+            close(handoff->client_fd);
+        }
+    } else if (wl_client_attach(handoff->client, shard->display) < 0) {
+        // out of memory, nothing sensible left to do with it
+        wl_client_destroy(handoff->client);
+    }
+}
+
+static int
+handle_queue(int fd, uint32_t mask, void *data) {
+    struct westfield_shard *shard = data;
+    struct shard_handoff *handoff;
+    struct wl_array queue;
+    uint64_t count;
+
+    read(fd, &count, sizeof(count));
+
+    pthread_mutex_lock(&group_mutex);
+    queue = shard->queue;
+    wl_array_init(&shard->queue);
+    pthread_mutex_unlock(&group_mutex);
+
+    wl_array_for_each(handoff, &queue) {
+        take_handoff(shard, handoff);
+    }
+    wl_array_release(&queue);
+
+    return 1;
+}
+
+struct pending_migration {
+    // link in westfield_shard::migrations
+    struct wl_list link;
+    struct westfield_shard *shard;
+    uint32_t target_id;
+    struct wl_client *client;
+    struct wl_event_source *idle;
+};
+
+static bool
+hand_off_migration(struct pending_migration *migration) {
+    struct westfield_shard *target;
+    bool queued = false;
+
+    pthread_mutex_lock(&group_mutex);
+    // the target may have left the group in the meantime
+    target = find_shard(migration->target_id);
+    if (target) {
+        queued = enqueue(target, -1, migration->client);
+    }
+    pthread_mutex_unlock(&group_mutex);
+
+    return queued;
+}
+
+static void
+on_display_destroyed(struct wl_listener *listener, void *data) {
+    struct westfield_shard *shard = wl_container_of(listener, shard, display_destroy_listener);
+    struct shard_client *shard_client, *next;
+    struct pending_migration *migration, *next_migration;
+    struct shard_handoff *handoff;
+    struct wl_array queue;
+
+    pthread_mutex_lock(&group_mutex);
+    wl_list_remove(&shard->link);
+    queue = shard->queue;
+    wl_array_init(&shard->queue);
+    pthread_mutex_unlock(&group_mutex);
+
+    wl_array_for_each(handoff, &queue) {
+        if (handoff->client) {
+            wl_client_destroy(handoff->client);
+        } else {
+            close(handoff->client_fd);
+        }
+    }
+    wl_array_release(&queue);
+
+    // migrations that did not get to run, there is no display left to take them back
+    wl_list_for_each_safe(migration, next_migration, &shard->migrations, link) {
+        wl_event_source_remove(migration->idle);
+        if (!hand_off_migration(migration)) {
+            wl_client_destroy(migration->client);
+        }
+        free(migration);
+    }
+
+    // clients that outlive their display must not reach the freed shard
+    wl_list_for_each_safe(shard_client, next, &shard->clients, link) {
+        wl_list_remove(&shard_client->destroy_listener.link);
+        free(shard_client);
+    }
+
+    wl_display_set_client_fd_handoff(shard->display, NULL, NULL);
+    wl_list_remove(&shard->client_created_listener.link);
+    wl_event_source_remove(shard->queue_source);
+    close(shard->queue_fd);
+    free(shard);
+}
+
+struct westfield_shard *
+westfield_shard_create(struct wl_display *display) {
+    struct westfield_shard *shard;
+
+    shard = calloc(1, sizeof(*shard));
+    if (shard == NULL) {
+        return NULL;
+    }
+
+    shard->queue_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shard->queue_fd < 0) {
+        free(shard);
+        return NULL;
+    }
+
+    shard->queue_source = wl_event_loop_add_fd(wl_display_get_event_loop(display), shard->queue_fd,
+                                               WL_EVENT_READABLE, handle_queue, shard);
+    if (shard->queue_source == NULL) {
+        close(shard->queue_fd);
+        free(shard);
+        return NULL;
+    }
+
+    shard->display = display;
+    wl_array_init(&shard->queue);
+    wl_list_init(&shard->clients);
+    wl_list_init(&shard->migrations);
+    shard->client_created_listener.notify = on_client_created;
+    wl_display_add_client_created_listener(display, &shard->client_created_listener);
+    shard->display_destroy_listener.notify = on_display_destroyed;
+    wl_display_add_destroy_listener(display, &shard->display_destroy_listener);
+
+    pthread_mutex_lock(&group_mutex);
+    shard->id = next_shard_id++;
+    wl_list_insert(shard_group.prev, &shard->link);
+    pthread_mutex_unlock(&group_mutex);
+
+    return shard;
+}
+
+void
+westfield_shard_set_front(struct westfield_shard *shard, bool front) {
+    wl_display_set_client_fd_handoff(shard->display, front ? handoff_client_fd : NULL, shard);
+}
+
+uint32_t
+westfield_shard_get_id(struct westfield_shard *shard) {
+    return shard->id;
+}
+
+bool
+westfield_shard_get_stats(uint32_t id, struct westfield_shard_stats *stats) {
+    struct westfield_shard *shard;
+
+    pthread_mutex_lock(&group_mutex);
+    shard = find_shard(id);
+    if (shard) {
+        stats->clients = shard->client_count;
+        stats->pending = shard->queue.size / sizeof(struct shard_handoff);
+    }
+    pthread_mutex_unlock(&group_mutex);
+
+    return shard != NULL;
+}
+
+bool
+westfield_shard_get_ids(struct wl_array *ids) {
+    struct westfield_shard *shard;
+    uint32_t *id;
+    bool complete = true;
+
+    pthread_mutex_lock(&group_mutex);
+    wl_list_for_each(shard, &shard_group, link) {
+        id = wl_array_add(ids, sizeof(*id));
+        if (id == NULL) {
+            complete = false;
+            break;
+        }
+        *id = shard->id;
+    }
+    pthread_mutex_unlock(&group_mutex);
+
+    return complete;
+}
+
+static enum wl_iterator_result
+find_unmovable_resource(struct wl_resource *resource, void *data) {
+    // these hold buffers and state of the gpu of the display's own egl context
+    static const char *const unmovable[] = {
+            "wl_drm",
+            "zwp_linux_dmabuf_v1",
+            "zwp_linux_buffer_params_v1",
+            "zwp_linux_dmabuf_feedback_v1",
+    };
+    bool *movable = data;
+    const char *class = wl_resource_get_class(resource);
+
+    for (size_t i = 0; i < sizeof(unmovable) / sizeof(unmovable[0]); i++) {
+        if (strcmp(class, unmovable[i]) == 0) {
+            *movable = false;
+            return WL_ITERATOR_STOP;
+        }
+    }
+    // dmabuf and drm buffers are plain wl_buffers, recognize them by their implementation instead
+    if (wlr_dmabuf_v1_resource_is_buffer(resource) || wlr_drm_buffer_is_resource(resource)) {
+        *movable = false;
+        return WL_ITERATOR_STOP;
+    }
+    return WL_ITERATOR_CONTINUE;
+}
+
+static void
+finish_migration(void *data) {
+    struct pending_migration *migration = data;
+
+    wl_list_remove(&migration->link);
+    if (!hand_off_migration(migration) && wl_client_attach(migration->client, migration->shard->display) < 0) {
+        wl_client_destroy(migration->client);
+    }
+    free(migration);
+}
+
+bool
+westfield_shard_migrate_client(struct westfield_shard *shard, struct wl_client *client, uint32_t target_id) {
+    struct pending_migration *migration;
+    bool movable = true, target_found;
+
+    if (target_id == shard->id || wl_client_get_display(client) != shard->display) {
+        return false;
+    }
+
+    pthread_mutex_lock(&group_mutex);
+    target_found = find_shard(target_id) != NULL;
+    pthread_mutex_unlock(&group_mutex);
+    if (!target_found) {
+        return false;
+    }
+
+    wl_client_for_each_resource(client, find_unmovable_resource, &movable);
+    if (!movable) {
+        return false;
+    }
+
+    migration = calloc(1, sizeof(*migration));
+    if (migration == NULL) {
+        return false;
+    }
+    if (wl_client_detach(client) < 0) {
+        free(migration);
+        return false;
+    }
+    migration->shard = shard;
+    migration->target_id = target_id;
+    migration->client = client;
+
+    // the client may be dispatching the request that asked for its migration, only hand it over once that returned
+    migration->idle = wl_event_loop_add_idle(wl_display_get_event_loop(shard->display), finish_migration, migration);
+    if (migration->idle == NULL) {
+        free(migration);
+        if (wl_client_attach(client, shard->display) < 0) {
+            wl_client_destroy(client);
+        }
+        return false;
+    }
+    wl_list_insert(&shard->migrations, &migration->link);
+
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef WESTFIELD_WESTFIELD_SHARD_H
+#define WESTFIELD_WESTFIELD_SHARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+
+/**
+ * Spreads the clients connecting to a single wayland socket over several displays of the same process, each
+ * dispatched by its own thread (like a node worker).
+ *
+ * Every display that wants to serve clients joins the process wide shard group. The display that listens on the socket
+ * is made the front: each connection it accepts is handed to the least loaded shard, including itself, and the client
+ * is created on the thread of that shard. The load of a shard is its number of clients plus the connections queued for
+ * it but not picked up yet.
+ */
+struct westfield_shard;
+
+struct westfield_shard_stats {
+    uint32_t clients;
+    uint32_t pending;
+};
+
+/**
+ * Make display join the shard group. Must be called on the thread that dispatches display. The shard leaves the group
+ * when the display is destroyed, connections still queued for it are closed. Returns NULL on failure.
+ */
+struct westfield_shard *
+westfield_shard_create(struct wl_display *display);
+
+/**
+ * Hand the connections accepted on the sockets of this shard's display to the least loaded shard of the group.
+ */
+void
+westfield_shard_set_front(struct westfield_shard *shard, bool front);
+
+/**
+ * The id of the shard, unique within the process and never reused. Other threads refer to the shard by this id.
+ */
+uint32_t
+westfield_shard_get_id(struct westfield_shard *shard);
+
+/**
+ * The current load of the shard with the given id. Safe to call from any thread. Returns false if no shard with that id
+ * is in the group (anymore).
+ */
+bool
+westfield_shard_get_stats(uint32_t id, struct westfield_shard_stats *stats);
+
+/**
+ * Append the ids of all shards in the group to ids, as uint32_t. Safe to call from any thread. Returns false if it ran
+ * out of memory.
+ */
+bool
+westfield_shard_get_ids(struct wl_array *ids);
+
+/**
+ * Move a running client of this shard's display to the display of the shard with target_id, which may be dispatched by
+ * any thread, together with all its objects and the messages it has pending. Must be called on the thread of shard. The
+ * client is destroyed on this display, as far as its listeners are concerned, and created again on the target display
+ * once its thread picks it up. If the target left the group by then, the client is put back on this display.
+ *
+ * Both displays must announce the same globals, under the same names. Fails, and leaves the client where it is, if
+ * the client waits for a sync or holds objects tied to the gpu of this display (wl_drm, linux dmabuf).
+ */
+bool
+westfield_shard_migrate_client(struct westfield_shard *shard, struct wl_client *client, uint32_t target_id);
+
+#endif //WESTFIELD_WESTFIELD_SHARD_H
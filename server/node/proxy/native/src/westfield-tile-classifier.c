@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-server/wayland-server-protocol.h"
+#include "westfield-tile-classifier.h"
+
+// distinct colors are counted up to this number
+#define MAX_COLORS 64
+#define COLOR_TABLE_SIZE 128
+#define MANY_COLORS 48
+#define FEW_COLORS 16
+
+// luma steps up to this size are considered part of a smooth gradient rather than an edge
+#define SMOOTH_GRADIENT_MAX 24
+#define SMOOTH_RATIO_LOSSY 0.25f
+
+#define CHANGE_DECAY 0.8f
+#define CHANGE_FREQUENCY_LOSSY 0.6f
+
+#define MIN_HYSTERESIS 2
+#define MAX_HYSTERESIS 16
+// a tile flipping again within this many frames means the surface is flapping
+#define FLAP_WINDOW 30
+// frames without flapping before hysteresis is relaxed by one step
+#define SETTLE_WINDOW 120
+
+struct tile_state {
+    bool initialized;
+    uint8_t tile_class;
+    uint8_t opposite_votes;
+    // exponential moving average of how often the tile is damaged per frame
+    float change_frequency;
+    uint32_t last_changed_frame;
+    uint32_t last_flip_frame;
+};
+
+struct westfield_tile_classifier {
+    int32_t width, height;
+    int32_t tiles_x, tiles_y;
+    struct tile_state *tiles;
+    bool *damaged;
+
+    uint32_t frame;
+    uint32_t hysteresis;
+    uint32_t last_flap_frame;
+
+    struct westfield_tile_classifier_stats stats;
+};
+
+struct tile_scores {
+    uint32_t colors;
+    float smooth_ratio;
+};
+
+static inline int32_t
+luma(uint32_t pixel) {
+    return (int32_t) ((((pixel >> 16) & 0xff) * 2 + ((pixel >> 8) & 0xff) * 5 + (pixel & 0xff)) >> 3);
+}
+
+static void
+score_tile(const uint8_t *data, int32_t stride, uint32_t color_mask,
+           int32_t x0, int32_t y0, int32_t width, int32_t height, struct tile_scores *scores) {
+    uint32_t color_table[COLOR_TABLE_SIZE];
+    bool color_used[COLOR_TABLE_SIZE] = {false};
+    uint32_t colors = 0, smooth = 0, pairs = 0;
+
+    for (int32_t y = y0; y < y0 + height; y++) {
+        const uint32_t *row = (const uint32_t *) (data + (size_t) y * stride) + x0;
+        int32_t prev_luma = luma(row[0]);
+
+        for (int32_t x = 0; x < width; x++) {
+            uint32_t color = row[x] & color_mask;
+
+            if (colors < MAX_COLORS) {
+                uint32_t slot = (color * 2654435761u) >> 25;
+                while (color_used[slot] && color_table[slot] != color) {
+                    slot = (slot + 1) & (COLOR_TABLE_SIZE - 1);
+                }
+                if (!color_used[slot]) {
+                    color_used[slot] = true;
+                    color_table[slot] = color;
+                    colors++;
+                }
+            }
+
+            if (x > 0) {
+                int32_t current_luma = luma(color);
+                int32_t step = abs(current_luma - prev_luma);
+                smooth += step > 0 && step <= SMOOTH_GRADIENT_MAX;
+                pairs++;
+                prev_luma = current_luma;
+            }
+        }
+    }
+
+    scores->colors = colors;
+    scores->smooth_ratio = pairs ? (float) smooth / (float) pairs : 0.0f;
+}
+
+static float
+decayed_change_frequency(const struct tile_state *tile, uint32_t frame) {
+    uint32_t elapsed = frame - tile->last_changed_frame;
+    float change_frequency = tile->change_frequency;
+
+    if (elapsed > 32) {
+        return 0.0f;
+    }
+    while (elapsed-- > 1) {
+        change_frequency *= CHANGE_DECAY;
+    }
+    return change_frequency;
+}
+
+static void
+update_tile(struct westfield_tile_classifier *classifier, struct tile_state *tile, const struct tile_scores *scores) {
+    enum westfield_tile_class vote;
+
+    tile->change_frequency = decayed_change_frequency(tile, classifier->frame) * CHANGE_DECAY + (1.0f - CHANGE_DECAY);
+    tile->last_changed_frame = classifier->frame;
+
+    if ((scores->colors >= MANY_COLORS && scores->smooth_ratio >= SMOOTH_RATIO_LOSSY) ||
+        (tile->change_frequency >= CHANGE_FREQUENCY_LOSSY && scores->colors >= FEW_COLORS)) {
+        vote = WESTFIELD_TILE_LOSSY;
+    } else {
+        vote = WESTFIELD_TILE_LOSSLESS;
+    }
+
+    if (!tile->initialized) {
+        tile->initialized = true;
+        tile->tile_class = vote;
+        tile->last_flip_frame = classifier->frame;
+        return;
+    }
+
+    if (vote == tile->tile_class) {
+        tile->opposite_votes = 0;
+        return;
+    }
+
+    if (++tile->opposite_votes < classifier->hysteresis) {
+        return;
+    }
+
+    if (classifier->frame - tile->last_flip_frame <= FLAP_WINDOW && classifier->hysteresis < MAX_HYSTERESIS) {
+        classifier->hysteresis++;
+        classifier->last_flap_frame = classifier->frame;
+    }
+    tile->tile_class = vote;
+    tile->opposite_votes = 0;
+    tile->last_flip_frame = classifier->frame;
+    classifier->stats.class_flips++;
+}
+
+static bool
+resize(struct westfield_tile_classifier *classifier, int32_t width, int32_t height) {
+    int32_t tiles_x = (width + WESTFIELD_TILE_SIZE - 1) / WESTFIELD_TILE_SIZE;
+    int32_t tiles_y = (height + WESTFIELD_TILE_SIZE - 1) / WESTFIELD_TILE_SIZE;
+    struct tile_state *tiles;
+    bool *damaged;
+
+    tiles = calloc((size_t) tiles_x * tiles_y, sizeof(*tiles));
+    damaged = calloc((size_t) tiles_x * tiles_y, sizeof(*damaged));
+    if (tiles == NULL || damaged == NULL) {
+        free(tiles);
+        free(damaged);
+        return false;
+    }
+
+    free(classifier->tiles);
+    free(classifier->damaged);
+    classifier->tiles = tiles;
+    classifier->damaged = damaged;
+    classifier->width = width;
+    classifier->height = height;
+    classifier->tiles_x = tiles_x;
+    classifier->tiles_y = tiles_y;
+
+    return true;
+}
+
+struct westfield_tile_classifier *
+westfield_tile_classifier_create(void) {
+    struct westfield_tile_classifier *classifier;
+
+    classifier = calloc(1, sizeof(*classifier));
+    if (classifier == NULL) {
+        return NULL;
+    }
+    classifier->hysteresis = MIN_HYSTERESIS;
+
+    return classifier;
+}
+
+void
+westfield_tile_classifier_destroy(struct westfield_tile_classifier *classifier) {
+    free(classifier->tiles);
+    free(classifier->damaged);
+    free(classifier);
+}
+
+bool
+westfield_tile_classifier_classify_shm_buffer(struct westfield_tile_classifier *classifier,
+                                              struct wl_shm_buffer *buffer,
+                                              const struct westfield_rect *damage, uint32_t damage_count,
+                                              struct wl_array *tags) {
+    int32_t width, height, stride;
+    uint32_t format, color_mask;
+    const uint8_t *data;
+
+    format = wl_shm_buffer_get_format(buffer);
+    if (format == WL_SHM_FORMAT_ARGB8888) {
+        color_mask = 0xffffffff;
+    } else if (format == WL_SHM_FORMAT_XRGB8888) {
+        color_mask = 0x00ffffff;
+    } else {
+        return false;
+    }
+
+    width = wl_shm_buffer_get_width(buffer);
+    height = wl_shm_buffer_get_height(buffer);
+    stride = wl_shm_buffer_get_stride(buffer);
+
+    if ((classifier->width != width || classifier->height != height) && !resize(classifier, width, height)) {
+        return false;
+    }
+
+    classifier->frame++;
+    if (classifier->frame - classifier->last_flap_frame > SETTLE_WINDOW && classifier->hysteresis > MIN_HYSTERESIS) {
+        classifier->hysteresis--;
+        classifier->last_flap_frame = classifier->frame;
+    }
+
+    for (uint32_t i = 0; i < damage_count; i++) {
+        int32_t x0 = damage[i].x < 0 ? 0 : damage[i].x;
+        int32_t y0 = damage[i].y < 0 ? 0 : damage[i].y;
+        // widened, damage comes from the client and the sums can overflow
+        int64_t x1 = (int64_t) damage[i].x + damage[i].width > width ? width : (int64_t) damage[i].x + damage[i].width;
+        int64_t y1 = (int64_t) damage[i].y + damage[i].height > height ? height : (int64_t) damage[i].y + damage[i].height;
+
+        if (x0 >= x1 || y0 >= y1) {
+            continue;
+        }
+        for (int32_t ty = y0 / WESTFIELD_TILE_SIZE; ty <= (y1 - 1) / WESTFIELD_TILE_SIZE; ty++) {
+            for (int32_t tx = x0 / WESTFIELD_TILE_SIZE; tx <= (x1 - 1) / WESTFIELD_TILE_SIZE; tx++) {
+                classifier->damaged[ty * classifier->tiles_x + tx] = true;
+            }
+        }
+    }
+
+    wl_shm_buffer_begin_access(buffer);
+    data = wl_shm_buffer_get_data(buffer);
+    for (int32_t ty = 0; ty < classifier->tiles_y; ty++) {
+        for (int32_t tx = 0; tx < classifier->tiles_x; tx++) {
+            int32_t index = ty * classifier->tiles_x + tx;
+            struct tile_state *tile = &classifier->tiles[index];
+            struct westfield_tile_tag *tag;
+            struct tile_scores scores;
+            int32_t x = tx * WESTFIELD_TILE_SIZE, y = ty * WESTFIELD_TILE_SIZE;
+            int32_t tile_width = width - x < WESTFIELD_TILE_SIZE ? width - x : WESTFIELD_TILE_SIZE;
+            int32_t tile_height = height - y < WESTFIELD_TILE_SIZE ? height - y : WESTFIELD_TILE_SIZE;
+
+            if (!classifier->damaged[index]) {
+                continue;
+            }
+            classifier->damaged[index] = false;
+
+            score_tile(data, stride, color_mask, x, y, tile_width, tile_height, &scores);
+            update_tile(classifier, tile, &scores);
+            classifier->stats.tiles[tile->tile_class]++;
+
+            tag = wl_array_add(tags, sizeof(*tag));
+            if (tag == NULL) {
+                continue;
+            }
+            tag->rect.x = x;
+            tag->rect.y = y;
+            tag->rect.width = tile_width;
+            tag->rect.height = tile_height;
+            tag->tile_class = tile->tile_class;
+        }
+    }
+    wl_shm_buffer_end_access(buffer);
+
+    return true;
+}
+
+void
+westfield_tile_classifier_report_encoded(struct westfield_tile_classifier *classifier,
+                                         enum westfield_tile_class tile_class,
+                                         uint64_t raw_bytes, uint64_t encoded_bytes) {
+    if (tile_class != WESTFIELD_TILE_LOSSLESS && tile_class != WESTFIELD_TILE_LOSSY) {
+        return;
+    }
+    classifier->stats.raw_bytes[tile_class] += raw_bytes;
+    classifier->stats.encoded_bytes[tile_class] += encoded_bytes;
+}
+
+void
+westfield_tile_classifier_get_stats(struct westfield_tile_classifier *classifier,
+                                    struct westfield_tile_classifier_stats *stats) {
+    *stats = classifier->stats;
+
+    if (stats->raw_bytes[WESTFIELD_TILE_LOSSLESS] == 0) {
+        stats->bytes_saved = 0;
+        return;
+    }
+
+    stats->bytes_saved = (int64_t) ((double) stats->raw_bytes[WESTFIELD_TILE_LOSSY] *
+                                    (double) stats->encoded_bytes[WESTFIELD_TILE_LOSSLESS] /
+                                    (double) stats->raw_bytes[WESTFIELD_TILE_LOSSLESS]) -
+                         (int64_t) stats->encoded_bytes[WESTFIELD_TILE_LOSSY];
+}
@@ -0,0 +1,74 @@
+#ifndef WESTFIELD_WESTFIELD_TILE_CLASSIFIER_H
+#define WESTFIELD_WESTFIELD_TILE_CLASSIFIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+#include "westfield-util.h"
+
+#define WESTFIELD_TILE_SIZE 64
+
+enum westfield_tile_class {
+    // text, UI and other content with few colors and hard edges
+    WESTFIELD_TILE_LOSSLESS = 0,
+    // photo and video content with many colors and smooth gradients
+    WESTFIELD_TILE_LOSSY = 1,
+};
+
+/**
+ * Classifies the damaged tiles of a surface as suited for lossless or lossy encoding.
+ *
+ * A surface is divided into WESTFIELD_TILE_SIZE tiles. Each damaged tile is scored on the number of distinct colors it
+ * holds, the share of small (smooth) luma gradients between neighbouring pixels and how often the tile changed
+ * recently. A tile only changes class after the score has disagreed with its current class for a number of
+ * consecutive frames. That number grows when tiles of the surface flap between classes and shrinks again when they
+ * settle.
+ */
+struct westfield_tile_classifier;
+
+struct westfield_tile_tag {
+    struct westfield_rect rect;
+    enum westfield_tile_class tile_class;
+};
+
+struct westfield_tile_classifier_stats {
+    uint64_t tiles[2];
+    uint64_t class_flips;
+    // as reported with westfield_tile_classifier_report_encoded, indexed by enum westfield_tile_class
+    uint64_t raw_bytes[2];
+    uint64_t encoded_bytes[2];
+    /**
+     * Estimated number of bytes saved by encoding lossy tiles lossy: the lossy raw bytes at the observed lossless
+     * compression ratio minus the actual lossy encoded bytes.
+     */
+    int64_t bytes_saved;
+};
+
+struct westfield_tile_classifier *
+westfield_tile_classifier_create(void);
+
+void
+westfield_tile_classifier_destroy(struct westfield_tile_classifier *classifier);
+
+/**
+ * Tag every tile of an ARGB8888 or XRGB8888 shm buffer that intersects the damage. Tags are appended to tags as
+ * struct westfield_tile_tag, in row major tile order and clipped to the buffer size.
+ *
+ * Returns false if the buffer format is not supported.
+ */
+bool
+westfield_tile_classifier_classify_shm_buffer(struct westfield_tile_classifier *classifier,
+                                              struct wl_shm_buffer *buffer,
+                                              const struct westfield_rect *damage, uint32_t damage_count,
+                                              struct wl_array *tags);
+
+void
+westfield_tile_classifier_report_encoded(struct westfield_tile_classifier *classifier,
+                                         enum westfield_tile_class tile_class,
+                                         uint64_t raw_bytes, uint64_t encoded_bytes);
+
+void
+westfield_tile_classifier_get_stats(struct westfield_tile_classifier *classifier,
+                                    struct westfield_tile_classifier_stats *stats);
+
+#endif //WESTFIELD_WESTFIELD_TILE_CLASSIFIER_H
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "westfield-transfer.h"
+
+// big enough to move a large clipboard image in few syscalls, the kernel clamps it to /proc/sys/fs/pipe-max-size
+#define PIPE_SIZE (1024 * 1024)
+
+struct westfield_transfer {
+    struct wl_event_loop *loop;
+    struct wl_listener loop_destroy_listener;
+    // the loop was destroyed while a callback was running, end the transfer once it returns
+    bool loop_gone;
+    int source_fd, target_fd;
+    // intermediate pipe, data spliced in from source_fd and out to target_fd
+    int pipe_fds[2];
+    size_t pipe_capacity;
+    size_t buffered;
+
+    // NULL while the source is not being polled, see watch_source
+    struct wl_event_source *source_event;
+    struct wl_event_source *target_event;
+    // regular files can't be polled but never block, they are serviced from the handler of the other side
+    bool source_is_file, target_is_file;
+    bool source_eof;
+    // files are read at our own offset, the fd may be a dup sharing its file offset with others
+    loff_t source_offset;
+
+    uint64_t transferred;
+    uint64_t progress_step, next_progress;
+
+    // copy of the data read from the source, see westfield_transfer_set_tap
+    int tap_fd;
+    int tap_pipe_fds[2];
+    size_t tap_pipe_capacity;
+    loff_t tap_offset;
+    uint64_t tap_max_bytes;
+    bool tap_failed;
+    void *tap_data;
+    westfield_transfer_tap_func_t tap_func;
+
+    // a callback is running, destroying the transfer has to wait until it returns
+    bool dispatching;
+    bool cancelled;
+
+    void *user_data;
+    westfield_transfer_progress_func_t progress_func;
+    westfield_transfer_done_func_t done_func;
+};
+
+static int
+on_source_event(int fd, uint32_t mask, void *data);
+
+static void
+close_tap_pipe(struct westfield_transfer *transfer) {
+    if (transfer->tap_pipe_fds[0] >= 0) {
+        close(transfer->tap_pipe_fds[0]);
+        close(transfer->tap_pipe_fds[1]);
+        transfer->tap_pipe_fds[0] = -1;
+    }
+}
+
+static void
+end_tap(struct westfield_transfer *transfer, bool complete) {
+    westfield_transfer_tap_func_t tap_func = transfer->tap_func;
+
+    close_tap_pipe(transfer);
+    if (tap_func) {
+        transfer->tap_func = NULL;
+        tap_func(transfer->tap_data, transfer->tap_fd, (uint64_t) transfer->tap_offset,
+                 complete && !transfer->tap_failed);
+    }
+}
+
+/**
+ * Duplicate the size bytes that were just spliced into the, otherwise empty, intermediate pipe to the tap file.
+ */
+static void
+tap(struct westfield_transfer *transfer, size_t size) {
+    ssize_t moved;
+
+    if ((uint64_t) transfer->tap_offset + size > transfer->tap_max_bytes) {
+        transfer->tap_failed = true;
+        close_tap_pipe(transfer);
+        return;
+    }
+
+    // the tap pipe is empty and at least as big as what was read, so this copies all of it
+    moved = tee(transfer->pipe_fds[0], transfer->tap_pipe_fds[1], size, SPLICE_F_NONBLOCK);
+    if (moved != (ssize_t) size) {
+        transfer->tap_failed = true;
+        close_tap_pipe(transfer);
+        return;
+    }
+
+    while (size > 0) {
+        moved = splice(transfer->tap_pipe_fds[0], NULL, transfer->tap_fd, &transfer->tap_offset, size, SPLICE_F_MOVE);
+        if (moved <= 0 && !(moved < 0 && errno == EINTR)) {
+            transfer->tap_failed = true;
+            close_tap_pipe(transfer);
+            return;
+        }
+        if (moved > 0) {
+            size -= moved;
+        }
+    }
+}
+
+static bool
+tapping(struct westfield_transfer *transfer) {
+    return transfer->tap_func && !transfer->tap_failed;
+}
+
+static void
+destroy(struct westfield_transfer *transfer) {
+    end_tap(transfer, false);
+    wl_list_remove(&transfer->loop_destroy_listener.link);
+    if (transfer->source_event) {
+        wl_event_source_remove(transfer->source_event);
+    }
+    if (transfer->target_event) {
+        wl_event_source_remove(transfer->target_event);
+    }
+    if (transfer->pipe_fds[0] >= 0) {
+        close(transfer->pipe_fds[0]);
+        close(transfer->pipe_fds[1]);
+    }
+    close(transfer->source_fd);
+    if (transfer->target_fd >= 0) {
+        close(transfer->target_fd);
+    }
+    free(transfer);
+}
+
+static void
+finish(struct westfield_transfer *transfer, enum westfield_transfer_status status, int error) {
+    // close the target first, so the reader sees end of file before anything else happens
+    if (transfer->target_event) {
+        wl_event_source_remove(transfer->target_event);
+        transfer->target_event = NULL;
+    }
+    close(transfer->target_fd);
+    transfer->target_fd = -1;
+
+    // before the done callback, so a new transfer started from it can already use the tapped copy
+    end_tap(transfer, status == WESTFIELD_TRANSFER_DONE);
+
+    transfer->dispatching = true;
+    transfer->done_func(transfer->user_data, status, transfer->transferred, error);
+    transfer->dispatching = false;
+
+    destroy(transfer);
+}
+
+/**
+ * Poll the source only while the intermediate pipe has room. The source is removed from the loop rather than given an
+ * empty mask, as a hung up pipe is reported regardless of the mask and would wake the loop over and over.
+ */
+static void
+watch_source(struct westfield_transfer *transfer, bool watch) {
+    if (transfer->source_is_file || watch == (transfer->source_event != NULL)) {
+        return;
+    }
+
+    if (watch) {
+        transfer->source_event = wl_event_loop_add_fd(transfer->loop, transfer->source_fd, WL_EVENT_READABLE,
+                                                      on_source_event, transfer);
+    } else {
+        wl_event_source_remove(transfer->source_event);
+        transfer->source_event = NULL;
+    }
+}
+
+/**
+ * Move as much data as possible without blocking. Returns false if the transfer is over and has been destroyed.
+ */
+static bool
+pump(struct westfield_transfer *transfer) {
+    bool source_blocked = false, target_blocked = false;
+    ssize_t moved;
+
+    while (!transfer->cancelled && !transfer->loop_gone) {
+        bool progressed = false;
+
+        // tee() always copies from the start of the pipe, so while tapping only read into an empty pipe
+        if (!transfer->source_eof && !source_blocked &&
+            (tapping(transfer) ? transfer->buffered == 0 : transfer->buffered < transfer->pipe_capacity)) {
+            moved = splice(transfer->source_fd, transfer->source_is_file ? &transfer->source_offset : NULL,
+                           transfer->pipe_fds[1], NULL,
+                           (tapping(transfer) ? transfer->tap_pipe_capacity : transfer->pipe_capacity) -
+                           transfer->buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                if (tapping(transfer)) {
+                    tap(transfer, moved);
+                }
+                transfer->buffered += moved;
+                progressed = true;
+            } else if (moved == 0) {
+                transfer->source_eof = true;
+            } else if (errno == EAGAIN) {
+                source_blocked = true;
+            } else if (errno != EINTR) {
+                finish(transfer, WESTFIELD_TRANSFER_ERROR, errno);
+                return false;
+            }
+        }
+
+        if (transfer->buffered > 0 && !target_blocked) {
+            moved = splice(transfer->pipe_fds[0], NULL, transfer->target_fd, NULL, transfer->buffered,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                transfer->buffered -= moved;
+                transfer->transferred += moved;
+                progressed = true;
+            } else if (moved < 0 && errno == EAGAIN) {
+                target_blocked = true;
+            } else if (moved < 0 && errno != EINTR) {
+                finish(transfer, WESTFIELD_TRANSFER_ERROR, errno);
+                return false;
+            }
+        }
+
+        if (transfer->progress_step && transfer->transferred >= transfer->next_progress) {
+            transfer->next_progress = transfer->transferred + transfer->progress_step;
+            transfer->dispatching = true;
+            transfer->progress_func(transfer->user_data, transfer->transferred);
+            transfer->dispatching = false;
+        }
+
+        if (!progressed) {
+            break;
+        }
+    }
+
+    if (transfer->cancelled) {
+        destroy(transfer);
+        return false;
+    }
+
+    if (transfer->loop_gone) {
+        finish(transfer, WESTFIELD_TRANSFER_ERROR, ECANCELED);
+        return false;
+    }
+
+    if (transfer->source_eof && transfer->buffered == 0) {
+        finish(transfer, WESTFIELD_TRANSFER_DONE, 0);
+        return false;
+    }
+
+    watch_source(transfer, !transfer->source_eof &&
+                           (tapping(transfer) ? transfer->buffered == 0 : transfer->buffered < transfer->pipe_capacity));
+    if (transfer->target_event) {
+        // a file source never blocks, so keep the target polled to pull more from it
+        wl_event_source_fd_update(transfer->target_event,
+                                  transfer->buffered > 0 || transfer->source_is_file ? WL_EVENT_WRITABLE : 0);
+    }
+
+    return true;
+}
+
+static int
+on_source_event(int fd, uint32_t mask, void *data) {
+    pump(data);
+    return 0;
+}
+
+static int
+on_target_event(int fd, uint32_t mask, void *data) {
+    struct westfield_transfer *transfer = data;
+
+    if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+        // nobody is reading anymore
+        finish(transfer, WESTFIELD_TRANSFER_ERROR, EPIPE);
+        return 0;
+    }
+
+    pump(transfer);
+    return 0;
+}
+
+static void
+on_loop_destroyed(struct wl_listener *listener, void *data) {
+    struct westfield_transfer *transfer = wl_container_of(listener, transfer, loop_destroy_listener);
+
+    // nothing can be polled anymore, the sources have to go before the loop does
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+    if (transfer->source_event) {
+        wl_event_source_remove(transfer->source_event);
+        transfer->source_event = NULL;
+    }
+    if (transfer->target_event) {
+        wl_event_source_remove(transfer->target_event);
+        transfer->target_event = NULL;
+    }
+
+    if (transfer->dispatching) {
+        transfer->loop_gone = true;
+        return;
+    }
+    finish(transfer, WESTFIELD_TRANSFER_ERROR, ECANCELED);
+}
+
+static bool
+is_regular_file(int fd) {
+    struct stat statbuf;
+
+    return fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+}
+
+struct westfield_transfer *
+westfield_transfer_create(struct wl_event_loop *loop, int source_fd, int target_fd, uint64_t progress_step,
+                          void *user_data, westfield_transfer_progress_func_t progress_func,
+                          westfield_transfer_done_func_t done_func) {
+    struct westfield_transfer *transfer;
+    int pipe_size;
+
+    transfer = calloc(1, sizeof(*transfer));
+    if (transfer == NULL) {
+        close(source_fd);
+        close(target_fd);
+        return NULL;
+    }
+
+    transfer->loop = loop;
+    transfer->loop_destroy_listener.notify = on_loop_destroyed;
+    wl_event_loop_add_destroy_listener(loop, &transfer->loop_destroy_listener);
+    transfer->tap_fd = -1;
+    transfer->tap_pipe_fds[0] = -1;
+    transfer->source_fd = source_fd;
+    transfer->target_fd = target_fd;
+    transfer->progress_step = progress_step;
+    transfer->next_progress = progress_step;
+    transfer->user_data = user_data;
+    transfer->progress_func = progress_func;
+    transfer->done_func = done_func;
+    transfer->source_is_file = is_regular_file(source_fd);
+    transfer->target_is_file = is_regular_file(target_fd);
+
+    if (transfer->source_is_file && transfer->target_is_file) {
+        // nothing to poll, use copy_file_range instead
+        transfer->pipe_fds[0] = -1;
+        destroy(transfer);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (pipe2(transfer->pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        transfer->pipe_fds[0] = -1;
+        destroy(transfer);
+        return NULL;
+    }
+    pipe_size = fcntl(transfer->pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    if (pipe_size < 0) {
+        pipe_size = fcntl(transfer->pipe_fds[1], F_GETPIPE_SZ);
+    }
+    transfer->pipe_capacity = pipe_size > 0 ? pipe_size : 65536;
+
+    if (!transfer->source_is_file) {
+        fcntl(source_fd, F_SETFL, fcntl(source_fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (!transfer->target_is_file) {
+        fcntl(target_fd, F_SETFL, fcntl(target_fd, F_GETFL) | O_NONBLOCK);
+        transfer->target_event = wl_event_loop_add_fd(loop, target_fd, transfer->source_is_file ? WL_EVENT_WRITABLE : 0,
+                                                      on_target_event, transfer);
+        if (transfer->target_event == NULL) {
+            destroy(transfer);
+            return NULL;
+        }
+    }
+    watch_source(transfer, true);
+    if (!transfer->source_is_file && transfer->source_event == NULL) {
+        destroy(transfer);
+        return NULL;
+    }
+
+    return transfer;
+}
+
+void
+westfield_transfer_cancel(struct westfield_transfer *transfer) {
+    if (transfer->dispatching) {
+        // called from a callback, pump destroys the transfer once the callback returns
+        transfer->cancelled = true;
+        return;
+    }
+    destroy(transfer);
+}
+
+bool
+westfield_transfer_set_tap(struct westfield_transfer *transfer, int tap_fd, uint64_t max_bytes, void *tap_data,
+                           westfield_transfer_tap_func_t tap_func) {
+    int pipe_size;
+
+    if (transfer->tap_func || transfer->buffered || pipe2(transfer->tap_pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return false;
+    }
+
+    pipe_size = fcntl(transfer->tap_pipe_fds[1], F_SETPIPE_SZ, (int) transfer->pipe_capacity);
+    if (pipe_size < 0) {
+        pipe_size = fcntl(transfer->tap_pipe_fds[1], F_GETPIPE_SZ);
+    }
+    if (pipe_size <= 0) {
+        close_tap_pipe(transfer);
+        return false;
+    }
+    transfer->tap_pipe_capacity = (size_t) pipe_size < transfer->pipe_capacity ? pipe_size : transfer->pipe_capacity;
+
+    transfer->tap_fd = tap_fd;
+    transfer->tap_max_bytes = max_bytes;
+    transfer->tap_data = tap_data;
+    transfer->tap_func = tap_func;
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef WESTFIELD_WESTFIELD_TRANSFER_H
+#define WESTFIELD_WESTFIELD_TRANSFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server/wayland-server-core.h"
+
+/**
+ * Moves all data from one fd to another without it passing through user space, like the pipes of a clipboard or drag
+ * and drop transfer.
+ *
+ * Data is spliced from the source into an intermediate pipe and from there into the target, on the given event loop.
+ * The source is only read while the intermediate pipe has room, so a slow target holds back a fast source instead of
+ * data piling up in memory. Pipes, sockets and regular files (like memfds) are supported on either side, as long as not
+ * both sides are regular files.
+ */
+struct westfield_transfer;
+
+enum westfield_transfer_status {
+    // the source reached end of file and everything was written to the target
+    WESTFIELD_TRANSFER_DONE = 0,
+    WESTFIELD_TRANSFER_ERROR = 1,
+};
+
+/**
+ * Called on the event loop thread whenever another progress_step bytes were written to the target.
+ */
+typedef void (*westfield_transfer_progress_func_t)(void *user_data, uint64_t transferred);
+
+/**
+ * Called on the event loop thread once the transfer is over. Both fds are closed and the transfer is destroyed right
+ * after this returns. error holds the errno value that ended the transfer, if it failed. A transfer whose event loop is
+ * destroyed first fails with ECANCELED.
+ */
+typedef void (*westfield_transfer_done_func_t)(void *user_data, enum westfield_transfer_status status,
+                                               uint64_t transferred, int error);
+
+/**
+ * Called once a tapped transfer is over, also when it is cancelled. complete tells whether tap_fd received everything
+ * the source produced. The transfer does not close tap_fd.
+ */
+typedef void (*westfield_transfer_tap_func_t)(void *tap_data, int tap_fd, uint64_t size, bool complete);
+
+/**
+ * Start a transfer. Takes ownership of source_fd and target_fd, also on failure. A progress_step of 0 disables
+ * progress callbacks. Returns NULL on failure, with errno set.
+ */
+struct westfield_transfer *
+westfield_transfer_create(struct wl_event_loop *loop, int source_fd, int target_fd, uint64_t progress_step,
+                          void *user_data, westfield_transfer_progress_func_t progress_func,
+                          westfield_transfer_done_func_t done_func);
+
+/**
+ * Also copy everything read from the source to tap_fd, a regular file, without consuming it, using tee(). Used to keep
+ * a copy of a transfer for later consumers. The tap is abandoned, without affecting the transfer itself, if more than
+ * max_bytes pass through or writing to tap_fd fails.
+ *
+ * Must be called right after westfield_transfer_create, before the event loop is dispatched. Returns false if the tap
+ * could not be set up, in which case tap_func is not called.
+ */
+bool
+westfield_transfer_set_tap(struct westfield_transfer *transfer, int tap_fd, uint64_t max_bytes, void *tap_data,
+                           westfield_transfer_tap_func_t tap_func);
+
+/**
+ * Stop a transfer that is not done yet and close its fds. The done callback is not called.
+ */
+void
+westfield_transfer_cancel(struct westfield_transfer *transfer);
+
+#endif //WESTFIELD_WESTFIELD_TRANSFER_H
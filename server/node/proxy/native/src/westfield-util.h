@@ -2,6 +2,7 @@
 #define WESTFIELD_WESTFIELD_UTIL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
@@ -12,5 +13,9 @@
 #define wfl_log_errno(std, fmt, ...) \
 	wfl_log(std, fmt ": %s", ##__VA_ARGS__, strerror(errno))
 
+struct westfield_rect {
+    int32_t x, y;
+    int32_t width, height;
+};
 
 #endif //WESTFIELD_WESTFIELD_UTIL_H
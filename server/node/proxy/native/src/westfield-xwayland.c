@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
 #include "wayland-server/wayland-util.h"
 
 struct westfield_process;
@@ -38,8 +39,6 @@ struct westfield_xserver {
     pid_t pid;
 };
 
-static struct wl_list child_process_list;
-
 struct westfield_xwayland {
     struct wl_display *wl_display;
     struct westfield_xserver *xserver;
@@ -48,7 +47,9 @@ struct westfield_xwayland {
     struct westfield_process process;
 };
 
-static struct wl_list child_process_list;
+// shared by all threads that run an xwayland, like node workers each owning a display
+static pthread_mutex_t child_process_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct wl_list child_process_list = {&child_process_list, &child_process_list};
 
 int
 westfield_xwayland_get_display(struct westfield_xwayland *westfield_xwayland) {
@@ -57,7 +58,19 @@ westfield_xwayland_get_display(struct westfield_xwayland *westfield_xwayland) {
 
 static void
 westfield_watch_process(struct westfield_process *process) {
+    pthread_mutex_lock(&child_process_mutex);
+    // the xserver is spawned again if it exited
+    wl_list_remove(&process->link);
     wl_list_insert(&child_process_list, &process->link);
+    pthread_mutex_unlock(&child_process_mutex);
+}
+
+static void
+westfield_unwatch_process(struct westfield_process *process) {
+    pthread_mutex_lock(&child_process_mutex);
+    wl_list_remove(&process->link);
+    wl_list_init(&process->link);
+    pthread_mutex_unlock(&child_process_mutex);
 }
 
 static void
@@ -220,12 +233,23 @@ create_lockfile(int display, char *lockfile, size_t lsize) {
 void
 westfield_xwayland_teardown(struct westfield_xwayland *wxw) {
     struct westfield_xserver *wxs = wxw->xserver;
+    char path[256];
+
     if (!wxs)
         return;
 
-    if (wxs->loop)
+    if (wxs->loop) {
         westfield_xserver_shutdown(wxs);
+    } else if (wxs->unix_fd >= 0) {
+        /* prepared but never started */
+        snprintf(path, sizeof path, "/tmp/.X%d-lock", wxs->display);
+        unlink(path);
+        snprintf(path, sizeof path, "/tmp/.X11-unix/X%d", wxs->display);
+        unlink(path);
+        close(wxs->unix_fd);
+    }
 
+    westfield_unwatch_process(&wxw->process);
     free(wxs);
     free(wxw);
 }
@@ -348,9 +372,10 @@ westfield_xserver_handle_event(int listen_fd, uint32_t mask, void *data) {
     return 1;
 }
 
+/* Only touches the file system, so it can run on any thread. */
 static int
-westfield_xserver_listen(struct westfield_xserver *wxs) {
-    char lockfile[256], display_name[8];
+westfield_xserver_bind(struct westfield_xserver *wxs) {
+    char lockfile[256];
     wxs->display = 1;
     retry:
     if (create_lockfile(wxs->display, lockfile, sizeof lockfile) < 0) {
@@ -360,7 +385,6 @@ westfield_xserver_listen(struct westfield_xserver *wxs) {
             wxs->display++;
             goto retry;
         } else {
-            free(wxs);
             return -1;
         }
     }
@@ -368,10 +392,16 @@ westfield_xserver_listen(struct westfield_xserver *wxs) {
     wxs->unix_fd = bind_to_unix_socket(wxs->display);
     if (wxs->unix_fd < 0) {
         unlink(lockfile);
-        free(wxs);
         return -1;
     }
 
+    return 0;
+}
+
+static void
+westfield_xserver_listen(struct westfield_xserver *wxs) {
+    char display_name[8];
+
     snprintf(display_name, sizeof display_name, ":%d", wxs->display);
     printf("xserver listening on display %s\n", display_name);
     setenv("DISPLAY", display_name, 1);
@@ -381,7 +411,6 @@ westfield_xserver_listen(struct westfield_xserver *wxs) {
             wl_event_loop_add_fd(wxs->loop, wxs->unix_fd,
                                  WL_EVENT_READABLE,
                                  westfield_xserver_handle_event, wxs);
-    return 0;
 }
 
 
@@ -420,25 +449,13 @@ xserver_cleanup(struct westfield_process *process, int status) {
 }
 
 struct westfield_xwayland *
-westfield_xwayland_setup(struct wl_display *wl_display,
-                         void *user_data,
-                         westfield_xserver_starting_func_t starting_func,
-                         westfield_xserver_destroyed_func_t destroyed_func) {
-    sigset_t mask;
+westfield_xwayland_prepare(void) {
     struct westfield_xserver *westfield_xserver;
     struct westfield_xwayland *westfield_xwayland;
 
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGPIPE);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
-
     westfield_xserver = calloc(sizeof *westfield_xserver, 1);
     if (westfield_xserver == NULL)
         return NULL;
-    westfield_xserver->user_data = user_data;
-    westfield_xserver->wl_display = (struct wl_display *) wl_display;
-    westfield_xserver->starting_func = starting_func;
-    westfield_xserver->destroyed_func = destroyed_func;
 
     westfield_xwayland = calloc(sizeof *westfield_xwayland, 1);
     if (!westfield_xwayland) {
@@ -447,10 +464,10 @@ westfield_xwayland_setup(struct wl_display *wl_display,
     }
 
     westfield_xserver->xwayland = westfield_xwayland;
-    westfield_xwayland->wl_display = (struct wl_display *) wl_display;
     westfield_xwayland->xserver = westfield_xserver;
     westfield_xwayland->process.cleanup = xserver_cleanup;
-    if (westfield_xserver_listen(westfield_xserver) < 0) {
+    wl_list_init(&westfield_xwayland->process.link);
+    if (westfield_xserver_bind(westfield_xserver) < 0) {
         free(westfield_xserver);
         free(westfield_xwayland);
         return NULL;
@@ -460,6 +477,39 @@ westfield_xwayland_setup(struct wl_display *wl_display,
 }
 
 void
-westfield_xwayland_init(void) {
-    wl_list_init(&child_process_list);
+westfield_xwayland_start(struct westfield_xwayland *westfield_xwayland,
+                         struct wl_display *wl_display,
+                         void *user_data,
+                         westfield_xserver_starting_func_t starting_func,
+                         westfield_xserver_destroyed_func_t destroyed_func) {
+    struct westfield_xserver *westfield_xserver = westfield_xwayland->xserver;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    westfield_xserver->user_data = user_data;
+    westfield_xserver->wl_display = (struct wl_display *) wl_display;
+    westfield_xserver->starting_func = starting_func;
+    westfield_xserver->destroyed_func = destroyed_func;
+    westfield_xwayland->wl_display = (struct wl_display *) wl_display;
+
+    westfield_xserver_listen(westfield_xserver);
+}
+
+struct westfield_xwayland *
+westfield_xwayland_setup(struct wl_display *wl_display,
+                         void *user_data,
+                         westfield_xserver_starting_func_t starting_func,
+                         westfield_xserver_destroyed_func_t destroyed_func) {
+    struct westfield_xwayland *westfield_xwayland;
+
+    westfield_xwayland = westfield_xwayland_prepare();
+    if (westfield_xwayland == NULL)
+        return NULL;
+
+    westfield_xwayland_start(westfield_xwayland, wl_display, user_data, starting_func, destroyed_func);
+
+    return westfield_xwayland;
 }
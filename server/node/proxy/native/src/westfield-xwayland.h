@@ -45,8 +45,24 @@ westfield_xwayland_setup(struct wl_display *wl_display,
                          westfield_xserver_starting_func_t starting_func,
                          westfield_xserver_destroyed_func_t destroyed_func);
 
+/**
+ * First half of westfield_xwayland_setup: pick a free X display, take its lock file and bind its socket. Only does
+ * file system work, so it can run off the main thread. The result must be passed to westfield_xwayland_start or
+ * westfield_xwayland_teardown.
+ */
+struct westfield_xwayland *
+westfield_xwayland_prepare(void);
+
+/**
+ * Second half of westfield_xwayland_setup: export DISPLAY and start listening for X clients on the event loop of
+ * wl_display. Must run on the thread that dispatches wl_display.
+ */
 void
-westfield_xwayland_init(void);
+westfield_xwayland_start(struct westfield_xwayland *westfield_xwayland,
+                         struct wl_display *wl_display,
+                         void *user_data,
+                         westfield_xserver_starting_func_t starting_func,
+                         westfield_xserver_destroyed_func_t destroyed_func);
 
 int
 westfield_xwayland_get_display(struct westfield_xwayland *westfield_xwayland);
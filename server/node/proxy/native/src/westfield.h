@@ -8,6 +8,17 @@
 #include "westfield-fdutils.h"
 #include "westfield-egl.h"
 #include "westfield-xwayland.h"
+#include "westfield-encoder.h"
+#include "westfield-scroll-detect.h"
+#include "westfield-tile-classifier.h"
+#include "westfield-pixel-cache.h"
+#include "westfield-cursor.h"
+#include "westfield-downscale.h"
+#include "westfield-quality.h"
+#include "westfield-memfd-cache.h"
+#include "westfield-transfer.h"
+#include "westfield-clipboard-cache.h"
+#include "westfield-shard.h"
 #include "wayland-server/westfield-wayland-server.h"
 
 #endif //WESTFIELD_WESTFIELD_H
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "wayland-server-protocol.h"
+#include "westfield-cursor.h"
+#include "test-client.h"
+#include "test-util.h"
+
+#define POOL_SIZE 65536
+#define CURSOR_SIZE 4096
+
+struct cursor_test {
+    struct test_client test_client;
+    uint32_t pool_id;
+    uint8_t *data;
+    int32_t next_offset;
+};
+
+static void
+cursor_test_init(struct cursor_test *test) {
+    test_client_init(&test->test_client);
+    wl_display_add_shm_format(test->test_client.display, WL_SHM_FORMAT_ABGR8888);
+    test->pool_id = test_client_create_pool(&test->test_client, POOL_SIZE, (void **) &test->data);
+    test->next_offset = 0;
+}
+
+static void
+cursor_test_release(struct cursor_test *test) {
+    munmap(test->data, POOL_SIZE);
+    test_client_release(&test->test_client);
+}
+
+/* A buffer of 8x8 pixels that all have the given value, padded to the given stride */
+static struct wl_shm_buffer *
+create_cursor_buffer(struct cursor_test *test, uint32_t pixel, int32_t stride, uint32_t format) {
+    uint8_t *data = test->data + test->next_offset;
+    uint32_t buffer_id;
+
+    test_assert(test->next_offset + CURSOR_SIZE <= POOL_SIZE);
+    memset(data, 0x55, CURSOR_SIZE);
+    for (int32_t y = 0; y < 8; y++) {
+        for (int32_t x = 0; x < 8; x++) {
+            memcpy(data + y * stride + x * 4, &pixel, sizeof(pixel));
+        }
+    }
+
+    buffer_id = test_client_create_buffer(&test->test_client, test->pool_id, test->next_offset, 8, 8, stride, format);
+    test->next_offset += CURSOR_SIZE;
+    test_assert(test_client_roundtrip(&test->test_client));
+
+    return test_client_get_shm_buffer(&test->test_client, buffer_id);
+}
+
+/* Update the cache and check that nothing was evicted */
+static void
+update(struct westfield_cursor_cache *cache, struct wl_shm_buffer *buffer, int32_t hotspot_x, int32_t hotspot_y,
+       struct westfield_cursor *cursor) {
+    struct wl_array evicted_ids;
+
+    wl_array_init(&evicted_ids);
+    test_assert(westfield_cursor_cache_update(cache, buffer, hotspot_x, hotspot_y, cursor, &evicted_ids));
+    test_assert(evicted_ids.size == 0);
+    wl_array_release(&evicted_ids);
+}
+
+static void
+test_known_cursor_is_sent_once(void) {
+    struct westfield_cursor_cache *cache = westfield_cursor_cache_create(8);
+    struct wl_shm_buffer *buffer, *same_pixels, *other_pixels;
+    struct westfield_cursor cursor, again;
+    struct cursor_test test;
+
+    cursor_test_init(&test);
+    buffer = create_cursor_buffer(&test, 0x80112233, 32, WL_SHM_FORMAT_ARGB8888);
+    same_pixels = create_cursor_buffer(&test, 0x80112233, 48, WL_SHM_FORMAT_ARGB8888);
+    other_pixels = create_cursor_buffer(&test, 0x80112234, 32, WL_SHM_FORMAT_ARGB8888);
+
+    update(cache, buffer, 1, 2, &cursor);
+    test_assert(cursor.is_new);
+    test_assert(cursor.id != 0);
+    test_assert(cursor.width == 8 && cursor.height == 8);
+    test_assert(cursor.hotspot_x == 1 && cursor.hotspot_y == 2);
+    test_assert(cursor.pixels != NULL);
+    // tightly packed, without the stride padding
+    for (int i = 0; i < 8 * 8; i++) {
+        uint32_t pixel;
+
+        memcpy(&pixel, cursor.pixels + i * 4, sizeof(pixel));
+        test_assert(pixel == 0x80112233);
+    }
+    free(cursor.pixels);
+
+    // equal pixels from another buffer, with a different stride, are the same cursor
+    update(cache, same_pixels, 1, 2, &again);
+    test_assert(!again.is_new);
+    test_assert(again.id == cursor.id);
+    test_assert(again.pixels == NULL);
+
+    // the hotspot is part of the cursor
+    update(cache, same_pixels, 2, 1, &again);
+    test_assert(again.is_new);
+    test_assert(again.id != cursor.id);
+    free(again.pixels);
+
+    update(cache, other_pixels, 1, 2, &again);
+    test_assert(again.is_new);
+    test_assert(again.id != cursor.id);
+    free(again.pixels);
+
+    westfield_cursor_cache_destroy(cache);
+    cursor_test_release(&test);
+}
+
+static void
+test_xrgb_is_made_opaque(void) {
+    struct westfield_cursor_cache *cache = westfield_cursor_cache_create(8);
+    struct westfield_cursor cursor, argb_cursor;
+    struct cursor_test test;
+    uint32_t pixel;
+
+    cursor_test_init(&test);
+
+    update(cache, create_cursor_buffer(&test, 0x00112233, 32, WL_SHM_FORMAT_XRGB8888), 0, 0, &cursor);
+    test_assert(cursor.is_new);
+    memcpy(&pixel, cursor.pixels, sizeof(pixel));
+    test_assert(pixel == 0xff112233);
+    free(cursor.pixels);
+
+    // the browser sees the same image as from an opaque ARGB buffer
+    update(cache, create_cursor_buffer(&test, 0xff112233, 32, WL_SHM_FORMAT_ARGB8888), 0, 0, &argb_cursor);
+    test_assert(!argb_cursor.is_new);
+    test_assert(argb_cursor.id == cursor.id);
+
+    westfield_cursor_cache_destroy(cache);
+    cursor_test_release(&test);
+}
+
+static void
+test_evicts_least_recently_used(void) {
+    struct westfield_cursor_cache *cache = westfield_cursor_cache_create(2);
+    struct westfield_cursor a, b, c, cursor;
+    struct wl_shm_buffer *buffers[3];
+    struct wl_array evicted_ids;
+    struct cursor_test test;
+
+    cursor_test_init(&test);
+    for (int i = 0; i < 3; i++) {
+        buffers[i] = create_cursor_buffer(&test, 0xff000000 + i, 32, WL_SHM_FORMAT_ARGB8888);
+    }
+
+    update(cache, buffers[0], 0, 0, &a);
+    free(a.pixels);
+    update(cache, buffers[1], 0, 0, &b);
+    free(b.pixels);
+    // a is now used more recently than b
+    update(cache, buffers[0], 0, 0, &cursor);
+    test_assert(!cursor.is_new);
+
+    wl_array_init(&evicted_ids);
+    test_assert(westfield_cursor_cache_update(cache, buffers[2], 0, 0, &c, &evicted_ids));
+    test_assert(c.is_new);
+    free(c.pixels);
+    test_assert(evicted_ids.size == sizeof(uint32_t));
+    test_assert(*(uint32_t *) evicted_ids.data == b.id);
+    wl_array_release(&evicted_ids);
+
+    // b has to be sent again, under a new id
+    wl_array_init(&evicted_ids);
+    test_assert(westfield_cursor_cache_update(cache, buffers[1], 0, 0, &cursor, &evicted_ids));
+    test_assert(cursor.is_new);
+    test_assert(cursor.id != b.id);
+    free(cursor.pixels);
+    test_assert(evicted_ids.size == sizeof(uint32_t));
+    test_assert(*(uint32_t *) evicted_ids.data == a.id);
+    wl_array_release(&evicted_ids);
+
+    westfield_cursor_cache_destroy(cache);
+    cursor_test_release(&test);
+}
+
+static void
+test_unsupported_format(void) {
+    struct westfield_cursor_cache *cache = westfield_cursor_cache_create(0);
+    struct wl_shm_buffer *buffer;
+    struct westfield_cursor cursor;
+    struct wl_array evicted_ids;
+    struct cursor_test test;
+
+    cursor_test_init(&test);
+    buffer = create_cursor_buffer(&test, 0xff000000, 32, WL_SHM_FORMAT_ABGR8888);
+
+    wl_array_init(&evicted_ids);
+    test_assert(!westfield_cursor_cache_update(cache, buffer, 0, 0, &cursor, &evicted_ids));
+    test_assert(evicted_ids.size == 0);
+    wl_array_release(&evicted_ids);
+
+    // a cache created with room for no cursors still holds one
+    update(cache, create_cursor_buffer(&test, 0xff000000, 32, WL_SHM_FORMAT_ARGB8888), 0, 0, &cursor);
+    test_assert(cursor.is_new);
+    free(cursor.pixels);
+    update(cache, create_cursor_buffer(&test, 0xff000000, 32, WL_SHM_FORMAT_ARGB8888), 0, 0, &cursor);
+    test_assert(!cursor.is_new);
+
+    westfield_cursor_cache_destroy(cache);
+    cursor_test_release(&test);
+}
+
+int
+main(void) {
+    test_known_cursor_is_sent_once();
+    test_xrgb_is_made_opaque();
+    test_evicts_least_recently_used();
+    test_unsupported_format();
+
+    return EXIT_SUCCESS;
+}
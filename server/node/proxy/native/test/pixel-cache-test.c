@@ -0,0 +1,220 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "wayland-server-protocol.h"
+#include "westfield-pixel-cache.h"
+#include "test-client.h"
+#include "test-util.h"
+
+static void
+take_evicted(struct westfield_pixel_cache *cache, const uint64_t *expected, size_t count) {
+    struct wl_array evicted;
+
+    westfield_pixel_cache_take_evicted(cache, &evicted);
+    test_assert(evicted.size == count * sizeof(uint64_t));
+    test_assert(count == 0 || memcmp(evicted.data, expected, evicted.size) == 0);
+    wl_array_release(&evicted);
+}
+
+static void
+test_lookup_or_insert(void) {
+    struct westfield_pixel_cache *cache = westfield_pixel_cache_create(1000);
+    struct westfield_pixel_cache_stats stats;
+
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 1, 100));
+    test_assert(westfield_pixel_cache_lookup_or_insert(cache, 1, 100));
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 2, 200));
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+    test_assert(stats.lookups == 3);
+    test_assert(stats.hits == 1);
+    test_assert(stats.entries == 2);
+    test_assert(stats.bytes == 300);
+    test_assert(stats.evictions == 0);
+
+    westfield_pixel_cache_remove(cache, 1);
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 1, 100));
+
+    westfield_pixel_cache_destroy(cache);
+}
+
+static void
+test_evicts_least_recently_used(void) {
+    struct westfield_pixel_cache *cache = westfield_pixel_cache_create(300);
+    struct westfield_pixel_cache_stats stats;
+
+    westfield_pixel_cache_lookup_or_insert(cache, 1, 100);
+    westfield_pixel_cache_lookup_or_insert(cache, 2, 100);
+    westfield_pixel_cache_lookup_or_insert(cache, 3, 100);
+    take_evicted(cache, NULL, 0);
+
+    // 1 is now used more recently than 2
+    test_assert(westfield_pixel_cache_lookup_or_insert(cache, 1, 100));
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 4, 100));
+    take_evicted(cache, (uint64_t[]) {2}, 1);
+
+    test_assert(westfield_pixel_cache_lookup_or_insert(cache, 1, 100));
+    test_assert(westfield_pixel_cache_lookup_or_insert(cache, 3, 100));
+    test_assert(westfield_pixel_cache_lookup_or_insert(cache, 4, 100));
+
+    // one large entry pushes out several small ones
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 5, 250));
+    take_evicted(cache, (uint64_t[]) {1, 3, 4}, 3);
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+    test_assert(stats.entries == 1);
+    test_assert(stats.bytes == 250);
+    test_assert(stats.evictions == 4);
+
+    westfield_pixel_cache_destroy(cache);
+}
+
+static void
+test_never_inserts_entries_larger_than_cap(void) {
+    struct westfield_pixel_cache *cache = westfield_pixel_cache_create(100);
+    struct westfield_pixel_cache_stats stats;
+
+    westfield_pixel_cache_lookup_or_insert(cache, 1, 50);
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 2, 101));
+    test_assert(!westfield_pixel_cache_lookup_or_insert(cache, 2, 101));
+    take_evicted(cache, NULL, 0);
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+    test_assert(stats.entries == 1);
+    test_assert(stats.bytes == 50);
+
+    westfield_pixel_cache_destroy(cache);
+}
+
+static void
+test_lowering_cap_evicts(void) {
+    struct westfield_pixel_cache *cache = westfield_pixel_cache_create(1000);
+    struct westfield_pixel_cache_stats stats;
+
+    for (uint64_t hash = 1; hash <= 10; hash++) {
+        westfield_pixel_cache_lookup_or_insert(cache, hash, 100);
+    }
+    westfield_pixel_cache_set_max_bytes(cache, 350);
+    take_evicted(cache, (uint64_t[]) {1, 2, 3, 4, 5, 6, 7}, 7);
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+    test_assert(stats.entries == 3);
+    test_assert(stats.bytes == 300);
+    test_assert(stats.max_bytes == 350);
+
+    westfield_pixel_cache_destroy(cache);
+}
+
+static void
+test_many_entries(void) {
+    struct westfield_pixel_cache *cache = westfield_pixel_cache_create(UINT64_MAX);
+    struct westfield_pixel_cache_stats stats;
+    const uint64_t count = 20000;
+
+    // enough entries to grow the buckets a few times
+    for (uint64_t i = 0; i < count; i++) {
+        test_assert(!westfield_pixel_cache_lookup_or_insert(cache, i * 0x9e3779b97f4a7c15u, 1));
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        test_assert(westfield_pixel_cache_lookup_or_insert(cache, i * 0x9e3779b97f4a7c15u, 1));
+    }
+
+    westfield_pixel_cache_get_stats(cache, &stats);
+    test_assert(stats.entries == count);
+    test_assert(stats.hits == count);
+
+    westfield_pixel_cache_destroy(cache);
+}
+
+static void
+fill(uint8_t *data, int32_t x, int32_t y, int32_t width, int32_t height, int32_t stride, uint8_t seed) {
+    for (int32_t row = 0; row < height; row++) {
+        for (int32_t i = 0; i < width * 4; i++) {
+            data[(size_t) (y + row) * stride + (size_t) x * 4 + i] = (uint8_t) (seed + row * 31 + i);
+        }
+    }
+}
+
+static void
+test_hash_shm_buffer(void) {
+    struct test_client test_client;
+    struct wl_shm_buffer *tight, *padded, *xrgb, *large, *abgr, *reshaped;
+    uint64_t hash, other_hash, size;
+    uint32_t pool_id, tight_id, padded_id, xrgb_id, large_id, abgr_id, reshaped_id;
+    struct westfield_rect region;
+    uint8_t *data;
+
+    test_client_init(&test_client);
+    wl_display_add_shm_format(test_client.display, WL_SHM_FORMAT_ABGR8888);
+
+    pool_id = test_client_create_pool(&test_client, 65536, (void **) &data);
+    memset(data, 0xee, 65536);
+    // the same 8x8 pixels without and with padding between rows, in a different format, and as part of 16x16 pixels
+    fill(data, 0, 0, 8, 8, 32, 1);
+    fill(data + 4096, 0, 0, 8, 8, 48, 1);
+    fill(data + 8192, 0, 0, 8, 8, 32, 1);
+    fill(data + 12288, 4, 2, 8, 8, 64, 1);
+    fill(data + 16384, 0, 0, 8, 8, 32, 1);
+    tight_id = test_client_create_buffer(&test_client, pool_id, 0, 8, 8, 32, WL_SHM_FORMAT_ARGB8888);
+    padded_id = test_client_create_buffer(&test_client, pool_id, 4096, 8, 8, 48, WL_SHM_FORMAT_ARGB8888);
+    xrgb_id = test_client_create_buffer(&test_client, pool_id, 8192, 8, 8, 32, WL_SHM_FORMAT_XRGB8888);
+    large_id = test_client_create_buffer(&test_client, pool_id, 12288, 16, 16, 64, WL_SHM_FORMAT_ARGB8888);
+    abgr_id = test_client_create_buffer(&test_client, pool_id, 16384, 8, 8, 32, WL_SHM_FORMAT_ABGR8888);
+    // the very bytes of the first buffer, as 16x4 pixels
+    reshaped_id = test_client_create_buffer(&test_client, pool_id, 0, 16, 4, 64, WL_SHM_FORMAT_ARGB8888);
+    test_assert(test_client_roundtrip(&test_client));
+
+    tight = test_client_get_shm_buffer(&test_client, tight_id);
+    padded = test_client_get_shm_buffer(&test_client, padded_id);
+    xrgb = test_client_get_shm_buffer(&test_client, xrgb_id);
+    large = test_client_get_shm_buffer(&test_client, large_id);
+    abgr = test_client_get_shm_buffer(&test_client, abgr_id);
+    reshaped = test_client_get_shm_buffer(&test_client, reshaped_id);
+
+    test_assert(westfield_pixel_cache_hash_shm_buffer(tight, NULL, &hash, &size));
+    test_assert(size == 8 * 8 * 4);
+
+    test_assert(westfield_pixel_cache_hash_shm_buffer(padded, NULL, &other_hash, &size));
+    test_assert(other_hash == hash);
+
+    region = (struct westfield_rect) {4, 2, 8, 8};
+    test_assert(westfield_pixel_cache_hash_shm_buffer(large, &region, &other_hash, &size));
+    test_assert(other_hash == hash);
+    test_assert(size == 8 * 8 * 4);
+
+    // the format is part of the hash
+    test_assert(westfield_pixel_cache_hash_shm_buffer(xrgb, NULL, &other_hash, &size));
+    test_assert(other_hash != hash);
+
+    // so are the dimensions
+    test_assert(westfield_pixel_cache_hash_shm_buffer(reshaped, NULL, &other_hash, &size));
+    test_assert(size == 16 * 4 * 4);
+    test_assert(other_hash != hash);
+
+    test_assert(!westfield_pixel_cache_hash_shm_buffer(abgr, NULL, &hash, &size));
+
+    region = (struct westfield_rect) {12, 0, 8, 8};
+    test_assert(!westfield_pixel_cache_hash_shm_buffer(large, &region, &hash, &size));
+    region = (struct westfield_rect) {-1, 0, 8, 8};
+    test_assert(!westfield_pixel_cache_hash_shm_buffer(large, &region, &hash, &size));
+    region = (struct westfield_rect) {0, 0, 0, 8};
+    test_assert(!westfield_pixel_cache_hash_shm_buffer(large, &region, &hash, &size));
+    // x + width would overflow
+    region = (struct westfield_rect) {8, 0, INT32_MAX, 8};
+    test_assert(!westfield_pixel_cache_hash_shm_buffer(large, &region, &hash, &size));
+
+    munmap(data, 65536);
+    test_client_release(&test_client);
+}
+
+int
+main(void) {
+    test_lookup_or_insert();
+    test_evicts_least_recently_used();
+    test_never_inserts_entries_larger_than_cap();
+    test_lowering_cap_evicts();
+    test_many_entries();
+    test_hash_shm_buffer();
+
+    return EXIT_SUCCESS;
+}
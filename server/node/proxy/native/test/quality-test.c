@@ -0,0 +1,175 @@
+#include "westfield-quality.h"
+#include "test-util.h"
+
+#define INTERVAL_MS 250.0
+
+/* One measuring interval in which the browser acknowledges everything that was sent, with the given latency */
+static void
+healthy_interval(struct westfield_quality_controller *controller, double *now_ms, uint64_t bytes, double latency_ms,
+                 struct westfield_quality_decision *decision) {
+    westfield_quality_controller_report_sent(controller, bytes, *now_ms);
+    westfield_quality_controller_report_acked(controller, bytes, latency_ms, *now_ms + latency_ms);
+    *now_ms += INTERVAL_MS;
+    westfield_quality_controller_get_decision(controller, *now_ms, decision);
+}
+
+static void
+test_defaults(void) {
+    struct westfield_quality_config config = {0};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision decision;
+
+    westfield_quality_controller_get_decision(controller, 0, &decision);
+    // a quarter of the way from 250 to 20000 kbps
+    test_assert(decision.bitrate_kbps == 250 + (20000 - 250) / 4);
+    test_assert(decision.compression_level == 4);
+    test_assert(decision.max_fps == 60);
+    test_assert(!decision.congested);
+    westfield_quality_controller_destroy(controller);
+
+    // a maximum below the minimum is raised
+    config.min_bitrate_kbps = 30000;
+    controller = westfield_quality_controller_create(&config);
+    westfield_quality_controller_get_decision(controller, 0, &decision);
+    test_assert(decision.bitrate_kbps == 30000);
+    westfield_quality_controller_destroy(controller);
+}
+
+static void
+test_decides_once_per_interval(void) {
+    struct westfield_quality_config config = {.min_bitrate_kbps = 1000, .max_bitrate_kbps = 11000, .max_fps = 30};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision first, decision;
+
+    westfield_quality_controller_get_decision(controller, 0, &first);
+    westfield_quality_controller_report_sent(controller, 10000, 1000);
+    westfield_quality_controller_report_acked(controller, 10000, 10, 1010);
+    westfield_quality_controller_get_decision(controller, 1000 + INTERVAL_MS - 1, &decision);
+    test_assert(decision.bitrate_kbps == first.bitrate_kbps);
+    test_assert(decision.compression_level == first.compression_level);
+
+    westfield_quality_controller_get_decision(controller, 1000 + INTERVAL_MS, &decision);
+    test_assert(decision.bitrate_kbps == first.bitrate_kbps + 550);
+
+    westfield_quality_controller_destroy(controller);
+}
+
+static void
+test_additive_increase(void) {
+    struct westfield_quality_config config = {.min_bitrate_kbps = 1000, .max_bitrate_kbps = 11000, .max_fps = 30};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision decision;
+    uint32_t bitrate_kbps, compression_level;
+    double now_ms = 0;
+
+    westfield_quality_controller_get_decision(controller, now_ms, &decision);
+    test_assert(decision.bitrate_kbps == 3500);
+
+    // steps of 5% of the maximum, while compression eases off
+    for (int i = 0; i < 4; i++) {
+        bitrate_kbps = decision.bitrate_kbps;
+        compression_level = decision.compression_level;
+        healthy_interval(controller, &now_ms, 50000, 10, &decision);
+        test_assert(!decision.congested);
+        test_assert(decision.bitrate_kbps == bitrate_kbps + 550);
+        test_assert(decision.compression_level == compression_level - 1);
+        test_assert(decision.max_fps == 30);
+    }
+
+    for (int i = 0; i < 20; i++) {
+        healthy_interval(controller, &now_ms, 50000, 10, &decision);
+    }
+    test_assert(decision.bitrate_kbps == 11000);
+    test_assert(decision.compression_level == 0);
+    // 50000 bytes per 250 ms
+    test_assert(decision.bandwidth_kbps > 1599 && decision.bandwidth_kbps < 1601);
+    test_assert(decision.bytes_in_flight == 0);
+
+    westfield_quality_controller_destroy(controller);
+}
+
+static void
+test_latency_triggers_decrease(void) {
+    struct westfield_quality_config config = {.min_bitrate_kbps = 1000, .max_bitrate_kbps = 11000, .max_fps = 60};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision before, decision;
+    double now_ms = 0;
+
+    for (int i = 0; i < 4; i++) {
+        healthy_interval(controller, &now_ms, 500000, 10, &before);
+    }
+    test_assert(!before.congested);
+
+    // far above the 10 ms baseline
+    healthy_interval(controller, &now_ms, 500000, 500, &decision);
+    test_assert(decision.congested);
+    test_assert(decision.latency_ms > 10 * 1.5 + 20);
+    test_assert(decision.bitrate_kbps <= before.bitrate_kbps * 0.7);
+    test_assert(decision.compression_level == before.compression_level + 1);
+    test_assert(decision.max_fps == 45);
+
+    // recovers once latency is back to normal
+    for (int i = 0; i < 40 && decision.congested; i++) {
+        healthy_interval(controller, &now_ms, 500000, 10, &decision);
+    }
+    test_assert(!decision.congested);
+
+    westfield_quality_controller_destroy(controller);
+}
+
+static void
+test_unacknowledged_data_triggers_decrease(void) {
+    struct westfield_quality_config config = {.min_bitrate_kbps = 1000, .max_bitrate_kbps = 11000, .max_fps = 60};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision before, decision;
+    double now_ms = 0;
+
+    for (int i = 0; i < 4; i++) {
+        healthy_interval(controller, &now_ms, 100000, 10, &before);
+    }
+
+    // 3200 kbps drains 80000 bytes in 200 ms
+    westfield_quality_controller_report_sent(controller, 1000000, now_ms);
+    now_ms += INTERVAL_MS;
+    westfield_quality_controller_get_decision(controller, now_ms, &decision);
+    test_assert(decision.congested);
+    test_assert(decision.bytes_in_flight == 1000000);
+    test_assert(decision.bitrate_kbps <= before.bitrate_kbps * 0.7);
+    // no higher than what the link was seen to drain, minus headroom
+    test_assert(decision.bitrate_kbps <= decision.bandwidth_kbps * 0.85 + 1);
+
+    westfield_quality_controller_destroy(controller);
+}
+
+static void
+test_bounded_by_config(void) {
+    struct westfield_quality_config config = {.min_bitrate_kbps = 1000, .max_bitrate_kbps = 11000, .max_fps = 60};
+    struct westfield_quality_controller *controller = westfield_quality_controller_create(&config);
+    struct westfield_quality_decision decision;
+    double now_ms = 0;
+
+    healthy_interval(controller, &now_ms, 100000, 10, &decision);
+    // 5 s, well within the time the 10 ms baseline is trusted
+    for (int i = 0; i < 20; i++) {
+        healthy_interval(controller, &now_ms, 100000, 1000, &decision);
+        test_assert(decision.bitrate_kbps >= 1000);
+    }
+    test_assert(decision.congested);
+    test_assert(decision.bitrate_kbps == 1000);
+    test_assert(decision.compression_level == 9);
+    test_assert(decision.max_fps == 5);
+
+    westfield_quality_controller_destroy(controller);
+}
+
+int
+main(void) {
+    test_defaults();
+    test_decides_once_per_interval();
+    test_additive_increase();
+    test_latency_triggers_decrease();
+    test_unacknowledged_data_triggers_decrease();
+    test_bounded_by_config();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wayland-server-protocol.h"
+#include "westfield-wayland-server-extra.h"
+#include "test-client.h"
+#include "test-util.h"
+
+static void
+assert_shm_bytes(struct test_client *test_client, uint64_t mapped, uint64_t stale) {
+    test_assert(wl_client_get_shm_mapped_bytes(test_client->client) == mapped);
+    test_assert(wl_client_get_shm_stale_bytes(test_client->client) == stale);
+}
+
+static void
+test_accounts_pools(void) {
+    struct test_client test_client;
+    uint32_t pool_id, other_pool_id;
+
+    test_client_init(&test_client);
+    assert_shm_bytes(&test_client, 0, 0);
+
+    pool_id = test_client_create_pool(&test_client, 4096, NULL);
+    other_pool_id = test_client_create_pool(&test_client, 16384, NULL);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 4096 + 16384, 0);
+
+    test_client_resize_pool(&test_client, pool_id, 8192);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 8192 + 16384, 0);
+
+    test_client_destroy_pool(&test_client, pool_id);
+    test_client_destroy_pool(&test_client, other_pool_id);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 0, 0);
+
+    test_client_release(&test_client);
+}
+
+static void
+test_buffers_keep_pool_charged(void) {
+    struct test_client test_client;
+    uint32_t pool_id, buffer_id;
+
+    test_client_init(&test_client);
+
+    pool_id = test_client_create_pool(&test_client, 4096, NULL);
+    buffer_id = test_client_create_buffer(&test_client, pool_id, 0, 16, 16, 64, WL_SHM_FORMAT_ARGB8888);
+    test_client_destroy_pool(&test_client, pool_id);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 4096, 0);
+
+    test_client_destroy_buffer(&test_client, buffer_id);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 0, 0);
+
+    test_client_release(&test_client);
+}
+
+static void
+test_accounts_stale_mappings(void) {
+    struct test_client test_client;
+    uint32_t pool_id, buffer_id;
+    struct wl_shm_pool *pool;
+
+    test_client_init(&test_client);
+
+    pool_id = test_client_create_pool(&test_client, 4096, NULL);
+    buffer_id = test_client_create_buffer(&test_client, pool_id, 0, 16, 16, 64, WL_SHM_FORMAT_ARGB8888);
+    test_assert(test_client_roundtrip(&test_client));
+
+    // the compositor still reads the old mapping, so growing the pool keeps it alive
+    pool = wl_shm_buffer_ref_pool(test_client_get_shm_buffer(&test_client, buffer_id));
+    test_client_resize_pool(&test_client, pool_id, 8192);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 8192, 4096);
+
+    wl_shm_pool_unref(pool);
+    assert_shm_bytes(&test_client, 8192, 0);
+
+    // and once the client dropped it, the compositor's reference isn't charged at all
+    pool = wl_shm_buffer_ref_pool(test_client_get_shm_buffer(&test_client, buffer_id));
+    test_client_destroy_buffer(&test_client, buffer_id);
+    test_client_destroy_pool(&test_client, pool_id);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 0, 0);
+    wl_shm_pool_unref(pool);
+    assert_shm_bytes(&test_client, 0, 0);
+
+    test_client_release(&test_client);
+}
+
+static void
+test_create_pool_beyond_quota_disconnects(void) {
+    struct test_client test_client;
+
+    test_client_init(&test_client);
+    wl_client_set_shm_quota(test_client.client, 12288);
+    test_assert(wl_client_get_shm_quota(test_client.client) == 12288);
+
+    test_client_create_pool(&test_client, 4096, NULL);
+    test_client_create_pool(&test_client, 8192, NULL);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 12288, 0);
+
+    test_client_create_pool(&test_client, 1, NULL);
+    test_assert(!test_client_roundtrip(&test_client));
+
+    test_client_release(&test_client);
+}
+
+static void
+test_resize_beyond_quota_disconnects(void) {
+    struct test_client test_client;
+    uint32_t pool_id, buffer_id;
+    struct wl_shm_pool *pool;
+
+    test_client_init(&test_client);
+    wl_client_set_shm_quota(test_client.client, 12288);
+
+    pool_id = test_client_create_pool(&test_client, 4096, NULL);
+    buffer_id = test_client_create_buffer(&test_client, pool_id, 0, 16, 16, 64, WL_SHM_FORMAT_ARGB8888);
+    test_assert(test_client_roundtrip(&test_client));
+
+    // the old mapping stays alive and counts as well: 4096 + 8192 fits, 8192 + 12288 doesn't
+    pool = wl_shm_buffer_ref_pool(test_client_get_shm_buffer(&test_client, buffer_id));
+    test_client_resize_pool(&test_client, pool_id, 8192);
+    test_assert(test_client_roundtrip(&test_client));
+    assert_shm_bytes(&test_client, 8192, 4096);
+
+    test_client_resize_pool(&test_client, pool_id, 12288);
+    test_assert(!test_client_roundtrip(&test_client));
+    wl_shm_pool_unref(pool);
+
+    test_client_release(&test_client);
+}
+
+static void
+test_default_quota(void) {
+    struct test_client test_client;
+    struct wl_client *client;
+    int fds[2];
+
+    test_client_init(&test_client);
+    test_assert(wl_client_get_shm_quota(test_client.client) == 0);
+
+    // only clients that connect afterwards get it
+    wl_display_set_default_shm_quota(test_client.display, 65536);
+    test_assert(wl_client_get_shm_quota(test_client.client) == 0);
+
+    test_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+    client = wl_client_create(test_client.display, fds[0]);
+    test_assert(client != NULL);
+    test_assert(wl_client_get_shm_quota(client) == 65536);
+    wl_client_destroy(client);
+    close(fds[1]);
+
+    test_client_release(&test_client);
+}
+
+int
+main(void) {
+    test_accounts_pools();
+    test_buffers_keep_pool_charged();
+    test_accounts_stale_mappings();
+    test_create_pool_beyond_quota_disconnects();
+    test_resize_beyond_quota_disconnects();
+    test_default_quota();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wayland-server-protocol.h"
+#include "westfield-wayland-server-extra.h"
+#include "test-client.h"
+#include "test-util.h"
+
+#define DISPLAY_ID 1
+#define REGISTRY_ID 2
+
+// request opcodes, only the client protocol header defines them
+#define WL_DISPLAY_GET_REGISTRY 1
+#define WL_REGISTRY_BIND 0
+#define WL_SHM_CREATE_POOL 0
+#define WL_SHM_POOL_CREATE_BUFFER 0
+#define WL_SHM_POOL_DESTROY 1
+#define WL_SHM_POOL_RESIZE 2
+#define WL_BUFFER_DESTROY 0
+
+// the wl_global_cb_t of the display takes no user data
+static uint32_t last_global_name;
+
+static void
+handle_global_created(struct wl_display *display, uint32_t name) {
+    last_global_name = name;
+}
+
+static void
+handle_client_destroy(struct wl_listener *listener, void *data) {
+    struct test_client *test_client = wl_container_of(listener, test_client, client_destroy_listener);
+
+    test_client->client = NULL;
+}
+
+static void
+send_request(struct test_client *test_client, uint32_t object_id, uint32_t opcode, const uint32_t *args,
+             size_t arg_count, int fd) {
+    uint32_t message[16];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    size_t size = (2 + arg_count) * sizeof(uint32_t);
+
+    test_assert(arg_count <= 14);
+    message[0] = object_id;
+    message[1] = (uint32_t) size << 16 | opcode;
+    memcpy(&message[2], args, arg_count * sizeof(uint32_t));
+
+    iov.iov_base = message;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    test_assert(sendmsg(test_client->fd, &msg, MSG_NOSIGNAL) == (ssize_t) size);
+}
+
+/* Throw away every event the display sent so far */
+static void
+discard_events(struct test_client *test_client) {
+    char buffer[4096];
+    ssize_t len;
+
+    for (;;) {
+        len = read(test_client->fd, buffer, sizeof(buffer));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            test_assert(len == 0 || errno == EAGAIN);
+            return;
+        }
+    }
+}
+
+static void
+dispatch(struct test_client *test_client) {
+    test_assert(wl_event_loop_dispatch(wl_display_get_event_loop(test_client->display), 0) == 0);
+    wl_display_flush_clients(test_client->display);
+    discard_events(test_client);
+}
+
+void
+test_client_init(struct test_client *test_client) {
+    uint32_t args[8];
+    int fds[2];
+
+    memset(test_client, 0, sizeof(*test_client));
+
+    test_client->display = wl_display_create();
+    test_assert(test_client->display != NULL);
+    // the registry doesn't announce globals, that's left to the compositor, so learn the name of wl_shm here
+    wl_display_set_global_created_cb(test_client->display, handle_global_created);
+    test_assert(wl_display_init_shm(test_client->display) == 0);
+    wl_display_set_global_created_cb(test_client->display, NULL);
+
+    test_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+    test_client->client = wl_client_create(test_client->display, fds[0]);
+    test_assert(test_client->client != NULL);
+    test_client->client_destroy_listener.notify = handle_client_destroy;
+    wl_client_add_destroy_listener(test_client->client, &test_client->client_destroy_listener);
+    test_client->fd = fds[1];
+    test_assert(fcntl(test_client->fd, F_SETFL, O_NONBLOCK) == 0);
+
+    args[0] = REGISTRY_ID;
+    send_request(test_client, DISPLAY_ID, WL_DISPLAY_GET_REGISTRY, args, 1, -1);
+    args[0] = last_global_name;
+
+    // name, "wl_shm" with its length, version, new id
+    test_client->shm_id = REGISTRY_ID + 1;
+    args[1] = strlen(wl_shm_interface.name) + 1;
+    memset(&args[2], 0, 8);
+    memcpy(&args[2], wl_shm_interface.name, args[1]);
+    args[4] = 1;
+    args[5] = test_client->shm_id;
+    send_request(test_client, REGISTRY_ID, WL_REGISTRY_BIND, args, 6, -1);
+    test_client->next_id = test_client->shm_id + 1;
+
+    test_assert(test_client_roundtrip(test_client));
+}
+
+void
+test_client_release(struct test_client *test_client) {
+    wl_display_destroy_clients(test_client->display);
+    wl_display_destroy(test_client->display);
+    close(test_client->fd);
+}
+
+/* A read stops at every request that carries an fd, so a single dispatch may leave requests behind */
+static bool
+has_pending_requests(struct test_client *test_client) {
+    int pending = 0;
+
+    test_assert(ioctl(wl_client_get_fd(test_client->client), FIONREAD, &pending) == 0);
+    return pending > 0;
+}
+
+bool
+test_client_roundtrip(struct test_client *test_client) {
+    while (test_client->client) {
+        dispatch(test_client);
+        if (test_client->client == NULL || !has_pending_requests(test_client)) {
+            break;
+        }
+    }
+    return test_client->client != NULL;
+}
+
+uint32_t
+test_client_create_pool(struct test_client *test_client, int32_t size, void **data) {
+    uint32_t args[2];
+    int fd;
+
+    fd = memfd_create("westfield-test", MFD_CLOEXEC);
+    test_assert(fd >= 0);
+    test_assert(ftruncate(fd, size) == 0);
+    if (data) {
+        *data = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        test_assert(*data != MAP_FAILED);
+    }
+
+    args[0] = test_client->next_id++;
+    args[1] = (uint32_t) size;
+    send_request(test_client, test_client->shm_id, WL_SHM_CREATE_POOL, args, 2, fd);
+    close(fd);
+
+    return args[0];
+}
+
+void
+test_client_resize_pool(struct test_client *test_client, uint32_t pool_id, int32_t size) {
+    uint32_t arg = (uint32_t) size;
+
+    send_request(test_client, pool_id, WL_SHM_POOL_RESIZE, &arg, 1, -1);
+}
+
+void
+test_client_destroy_pool(struct test_client *test_client, uint32_t pool_id) {
+    send_request(test_client, pool_id, WL_SHM_POOL_DESTROY, NULL, 0, -1);
+}
+
+uint32_t
+test_client_create_buffer(struct test_client *test_client, uint32_t pool_id, int32_t offset,
+                          int32_t width, int32_t height, int32_t stride, uint32_t format) {
+    uint32_t args[6] = {test_client->next_id++, offset, width, height, stride, format};
+
+    send_request(test_client, pool_id, WL_SHM_POOL_CREATE_BUFFER, args, 6, -1);
+
+    return args[0];
+}
+
+void
+test_client_destroy_buffer(struct test_client *test_client, uint32_t buffer_id) {
+    send_request(test_client, buffer_id, WL_BUFFER_DESTROY, NULL, 0, -1);
+}
+
+struct wl_shm_buffer *
+test_client_get_shm_buffer(struct test_client *test_client, uint32_t buffer_id) {
+    struct wl_resource *resource;
+
+    test_assert(test_client->client != NULL);
+    resource = wl_client_get_object(test_client->client, buffer_id);
+    test_assert(resource != NULL);
+
+    return wl_shm_buffer_get(resource);
+}
@@ -0,0 +1,66 @@
+#ifndef WESTFIELD_TEST_CLIENT_H
+#define WESTFIELD_TEST_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wayland-server-core.h"
+
+/**
+ * A client of a real wl_display that talks the wire protocol over a socketpair, without libwayland-client. It only
+ * knows the few requests the tests need to get shm pools and buffers created the way a real client would.
+ *
+ * Requests are written straight to the socket. test_client_roundtrip makes the display dispatch them and throws away
+ * whatever events it sends back.
+ */
+struct test_client {
+    struct wl_display *display;
+    // NULL once the display destroyed the client, e.g. after a protocol error
+    struct wl_client *client;
+    struct wl_listener client_destroy_listener;
+    int fd;
+    uint32_t next_id;
+    uint32_t shm_id;
+};
+
+/**
+ * Create a display with wl_shm and connect a client to it.
+ */
+void
+test_client_init(struct test_client *test_client);
+
+void
+test_client_release(struct test_client *test_client);
+
+/**
+ * Let the display dispatch every request written so far. Returns false if the client was destroyed.
+ */
+bool
+test_client_roundtrip(struct test_client *test_client);
+
+/**
+ * Create a pool backed by a new memfd of the given size. Its data is mapped at *data if data is not NULL and must then
+ * be unmapped by the caller.
+ */
+uint32_t
+test_client_create_pool(struct test_client *test_client, int32_t size, void **data);
+
+void
+test_client_resize_pool(struct test_client *test_client, uint32_t pool_id, int32_t size);
+
+void
+test_client_destroy_pool(struct test_client *test_client, uint32_t pool_id);
+
+uint32_t
+test_client_create_buffer(struct test_client *test_client, uint32_t pool_id, int32_t offset,
+                          int32_t width, int32_t height, int32_t stride, uint32_t format);
+
+void
+test_client_destroy_buffer(struct test_client *test_client, uint32_t buffer_id);
+
+/**
+ * The shm buffer of a buffer id, after a roundtrip.
+ */
+struct wl_shm_buffer *
+test_client_get_shm_buffer(struct test_client *test_client, uint32_t buffer_id);
+
+#endif //WESTFIELD_TEST_CLIENT_H
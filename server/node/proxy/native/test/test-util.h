@@ -0,0 +1,19 @@
+#ifndef WESTFIELD_TEST_UTIL_H
+#define WESTFIELD_TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Abort the test with the failed condition and its location. Unlike assert() it is not compiled out in release
+ * builds.
+ */
+#define test_assert(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: assertion '%s' failed\n", __FILE__, __LINE__, __func__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+#endif //WESTFIELD_TEST_UTIL_H
@@ -0,0 +1,161 @@
+#include "wayland-private.h"
+#include "wayland-server-protocol.h"
+#include "westfield-wayland-server-extra.h"
+#include "test-client.h"
+#include "test-util.h"
+
+static int data[4];
+
+static void
+test_insert_and_remove(void) {
+    struct wl_map map;
+    uint32_t a, b, c;
+
+    wl_map_init(&map, WL_MAP_SERVER_SIDE);
+
+    a = wl_map_insert_new(&map, 0, &data[0]);
+    b = wl_map_insert_new(&map, 0, &data[1]);
+    test_assert(a == WL_SERVER_ID_START);
+    test_assert(b == WL_SERVER_ID_START + 1);
+    test_assert(wl_map_lookup(&map, a) == &data[0]);
+    test_assert(wl_map_lookup(&map, b) == &data[1]);
+    test_assert(wl_map_lookup(&map, b + 1) == NULL);
+
+    // freed ids are reused, the most recently freed first
+    wl_map_remove(&map, a);
+    wl_map_remove(&map, b);
+    test_assert(wl_map_lookup(&map, a) == NULL);
+    test_assert(wl_map_insert_new(&map, 0, &data[2]) == b);
+    c = wl_map_insert_new(&map, 0, &data[3]);
+    test_assert(c == a);
+    test_assert(wl_map_lookup(&map, a) == &data[3]);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == WL_SERVER_ID_START + 2);
+
+    // client ids are appended at the end only
+    test_assert(wl_map_insert_at(&map, 0, 0, NULL) == 0);
+    test_assert(wl_map_insert_at(&map, 0, 2, &data[0]) < 0);
+    test_assert(wl_map_insert_at(&map, WL_MAP_ENTRY_LEGACY, 1, &data[0]) == 0);
+    test_assert(wl_map_lookup(&map, 1) == &data[0]);
+    test_assert(wl_map_lookup_flags(&map, 1) == WL_MAP_ENTRY_LEGACY);
+
+    wl_map_release(&map);
+}
+
+static void
+test_release_reserved(void) {
+    struct wl_map map;
+    uint32_t a, b;
+
+    wl_map_init(&map, WL_MAP_SERVER_SIDE);
+
+    a = wl_map_insert_new(&map, 0, &data[0]);
+    b = wl_map_insert_new(&map, 0, &data[1]);
+    // what wl_resource_destroy_silently leaves behind
+    test_assert(wl_map_insert_at(&map, 0, a, NULL) == 0);
+    test_assert(wl_map_lookup(&map, a) == NULL);
+
+    // a reserved id isn't reused until it's released
+    test_assert(wl_map_insert_new(&map, 0, &data[2]) == WL_SERVER_ID_START + 2);
+    test_assert(wl_map_release_reserved(&map, a) == 0);
+    test_assert(wl_map_insert_new(&map, 0, &data[3]) == a);
+
+    // only reserved server ids can be released
+    test_assert(wl_map_release_reserved(&map, b) < 0);
+    test_assert(wl_map_release_reserved(&map, WL_SERVER_ID_START + 3) < 0);
+    test_assert(wl_map_insert_at(&map, 0, 0, NULL) == 0);
+    test_assert(wl_map_release_reserved(&map, 0) < 0);
+
+    // releasing twice is harmless, also when the id is the only one on the free list
+    test_assert(wl_map_insert_at(&map, 0, b, NULL) == 0);
+    test_assert(wl_map_release_reserved(&map, b) == 0);
+    test_assert(wl_map_release_reserved(&map, b) < 0);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == b);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == WL_SERVER_ID_START + 3);
+
+    wl_map_release(&map);
+
+    // a client side map has no reserved server ids
+    wl_map_init(&map, WL_MAP_CLIENT_SIDE);
+    test_assert(wl_map_insert_at(&map, 0, WL_SERVER_ID_START, NULL) == 0);
+    test_assert(wl_map_release_reserved(&map, WL_SERVER_ID_START) < 0);
+    wl_map_release(&map);
+}
+
+/* Enough entries for several pages of the paged layout, on both sides */
+static void
+test_many_entries(void) {
+    const uint32_t count = 3 * 512 + 7;
+    struct wl_map map;
+    size_t allocated;
+
+    wl_map_init(&map, WL_MAP_SERVER_SIDE);
+
+    for (uint32_t i = 0; i < count; i++) {
+        test_assert(wl_map_insert_at(&map, 0, i, &data[i % 4]) == 0);
+        test_assert(wl_map_insert_new(&map, 0, &data[(i + 1) % 4]) == WL_SERVER_ID_START + i);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        test_assert(wl_map_lookup(&map, i) == &data[i % 4]);
+        test_assert(wl_map_lookup(&map, WL_SERVER_ID_START + i) == &data[(i + 1) % 4]);
+    }
+    test_assert(wl_map_lookup(&map, count) == NULL);
+    test_assert(wl_map_lookup(&map, WL_SERVER_ID_START + count) == NULL);
+
+    // the free list reaches across pages
+    wl_map_remove(&map, WL_SERVER_ID_START + 3);
+    wl_map_remove(&map, WL_SERVER_ID_START + 1000);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == WL_SERVER_ID_START + 1000);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == WL_SERVER_ID_START + 3);
+    test_assert(wl_map_insert_new(&map, 0, &data[0]) == WL_SERVER_ID_START + count);
+
+    allocated = wl_map_get_allocated_size(&map);
+    test_assert(allocated >= 2 * (count + 1) * sizeof(void *));
+#ifdef WL_MAP_PAGED
+    // 4 pages per side and their page tables, never more than a page ahead
+    test_assert(allocated <= 2 * (4 * 512 * sizeof(void *) + 4096));
+#endif
+
+    wl_map_release(&map);
+}
+
+static void
+test_release_server_object_ids(void) {
+    struct test_client test_client;
+    struct wl_resource *resource, *other;
+    uint32_t ids[3], id;
+
+    test_client_init(&test_client);
+
+    // server object ids are handed out in batches and the resources created later
+    wl_get_server_object_ids_batch(test_client.client, ids, 2);
+    test_assert(ids[0] >= WL_SERVER_ID_START);
+    resource = wl_resource_create(test_client.client, &wl_callback_interface, 1, ids[0]);
+    other = wl_resource_create(test_client.client, &wl_callback_interface, 1, ids[1]);
+    test_assert(resource != NULL && other != NULL);
+    ids[2] = ids[1];
+    ids[1] = ids[0];
+
+    wl_resource_destroy_silently(resource);
+    test_assert(wl_client_get_object(test_client.client, ids[0]) == NULL);
+    wl_get_server_object_ids_batch(test_client.client, &id, 1);
+    test_assert(id != ids[0]);
+
+    // the repeated id and the id of a live resource are skipped
+    test_assert(wl_client_release_server_object_ids(test_client.client, ids, 3) == 1);
+    test_assert(wl_client_get_object(test_client.client, ids[2]) == other);
+
+    wl_get_server_object_ids_batch(test_client.client, &id, 1);
+    test_assert(id == ids[0]);
+
+    test_client_release(&test_client);
+}
+
+int
+main(void) {
+    test_insert_and_remove();
+    test_release_reserved();
+    test_many_entries();
+    test_release_server_object_ids();
+
+    return EXIT_SUCCESS;
+}
@@ -7,6 +7,102 @@ declare namespace westfieldAddon {
     export type WlResource = { _resource_type: never }
     export type DRMHandle = { _drm_handle_type: never }
     export type XWaylandHandle = { _xWayland_handle_type: never }
+    export type EncoderHandle = { _encoder_handle_type: never }
+    export type ScrollDetectorHandle = { _scroll_detector_handle_type: never }
+    export type TileClassifierHandle = { _tile_classifier_handle_type: never }
+    // 0: lossless, 1: lossy
+    export type TileClass = 0 | 1
+    export type PixelCacheHandle = { _pixel_cache_handle_type: never }
+    export type PixelCacheStats = {
+        lookups: number
+        hits: number
+        hitRate: number
+        evictions: number
+        entries: number
+        bytes: number
+        maxBytes: number
+    }
+    export type CursorCacheHandle = { _cursor_cache_handle_type: never }
+    export type CursorImage = {
+        cursorId: number
+        isNew: boolean
+        width: number
+        height: number
+        hotspotX: number
+        hotspotY: number
+        pixels: ArrayBuffer | null
+        evictedCursorIds: Uint32Array
+    }
+    // 0: box, 1: bilinear
+    export type DownscaleFilter = 0 | 1
+    export type DownscaledBuffer = {
+        width: number
+        height: number
+        rects: Int32Array
+        pixels: ArrayBuffer
+    }
+    export type ShmMapOptions = {
+        populateSealed?: boolean
+        hugePages?: boolean
+        sequential?: boolean
+    }
+    export type FaultCounts = {
+        minorFaults: number
+        majorFaults: number
+    }
+    export type ClientMemoryStats = {
+        shmMappedBytes: number
+        shmStaleBytes: number
+        shmQuota: number
+        connectionBytes: number
+        connectionBufferedBytes: number
+        objectMapBytes: number
+    }
+    export type ObjectCacheUsage = {
+        allocated: number
+        reused: number
+        cached: number
+    }
+    export type ObjectCacheStats = {
+        resources: ObjectCacheUsage
+        closures: ObjectCacheUsage
+    }
+    export type QualityControllerHandle = { _quality_controller_handle_type: never }
+    export type QualityDecision = {
+        bitrateKbps: number
+        compressionLevel: number
+        maxFps: number
+        bandwidthKbps: number
+        latencyMs: number
+        bytesInFlight: number
+        congested: boolean
+    }
+    export type TransferHandle = { _transfer_handle_type: never }
+    /**
+     * 0: done, 1: error
+     */
+    export type TransferStatus = 0 | 1
+    export type ClipboardCacheHandle = { _clipboard_cache_handle_type: never }
+    export type DisplayShardHandle = { _display_shard_handle_type: never }
+    export type DisplayShardStats = {
+        clients: number
+        pending: number
+    }
+    export type ClientObject = {
+        id: number
+        interface: string
+        version: number
+    }
+    export type TileClassifierStats = {
+        losslessTiles: number
+        lossyTiles: number
+        classFlips: number
+        losslessRawBytes: number
+        losslessEncodedBytes: number
+        lossyRawBytes: number
+        lossyEncodedBytes: number
+        bytesSaved: number
+    }
     export type ExternalType =
         WlClient
         | WlDisplay
@@ -16,14 +112,26 @@ declare namespace westfieldAddon {
         | WlResource
         | DRMHandle
         | XWaylandHandle
+        | EncoderHandle
+        | ScrollDetectorHandle
+        | TileClassifierHandle
+        | PixelCacheHandle
+        | CursorCacheHandle
+        | QualityControllerHandle
+        | TransferHandle
+        | ClipboardCacheHandle
+        | DisplayShardHandle
 
     function createDisplay(
-        onClientCreated: (wlClient: WlClient) => void,
+        onClientCreated: (wlClient: WlClient, migrated: boolean) => void,
         onGlobalCreated: (globalName: number) => void,
         onGlobalDestroyed: (globalName: number) => void,
     ): WlDisplay
 
-    function setClientDestroyedCallback(wlClient: WlClient, onClientDestroyed: (wlClient: WlClient) => void): void
+    function setClientDestroyedCallback(
+        wlClient: WlClient,
+        onClientDestroyed: (wlClient: WlClient, migrated: boolean, destroyedIds: Uint32Array | null) => void,
+    ): void
 
     function setWireMessageCallback(
         wlClient: WlClient,
@@ -37,6 +145,26 @@ declare namespace westfieldAddon {
 
     function destroyDisplay(wlDisplay: WlDisplay): void
 
+    function setLazyClients(wlDisplay: WlDisplay, enabled: boolean): void
+
+    function addLazyGlobal(wlDisplay: WlDisplay, name: number, interfaceName: string, version: number): void
+
+    function removeLazyGlobal(wlDisplay: WlDisplay, name: number): void
+
+    function createDisplayShard(wlDisplay: WlDisplay): DisplayShardHandle | undefined
+
+    function setDisplayShardFront(displayShard: DisplayShardHandle, front: boolean): void
+
+    function getDisplayShardId(displayShard: DisplayShardHandle): number
+
+    function getDisplayShardIds(): Uint32Array | undefined
+
+    function getDisplayShardStats(shardId: number): DisplayShardStats | undefined
+
+    function migrateClient(displayShard: DisplayShardHandle, wlClient: WlClient, targetShardId: number): boolean
+
+    function getClientObjects(wlClient: WlClient): ClientObject[]
+
     function addSocketAuto(wlDisplay: WlDisplay): string
 
     function destroyClient(wlClient: WlClient): void
@@ -51,11 +179,31 @@ declare namespace westfieldAddon {
 
     function initShm(wlDisplay: WlDisplay): void
 
+    function setShmDirtyTracking(wlDisplay: WlDisplay, enabled: boolean): void
+
+    function collectShmDamage(wlClient: WlClient, bufferId: number): Int32Array | undefined
+
+    function setShmMapOptions(wlDisplay: WlDisplay, options: ShmMapOptions): void
+
+    function prefaultShmBuffer(wlClient: WlClient, bufferId: number, damage: Int32Array): boolean
+
+    function getFaultCounts(): FaultCounts | undefined
+
+    function getClientMemoryStats(wlClient: WlClient): ClientMemoryStats
+
+    function getObjectCacheStats(): ObjectCacheStats
+
+    function setClientShmQuota(wlClient: WlClient, quotaBytes: number): void
+
+    function setDefaultShmQuota(wlDisplay: WlDisplay, quotaBytes: number): void
+
     function initDrm(wlDisplay: WlDisplay): DRMHandle
 
+    function initDrmAsync(wlDisplay: WlDisplay, devicePath: string): Promise<DRMHandle>
+
     function setRegistryCreatedCallback(
         wlClient: WlClient,
-        onRegistryCreated: (wlRegistry: WlRegistry, registryId: number) => void,
+        onRegistryCreated: (wlRegistry: WlRegistry, registryId: number, alreadyAdvertised: boolean) => void,
     ): void
 
     function setSyncDoneCallback(
@@ -87,21 +235,188 @@ declare namespace westfieldAddon {
         onXWaylandDestroyed: () => void,
     ): XWaylandHandle
 
+    function setupXWaylandAsync(
+        wlDisplay: WlDisplay,
+        onXWaylandStarting: (wmFd: number, wlClient: WlClient) => void,
+        onXWaylandDestroyed: () => void,
+    ): Promise<XWaylandHandle>
+
     function teardownXWayland(westfieldXWayland: XWaylandHandle): void
 
     function setBufferCreatedCallback(wlClient: WlClient, onBufferCreated: (bufferId: number) => void): void
 
     function createMemoryMappedFile(contents: Buffer): number
 
+    function createMemoryMappedFileAsync(contents: Buffer): Promise<number>
+
     function getServerObjectIdsBatch(wlClient: WlClient, ids: Uint32Array): void
 
+    function createServerObjectIdPool(wlClient: WlClient, capacity: number, lowWater: number): Uint32Array
+
+    function releaseServerObjectIds(wlClient: WlClient, ids: Uint32Array): number
+
     function makePipe(resultBuffer: Uint32Array): void
 
+    function startTransfer(
+        wlDisplay: WlDisplay,
+        sourceFd: number,
+        targetFd: number,
+        progressStep: number,
+        onProgress: (transferred: number) => void,
+        onDone: (status: TransferStatus, transferred: number, errno: number) => void,
+    ): TransferHandle | undefined
+
+    function cancelTransfer(transfer: TransferHandle): boolean
+
+    function createClipboardCache(maxBytes: number): ClipboardCacheHandle | undefined
+
+    function invalidateClipboardCache(clipboardCache: ClipboardCacheHandle): void
+
+    function clipboardCacheReceive(
+        clipboardCache: ClipboardCacheHandle,
+        wlDisplay: WlDisplay,
+        mimeType: string,
+        targetFd: number,
+        progressStep: number,
+        onProgress: (transferred: number) => void,
+        onDone: (status: TransferStatus, transferred: number, errno: number) => void,
+    ): TransferHandle | undefined
+
+    function clipboardCacheStartTransfer(
+        clipboardCache: ClipboardCacheHandle,
+        wlDisplay: WlDisplay,
+        mimeType: string,
+        sourceFd: number,
+        targetFd: number,
+        progressStep: number,
+        onProgress: (transferred: number) => void,
+        onDone: (status: TransferStatus, transferred: number, errno: number) => void,
+    ): TransferHandle | undefined
+
+    function destroyClipboardCache(clipboardCache: ClipboardCacheHandle): void
+
     function equalValueExternal(objectA: ExternalType, objectB: ExternalType): boolean
 
     function getXWaylandDisplay(xWayland: XWaylandHandle): number
 
     function getCredentials(wlClient: WlClient, pidUidGid: Uint32Array): void
+
+    function createEncoder(
+        wlDisplay: WlDisplay,
+        bitrateKbps: number,
+        keyframeInterval: number,
+        maxFramesInFlight: number,
+        onEncodedFrame: (serial: number, bitstream: ArrayBuffer | null, keyframe: boolean, width: number, height: number) => void,
+    ): EncoderHandle | undefined
+
+    function encodeShmBuffer(encoder: EncoderHandle, wlClient: WlClient, bufferId: number, serial: number): boolean
+
+    function requestEncoderKeyframe(encoder: EncoderHandle): void
+
+    function setEncoderBitrate(encoder: EncoderHandle, bitrateKbps: number): void
+
+    function destroyEncoder(encoder: EncoderHandle): void
+
+    function createScrollDetector(): ScrollDetectorHandle
+
+    /**
+     * copyRects holds [srcX, srcY, dstX, dstY, width, height] tuples relative to the previous frame, to be applied before
+     * the [x, y, width, height] tuples in damageRects are repainted.
+     */
+    function detectScroll(
+        scrollDetector: ScrollDetectorHandle,
+        wlClient: WlClient,
+        bufferId: number,
+    ): { copyRects: Int32Array; damageRects: Int32Array } | undefined
+
+    function destroyScrollDetector(scrollDetector: ScrollDetectorHandle): void
+
+    function createTileClassifier(): TileClassifierHandle
+
+    /**
+     * Returns [x, y, width, height, tileClass] tuples for every tile touched by the [x, y, width, height] damage tuples.
+     */
+    function classifyTiles(
+        tileClassifier: TileClassifierHandle,
+        wlClient: WlClient,
+        bufferId: number,
+        damage: Int32Array,
+    ): Int32Array | undefined
+
+    function reportEncodedTile(
+        tileClassifier: TileClassifierHandle,
+        tileClass: TileClass,
+        rawBytes: number,
+        encodedBytes: number,
+    ): void
+
+    function getTileClassifierStats(tileClassifier: TileClassifierHandle): TileClassifierStats
+
+    function destroyTileClassifier(tileClassifier: TileClassifierHandle): void
+
+    function createPixelCache(maxBytes: number): PixelCacheHandle
+
+    function pixelCacheLookupBuffer(
+        pixelCache: PixelCacheHandle,
+        wlClient: WlClient,
+        bufferId: number,
+    ): { hash: bigint; hit: boolean } | undefined
+
+    function pixelCacheLookupTiles(
+        pixelCache: PixelCacheHandle,
+        wlClient: WlClient,
+        bufferId: number,
+        tiles: Int32Array,
+    ): { hashes: BigUint64Array; hits: Uint8Array } | undefined
+
+    function pixelCacheRemove(pixelCache: PixelCacheHandle, hash: bigint): void
+
+    function pixelCacheTakeEvicted(pixelCache: PixelCacheHandle): BigUint64Array
+
+    function setPixelCacheMaxBytes(pixelCache: PixelCacheHandle, maxBytes: number): void
+
+    function getPixelCacheStats(pixelCache: PixelCacheHandle): PixelCacheStats
+
+    function destroyPixelCache(pixelCache: PixelCacheHandle): void
+
+    function createCursorCache(maxCursors: number): CursorCacheHandle
+
+    function updateCursorImage(
+        cursorCache: CursorCacheHandle,
+        wlClient: WlClient,
+        bufferId: number,
+        hotspotX: number,
+        hotspotY: number,
+    ): CursorImage | undefined
+
+    function destroyCursorCache(cursorCache: CursorCacheHandle): void
+
+    function downscaleShmBuffer(
+        wlClient: WlClient,
+        bufferId: number,
+        filter: DownscaleFilter,
+        scale: number,
+        damage: Int32Array,
+    ): DownscaledBuffer | undefined
+
+    function createQualityController(
+        minBitrateKbps: number,
+        maxBitrateKbps: number,
+        maxFps: number,
+    ): QualityControllerHandle | undefined
+
+    function qualityReportSent(qualityController: QualityControllerHandle, bytes: number, nowMs: number): void
+
+    function qualityReportAcked(
+        qualityController: QualityControllerHandle,
+        bytes: number,
+        latencyMs: number,
+        nowMs: number,
+    ): void
+
+    function getQualityDecision(qualityController: QualityControllerHandle, nowMs: number): QualityDecision
+
+    function destroyQualityController(qualityController: QualityControllerHandle): void
 }
 
 export = westfieldAddon
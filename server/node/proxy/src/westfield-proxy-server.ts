@@ -1,4 +1,6 @@
+import { Worker } from 'worker_threads'
 import westfieldAddon from './westfield-addon'
+import type { CursorCacheHandle, WlClient } from './westfield-addon'
 
 export const {
   createDisplay,
@@ -6,6 +8,16 @@ export const {
   setWireMessageCallback,
   setWireMessageEndCallback,
   destroyDisplay,
+  setLazyClients,
+  addLazyGlobal,
+  removeLazyGlobal,
+  createDisplayShard,
+  getDisplayShardId,
+  getDisplayShardIds,
+  setDisplayShardFront,
+  getDisplayShardStats,
+  migrateClient,
+  getClientObjects,
   addSocketAuto,
   destroyClient,
   sendEvents,
@@ -13,7 +25,17 @@ export const {
   flush,
   getFd,
   initShm,
+  setShmDirtyTracking,
+  collectShmDamage,
+  setShmMapOptions,
+  prefaultShmBuffer,
+  getFaultCounts,
+  getClientMemoryStats,
+  getObjectCacheStats,
+  setClientShmQuota,
+  setDefaultShmQuota,
   initDrm,
+  initDrmAsync,
   setRegistryCreatedCallback,
   setSyncDoneCallback,
   emitGlobals,
@@ -23,14 +45,55 @@ export const {
   createWlResource,
   destroyWlResourceSilently,
   setupXWayland,
+  setupXWaylandAsync,
   teardownXWayland,
   setBufferCreatedCallback,
   createMemoryMappedFile,
+  createMemoryMappedFileAsync,
   getServerObjectIdsBatch,
+  createServerObjectIdPool,
+  releaseServerObjectIds,
   makePipe,
+  startTransfer,
+  cancelTransfer,
+  createClipboardCache,
+  invalidateClipboardCache,
+  clipboardCacheReceive,
+  clipboardCacheStartTransfer,
+  destroyClipboardCache,
   equalValueExternal,
   getXWaylandDisplay,
   getCredentials,
+  createEncoder,
+  encodeShmBuffer,
+  requestEncoderKeyframe,
+  setEncoderBitrate,
+  destroyEncoder,
+  createScrollDetector,
+  detectScroll,
+  destroyScrollDetector,
+  createTileClassifier,
+  classifyTiles,
+  reportEncodedTile,
+  getTileClassifierStats,
+  destroyTileClassifier,
+  createPixelCache,
+  pixelCacheLookupBuffer,
+  pixelCacheLookupTiles,
+  pixelCacheRemove,
+  pixelCacheTakeEvicted,
+  setPixelCacheMaxBytes,
+  getPixelCacheStats,
+  destroyPixelCache,
+  createCursorCache,
+  updateCursorImage,
+  destroyCursorCache,
+  downscaleShmBuffer,
+  createQualityController,
+  qualityReportSent,
+  qualityReportAcked,
+  getQualityDecision,
+  destroyQualityController,
 } = westfieldAddon
 
 export type {
@@ -42,13 +105,42 @@ export type {
   WlResource,
   ExternalType,
   DRMHandle,
-  XWaylandHandle
+  XWaylandHandle,
+  EncoderHandle,
+  ScrollDetectorHandle,
+  TileClassifierHandle,
+  TileClass,
+  TileClassifierStats,
+  PixelCacheHandle,
+  PixelCacheStats,
+  CursorCacheHandle,
+  CursorImage,
+  DownscaleFilter,
+  DownscaledBuffer,
+  QualityControllerHandle,
+  QualityDecision,
+  ShmMapOptions,
+  FaultCounts,
+  ClientMemoryStats,
+  ObjectCacheUsage,
+  ObjectCacheStats,
+  TransferHandle,
+  TransferStatus,
+  ClipboardCacheHandle,
+  DisplayShardHandle,
+  DisplayShardStats,
+  ClientObject,
 } from './westfield-addon'
 
 export type MessageDestination = {
   native: boolean
   browser: boolean
   neverReplies?: boolean
+  /**
+   * The request commits a cursor surface of which the image was already sent with the cursor fast path, so the
+   * surface's buffer contents should not be sent to the browser.
+   */
+  cursorForwarded?: boolean
 }
 
 export class Fixed {
@@ -263,3 +355,183 @@ export function unmarshallArgs(
   }
   return args
 }
+
+export type DisplayShardData = { shardIndex: number; shardCount: number; data: unknown }
+
+/**
+ * Run shardCount copies of workerScript, each in its own worker thread. The addon keeps its state per worker, so every
+ * worker can create and dispatch its own display (and listen on its own socket), spreading clients over as many cores.
+ * Each worker finds a DisplayShardData in `workerData`, with the data given here.
+ *
+ * To serve all shards from a single socket, every worker calls createDisplayShard on its display, and only the worker
+ * that adds the socket calls setDisplayShardFront. Connections are then created on the least loaded shard.
+ *
+ * Shards of other workers are known by their id, see getDisplayShardId and getDisplayShardIds. A worker can move one of
+ * its clients to the shard of another worker with migrateClient, eg to the one with the lowest getDisplayShardStats.
+ */
+export function startDisplayShards(workerScript: string | URL, shardCount: number, data?: unknown): Worker[] {
+  const workers: Worker[] = []
+  for (let shardIndex = 0; shardIndex < shardCount; shardIndex++) {
+    const workerData: DisplayShardData = { shardIndex, shardCount, data }
+    workers.push(new Worker(workerScript, { workerData }))
+  }
+  return workers
+}
+
+const singleServerObjectId = new Uint32Array(1)
+
+/**
+ * Take a reserved server object id from a pool made with createServerObjectIdPool. Only calls into the addon if the
+ * pool ran dry before native could top it up.
+ */
+export function takeServerObjectId(wlClient: WlClient, pool: Uint32Array): number {
+  const taken = pool[0]
+  if (taken === pool[1]) {
+    getServerObjectIdsBatch(wlClient, singleServerObjectId)
+    return singleServerObjectId[0]
+  }
+  const capacity = pool.length - 2
+  pool[0] = taken + 1
+  return pool[2 + (taken % capacity)]
+}
+
+type CursorFastPath = {
+  cursorCache: CursorCacheHandle
+  send: (wlClient: WlClient, message: ArrayBuffer) => void
+}
+
+type CursorSurfaceState = {
+  surfaceId: number
+  cursorRole?: { hotspotX: number; hotspotY: number }
+  pendingAttach?: { bufferId: number; dx: number; dy: number }
+  cursorId?: number
+}
+
+let cursorFastPath: CursorFastPath | undefined
+
+/**
+ * Send the images of cursor surfaces as cursor ids instead of as surface contents. Each image is sent only once, after
+ * which committing the same image again sends just its id. See encodeCursorMessage for the message layout.
+ *
+ * Commits of cursor surfaces are then intercepted with cursorForwarded set, meaning the surface contents were already
+ * taken care of.
+ *
+ * @param maxCursors the number of cursor images the browser keeps
+ * @param send sends a cursor message to the browser of the given client
+ */
+export function enableCursorFastPath(
+  maxCursors: number,
+  send: (wlClient: WlClient, message: ArrayBuffer) => void,
+): void {
+  disableCursorFastPath()
+  cursorFastPath = { cursorCache: createCursorCache(maxCursors), send }
+}
+
+export function disableCursorFastPath(): void {
+  if (cursorFastPath) {
+    destroyCursorCache(cursorFastPath.cursorCache)
+    cursorFastPath = undefined
+  }
+}
+
+function cursorSurfaceState(surface: any, surfaceId: number): CursorSurfaceState {
+  return (surface.cursorSurfaceState ??= { surfaceId })
+}
+
+/**
+ * A cursor message is a sequence of 32-bit words: surfaceId, cursorId, hotspotX, hotspotY, width, height, evictedCount,
+ * followed by evictedCount evicted cursor ids. The hotspot is signed, everything else unsigned. The ARGB pixels of the
+ * cursor follow if the browser has not seen the cursor before. A message with a width and height of 0 only moves the
+ * hotspot of an already shown cursor.
+ */
+function encodeCursorMessage(
+  surfaceId: number,
+  cursor: NonNullable<ReturnType<typeof updateCursorImage>>,
+): ArrayBuffer {
+  const headerLength = 7 + cursor.evictedCursorIds.length
+  const pixelsLength = cursor.pixels ? cursor.pixels.byteLength : 0
+  const message = new ArrayBuffer(headerLength * 4 + pixelsLength)
+  const header = new Uint32Array(message, 0, headerLength)
+  header[0] = surfaceId
+  header[1] = cursor.cursorId
+  header[2] = cursor.hotspotX >>> 0
+  header[3] = cursor.hotspotY >>> 0
+  header[4] = cursor.width
+  header[5] = cursor.height
+  header[6] = cursor.evictedCursorIds.length
+  header.set(cursor.evictedCursorIds, 7)
+  if (cursor.pixels) {
+    new Uint8Array(message, headerLength * 4).set(new Uint8Array(cursor.pixels))
+  }
+  return message
+}
+
+/**
+ * Intercepts wl_pointer.set_cursor, which gives the surface the cursor role. A new hotspot of a surface that already
+ * shows a cursor is sent right away, as no commit follows it.
+ */
+export function interceptSetCursor(
+  pointer: any,
+  _serial: number,
+  surfaceId: number,
+  hotspotX: number,
+  hotspotY: number,
+): MessageDestination {
+  const surface = surfaceId ? pointer.interceptors[surfaceId] : undefined
+  if (cursorFastPath && surface) {
+    const state = cursorSurfaceState(surface, surfaceId)
+    const hotspotChanged =
+      state.cursorRole && (state.cursorRole.hotspotX !== hotspotX || state.cursorRole.hotspotY !== hotspotY)
+    state.cursorRole = { hotspotX, hotspotY }
+    if (hotspotChanged && state.cursorId !== undefined) {
+      const header = new Int32Array([surfaceId, state.cursorId, hotspotX, hotspotY, 0, 0, 0])
+      cursorFastPath.send(surface.wlClient, header.buffer)
+    }
+  }
+  return { native: false, browser: true }
+}
+
+export function interceptSurfaceAttach(surface: any, bufferId: number, dx: number, dy: number): MessageDestination {
+  const state: CursorSurfaceState | undefined = surface.cursorSurfaceState
+  if (cursorFastPath && state) {
+    state.pendingAttach = { bufferId, dx, dy }
+  }
+  return { native: false, browser: true }
+}
+
+/**
+ * Intercepts wl_surface.commit. If the surface has the cursor role, its newly attached buffer is looked up in the cursor
+ * cache and sent as a cursor message.
+ */
+export function interceptSurfaceCommit(surface: any): MessageDestination {
+  const state: CursorSurfaceState | undefined = surface.cursorSurfaceState
+  const pendingAttach = state?.pendingAttach
+  if (cursorFastPath === undefined || state?.cursorRole === undefined || pendingAttach === undefined) {
+    return { native: false, browser: true }
+  }
+  state.pendingAttach = undefined
+
+  const cursorRole = state.cursorRole
+  cursorRole.hotspotX -= pendingAttach.dx
+  cursorRole.hotspotY -= pendingAttach.dy
+  if (pendingAttach.bufferId === 0) {
+    state.cursorId = undefined
+    return { native: false, browser: true }
+  }
+
+  const cursor = updateCursorImage(
+    cursorFastPath.cursorCache,
+    surface.wlClient,
+    pendingAttach.bufferId,
+    cursorRole.hotspotX,
+    cursorRole.hotspotY,
+  )
+  if (cursor === undefined) {
+    // not an shm buffer we can read, let the surface contents go the regular way
+    state.cursorId = undefined
+    return { native: false, browser: true }
+  }
+  state.cursorId = cursor.cursorId
+  cursorFastPath.send(surface.wlClient, encodeCursorMessage(state.surfaceId, cursor))
+  return { native: false, browser: true, cursorForwarded: true }
+}